@@ -0,0 +1,330 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include "bodyStore.h"
+#include "instancePacking.h"
+#include "visibility.h"
+#include "glm/gtc/matrix_transform.hpp"
+#include "physicsEngine.h"
+#include "threadPool.h"
+#include "config.h"
+
+// One row of output. "Interactions" are the unit of work of each benchmark: body pairs for
+// calculateForces (N * (N - 1), also for the tree solvers so they compare against direct),
+// bodies for the per-body passes and vertices for generateSphereVertices.
+struct benchResult {
+    std::string name;
+    size_t n;
+    double interactions;
+    unsigned long iterations;
+    double nsPerCall;
+    double bytesPerBody;
+};
+
+struct benchOptions {
+    size_t minBodies = 100;
+    size_t maxBodies = 1000000;
+    size_t factor = 10;
+    size_t maxPairwise = 100000; //direct O(N^2) solver is skipped above this
+    double budget = 0.25; //seconds spent per measurement
+    bool json = false;
+    std::vector<forceSolver> solvers{forceSolver::direct, forceSolver::barnesHut, forceSolver::fastMultipole};
+    bool directPrecisions = true; //also time the compensated and double direct sums
+};
+
+static void printUsage(const char *program) {
+    std::printf("usage: %s [options]\n"
+                "  --min N           smallest body count (default 100)\n"
+                "  --max N           largest body count (default 1000000)\n"
+                "  --factor N        body count multiplier between rows (default 10)\n"
+                "  --max-pairwise N  largest N for the direct solver (default 100000)\n"
+                "  --solver NAME     direct | barnes-hut | fmm | all (default all); direct also times the\n"
+                "                    compensated and double precision direct sums\n"
+                "  --budget SECONDS  minimum time per measurement (default 0.25)\n"
+                "  --threads N       worker threads, 0 = all hardware threads (default 0)\n"
+                "  --format X        csv | json (default csv)\n"
+                "\n"
+                "Rows report ns_per_interaction, interactions_per_second and bytes_per_body, where\n"
+                "an interaction is a body pair for calculateForces, a body for applyForces,\n"
+                "collisionCheck, mergeCheck, a whole step, generateBodies, packInstances and\n"
+                "cullInstances, and a vertex for generateSphereVertices. bytes_per_body is the resident\n"
+                "size of the data the benchmark reads and writes per body (per vertex for the sphere).\n",
+                program);
+}
+
+static const char *solverName(forceSolver solver) {
+    switch (solver) {
+        case forceSolver::barnesHut:
+            return "barnes-hut";
+        case forceSolver::fastMultipole:
+            return "fmm";
+        default:
+            return "direct";
+    }
+}
+
+template<typename T>
+static double vectorBytes(const std::vector<T> &v) {
+    return static_cast<double>(v.capacity() * sizeof(T));
+}
+
+static double storeBytes(const BodyStore &bodies) {
+    return vectorBytes(bodies.x) + vectorBytes(bodies.y) + vectorBytes(bodies.z) +
+           vectorBytes(bodies.vx) + vectorBytes(bodies.vy) + vectorBytes(bodies.vz) +
+           vectorBytes(bodies.mass) + vectorBytes(bodies.radius) + vectorBytes(bodies.colour);
+}
+
+static double forceBytes(const ForceBuffer &forces) {
+    return vectorBytes(forces.x) + vectorBytes(forces.y) + vectorBytes(forces.z);
+}
+
+// Runs `setup` (untimed) then `run` (timed) until the budget is spent, after one warm-up call.
+static void measure(const benchOptions &options, const std::function<void()> &setup,
+                    const std::function<void()> &run, unsigned long &iterations, double &nsPerCall) {
+    using clock = std::chrono::steady_clock;
+    setup();
+    run();
+    double timed = 0.0;
+    iterations = 0;
+    do {
+        setup();
+        const auto start = clock::now();
+        run();
+        timed += std::chrono::duration<double>(clock::now() - start).count();
+        iterations++;
+    } while (timed < options.budget);
+    nsPerCall = 1e9 * timed / static_cast<double>(iterations);
+}
+
+static void emit(const benchOptions &options, const benchResult &r, bool first) {
+    const double nsPerInteraction = r.nsPerCall / r.interactions;
+    const double perSecond = r.interactions * 1e9 / r.nsPerCall;
+    if (options.json) {
+        std::printf("%s\n  {\"benchmark\": \"%s\", \"n\": %zu, \"interactions\": %.0f, \"iterations\": %lu, "
+                    "\"ns_per_call\": %.1f, \"ns_per_interaction\": %.4f, \"interactions_per_second\": %.4e, "
+                    "\"bytes_per_body\": %.1f}",
+                    first ? "" : ",", r.name.c_str(), r.n, r.interactions, r.iterations, r.nsPerCall,
+                    nsPerInteraction, perSecond, r.bytesPerBody);
+    } else {
+        std::printf("%s,%zu,%.0f,%lu,%.1f,%.4f,%.4e,%.1f\n", r.name.c_str(), r.n, r.interactions, r.iterations,
+                    r.nsPerCall, nsPerInteraction, perSecond, r.bytesPerBody);
+    }
+    std::fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    benchOptions options;
+    CONFIG.seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "missing value for %s\n", arg.c_str());
+            printUsage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (arg == "--min") {
+            options.minBodies = std::strtoul(value, nullptr, 10);
+        } else if (arg == "--max") {
+            options.maxBodies = std::strtoul(value, nullptr, 10);
+        } else if (arg == "--factor") {
+            options.factor = std::strtoul(value, nullptr, 10);
+        } else if (arg == "--max-pairwise") {
+            options.maxPairwise = std::strtoul(value, nullptr, 10);
+        } else if (arg == "--budget") {
+            options.budget = std::strtod(value, nullptr);
+        } else if (arg == "--threads") {
+            CONFIG.numThreads = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--format") {
+            if (std::strcmp(value, "csv") == 0) {
+                options.json = false;
+            } else if (std::strcmp(value, "json") == 0) {
+                options.json = true;
+            } else {
+                std::fprintf(stderr, "unknown format %s\n", value);
+                return 1;
+            }
+        } else if (arg == "--solver") {
+            options.directPrecisions = std::strcmp(value, "all") == 0 || std::strcmp(value, "direct") == 0;
+            if (std::strcmp(value, "all") == 0) {
+                options.solvers = {forceSolver::direct, forceSolver::barnesHut, forceSolver::fastMultipole};
+            } else if (std::strcmp(value, "direct") == 0) {
+                options.solvers = {forceSolver::direct};
+            } else if (std::strcmp(value, "barnes-hut") == 0) {
+                options.solvers = {forceSolver::barnesHut};
+            } else if (std::strcmp(value, "fmm") == 0) {
+                options.solvers = {forceSolver::fastMultipole};
+            } else {
+                std::fprintf(stderr, "unknown solver %s\n", value);
+                return 1;
+            }
+        } else {
+            std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.factor < 2) options.factor = 2;
+    if (options.minBodies < 2) options.minBodies = 2;
+
+    threadPool::getInstance().resize(CONFIG.numThreads);
+    const unsigned int threads = threadPool::getInstance().size();
+    const float defaultMinRadius = CONFIG.minBodyRadius;
+    const float defaultMaxRadius = CONFIG.maxBodyRadius;
+
+    if (options.json) {
+        std::printf("{\"threads\": %u, \"seed\": %u, \"results\": [", threads, CONFIG.seed);
+    } else {
+        std::printf("# threads %u, seed %u\n", threads, CONFIG.seed);
+        std::printf("benchmark,n,interactions,iterations,ns_per_call,ns_per_interaction,"
+                    "interactions_per_second,bytes_per_body\n");
+    }
+
+    bool first = true;
+    auto report = [&](const benchResult &r) {
+        emit(options, r, first);
+        first = false;
+    };
+
+    BodyStore bodies;
+    BodyStore working;
+    ForceBuffer forces;
+    for (size_t n = options.minBodies; n <= options.maxBodies; n *= options.factor) {
+        // the generated shell has a fixed volume, so shrink the bodies with N to keep the
+        // default 1000-body packing and a comparable collision load at every size
+        const float radiusScale = n > 1000 ? std::cbrt(1000.0f / static_cast<float>(n)) : 1.0f;
+        CONFIG.minBodyRadius = defaultMinRadius * radiusScale;
+        CONFIG.maxBodyRadius = defaultMaxRadius * radiusScale;
+        const auto generated = static_cast<unsigned int>(n - 1); //plus the central body
+        benchResult r{};
+        r.n = n;
+
+        r.name = "generateBodies";
+        r.interactions = static_cast<double>(n);
+        measure(options, [] {}, [&] { body::generateBodies(bodies, generated); }, r.iterations, r.nsPerCall);
+        r.bytesPerBody = storeBytes(bodies) / static_cast<double>(n);
+        report(r);
+
+        for (forceSolver solver: options.solvers) {
+            if (solver == forceSolver::direct && n > options.maxPairwise) continue;
+            CONFIG.solver = solver;
+            r.name = std::string("calculateForces/") + solverName(solver);
+            r.interactions = static_cast<double>(n) * static_cast<double>(n - 1);
+            measure(options, [&] { forces.reset(n); }, [&] { physicsEngine::calculateForces(bodies, forces); },
+                    r.iterations, r.nsPerCall);
+            r.bytesPerBody = (storeBytes(bodies) + forceBytes(forces)) / static_cast<double>(n);
+            report(r);
+        }
+
+        // the higher-precision direct sums, the cost side of choosing CONFIG.precision
+        if (n <= options.maxPairwise && options.directPrecisions) {
+            CONFIG.solver = forceSolver::direct;
+            for (scalarPrecision precision: {scalarPrecision::compensated, scalarPrecision::doublePrecision}) {
+                CONFIG.precision = precision;
+                r.name = precision == scalarPrecision::compensated ? "calculateForces/direct-compensated"
+                                                                   : "calculateForces/direct-double";
+                r.interactions = static_cast<double>(n) * static_cast<double>(n - 1);
+                measure(options, [&] { forces.reset(n); }, [&] { physicsEngine::calculateForces(bodies, forces); },
+                        r.iterations, r.nsPerCall);
+                r.bytesPerBody = (storeBytes(bodies) + forceBytes(forces)) / static_cast<double>(n);
+                report(r);
+            }
+            CONFIG.precision = scalarPrecision::single;
+        }
+
+        r.name = "applyForces";
+        r.interactions = static_cast<double>(n);
+        working = bodies;
+        measure(options, [] {}, [&] { physicsEngine::applyForces(working, forces, 1e-3f); },
+                r.iterations, r.nsPerCall);
+        r.bytesPerBody = (storeBytes(working) + forceBytes(forces)) / static_cast<double>(n);
+        report(r);
+
+        // resolving contacts separates the bodies, so every call starts from the generated state
+        r.name = "collisionCheck";
+        measure(options, [&] { working = bodies; }, [&] { physicsEngine::collisionCheck(working); },
+                r.iterations, r.nsPerCall);
+        r.bytesPerBody = storeBytes(working) / static_cast<double>(n);
+        report(r);
+
+        // the same contacts merged, including the compaction of the store
+        r.name = "mergeCheck";
+        measure(options, [&] { working = bodies; }, [&] { physicsEngine::mergeCheck(working); },
+                r.iterations, r.nsPerCall);
+        r.bytesPerBody = storeBytes(bodies) / static_cast<double>(n);
+        report(r);
+
+        // a whole leapfrog step with elastic contacts, one parallelFor per pass against the task graph
+        for (forceSolver solver: options.solvers) {
+            if (solver == forceSolver::fastMultipole || (solver == forceSolver::direct && n > options.maxPairwise)) {
+                continue;
+            }
+            CONFIG.solver = solver;
+            for (bool graph: {false, true}) {
+                CONFIG.taskGraphStep = graph;
+                r.name = std::string(graph ? "step/task-graph/" : "step/fork-join/") + solverName(solver);
+                r.interactions = static_cast<double>(n);
+                measure(options, [&] { working = bodies; }, [&] { physicsEngine::update(working, 1e-3); },
+                        r.iterations, r.nsPerCall);
+                r.bytesPerBody = storeBytes(working) / static_cast<double>(n);
+                report(r);
+            }
+        }
+        CONFIG.taskGraphStep = true;
+
+        for (instanceFormat format: {instanceFormat::full, instanceFormat::compact}) {
+            const size_t stride = instancePacking::stride(format);
+            std::vector<unsigned char> instances(n * stride);
+            r.name = format == instanceFormat::full ? "packInstances/full" : "packInstances/compact";
+            measure(options, [] {}, [&] { instancePacking::pack(bodies, n, format, instances.data()); },
+                    r.iterations, r.nsPerCall);
+            r.bytesPerBody = static_cast<double>(stride);
+            report(r);
+        }
+
+        // the viewer's default camera: centred on the generated system, 2000 units back
+        {
+            const glm::vec3 eye(CONFIG.screenWidth / 2.0f, CONFIG.screenHeight / 2.0f, 2000.0f);
+            const glm::vec3 forward(0.0f, 0.0f, -1.0f);
+            const glm::mat4 viewProjection =
+                glm::perspective(glm::radians(45.0f), 1980.0f / 1080.0f, 0.1f, 10000.0f) *
+                glm::lookAt(eye, eye + forward, glm::vec3(0.0f, 1.0f, 0.0f));
+            const float pixelScale = 1080.0f / (2.0f * std::tan(glm::radians(45.0f) * 0.5f));
+            const float minPixels[visibleSet::levels - 1] = {24.0f, 8.0f, 2.5f};
+            visibleSet visible;
+            r.name = "cullInstances";
+            r.interactions = static_cast<double>(n);
+            measure(options, [] {}, [&] {
+                visibility::classify(bodies, viewProjection, eye, forward, pixelScale, minPixels, visible);
+            }, r.iterations, r.nsPerCall);
+            r.bytesPerBody = (vectorBytes(bodies.x) + vectorBytes(bodies.y) + vectorBytes(bodies.z) +
+                              vectorBytes(bodies.radius) + vectorBytes(visible.levelOf) +
+                              vectorBytes(visible.indices)) / static_cast<double>(n);
+            report(r);
+        }
+
+        // a sphere with about n vertices, (segments + 1)^2 of them
+        const int segments = std::max(1, static_cast<int>(std::lround(std::sqrt(static_cast<double>(n)))) - 1);
+        SphereData sphere;
+        r.name = "generateSphereVertices";
+        r.interactions = static_cast<double>((segments + 1) * (segments + 1));
+        measure(options, [] {}, [&] { sphere = body::generateSphereVertices(1.0f, segments); },
+                r.iterations, r.nsPerCall);
+        r.bytesPerBody = (vectorBytes(sphere.vertices) + vectorBytes(sphere.indices) + vectorBytes(sphere.normals)) /
+                         r.interactions;
+        report(r);
+    }
+
+    if (options.json) std::printf("\n]}\n");
+    return 0;
+}
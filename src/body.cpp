@@ -1,6 +1,11 @@
 #include "body.h"
+#include "bodyStore.h"
 #include "config.h"
+#include "philox.h"
+#include "threadPool.h"
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <random>
 #include "glm/detail/func_geometric.inl"
 
@@ -59,39 +64,138 @@ SphereData body::generateSphereVertices(float radius, int segments) {
     return sphere;
 }
 
-std::vector<body> body::generateBodies(unsigned int numBodies) {
-    std::vector<body> bodies;
-    body sun(
+// sin and cos of x for |x| < 2^22: Cody-Waite reduction to [-pi/4, pi/4] (rounding by the
+// 1.5 * 2^23 trick rather than nearbyint, which is a library call without SSE4.1) and the
+// Cephes minimax polynomials, branch-free so the generation loop vectorises
+static inline void sinCos(float x, float &sine, float &cosine) {
+    constexpr float roundingBias = 12582912.0f;
+    const float quadrant = (x * 0.63661977236f + roundingBias) - roundingBias;
+    const float r = (x - quadrant * 1.5703125f) - quadrant * 4.8382679e-4f - quadrant * 3.7748947e-8f;
+    const float r2 = r * r;
+    const float s = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+    const float c = 1.0f - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f + r2 * (-1.388731625493765e-3f +
+                                                                               r2 * 2.443315711809948e-5f));
+    const int q = static_cast<int>(quadrant);
+    const float swappedSine = (q & 1) ? c : s;
+    const float swappedCosine = (q & 1) ? s : c;
+    sine = (q & 2) ? -swappedSine : swappedSine;
+    cosine = ((q + 1) & 2) ? -swappedCosine : swappedCosine;
+}
+
+// Every body draws one Philox block at counter index, so a body's values depend only on
+// the seed and its index and the bodies can be filled in any order by any number of threads.
+// The orbit is createStableOrbit in closed form: with the reference axis +z (never near the
+// radius vector for inclinations within +-0.8) its velocity direction is (-sin a, cos a, 0).
+static void generateOrbits(BodyStore &bodies, size_t first, size_t count, unsigned int seed) {
+    const philox random(seed);
+    const float minOrbit = CONFIG.minOrbitRadius, orbitSpan = CONFIG.maxOrbitRadius - CONFIG.minOrbitRadius;
+    const float minMass = CONFIG.minBodyMass, massSpan = CONFIG.maxBodyMass - CONFIG.minBodyMass;
+    const float minRadius = CONFIG.minBodyRadius, radiusSpan = CONFIG.maxBodyRadius - CONFIG.minBodyRadius;
+    const float gm = CONFIG.gravitationalConstant * bodies.mass[0];
+    const glm::vec3 centre = bodies.position(0), centreVelocity = bodies.velocity(0);
+    const float centreX = centre.x, centreY = centre.y, centreZ = centre.z;
+    const float centreVx = centreVelocity.x, centreVy = centreVelocity.y, centreVz = centreVelocity.z;
+
+    threadPool::getInstance().parallelFor(count, body::generationGrain, [&](size_t begin, size_t end, unsigned int) {
+        constexpr size_t batch = philox::batch;
+        std::uint32_t words[4][batch];
+        float px[batch], py[batch], pz[batch], pvx[batch], pvy[batch], pmass[batch], pradius[batch];
+        float red[batch], green[batch];
+        for (size_t block = begin; block < end; block += batch) {
+            // always a full batch so the loops have a fixed trip count, the tail is discarded
+            random.fill(first + block, 0, words);
+            for (size_t lane = 0; lane < batch; lane++) {
+                // six uniforms from one 128-bit block: the top 21 bits of each word, then the
+                // low 11 bits of word pairs
+                const std::uint32_t w0 = words[0][lane], w1 = words[1][lane];
+                const std::uint32_t w2 = words[2][lane], w3 = words[3][lane];
+                constexpr float scale21 = 1.0f / 2097152.0f, scale22 = 1.0f / 4194304.0f;
+                const float orbitRadius = minOrbit + orbitSpan * (static_cast<float>(w0 >> 11) * scale21);
+                const float angle = 6.28318f * (static_cast<float>(w1 >> 11) * scale21);
+                const float inclination = -0.8f + 1.6f * (static_cast<float>(w2 >> 11) * scale21);
+                pmass[lane] = minMass + massSpan * (static_cast<float>(w3 >> 11) * scale21);
+                const std::uint32_t low01 = (w0 & 0x7ffu) | (w1 & 0x7ffu) << 11;
+                const std::uint32_t low23 = (w2 & 0x7ffu) | (w3 & 0x7ffu) << 11;
+                pradius[lane] = minRadius + radiusSpan * (static_cast<float>(low01) * scale22);
+                const float offset = -200.0f + 400.0f * (static_cast<float>(low23) * scale22);
+
+                float sinAngle, cosAngle, sinInclination, cosInclination;
+                sinCos(angle, sinAngle, cosAngle);
+                sinCos(inclination, sinInclination, cosInclination);
+                px[lane] = centreX + orbitRadius * cosAngle * cosInclination;
+                py[lane] = centreY + orbitRadius * sinAngle * cosInclination;
+                pz[lane] = centreZ + orbitRadius * sinInclination + offset;
+                const float speed = std::sqrt(gm / orbitRadius);
+                pvx[lane] = centreVx - sinAngle * speed;
+                pvy[lane] = centreVy + cosAngle * speed;
+
+                // the sin(i), cos(i) colour ramp; i is exact as a float below 2^24 and the
+                // two-part 2 pi keeps the reduction close enough for a colour
+                const auto phase = static_cast<float>(static_cast<std::int32_t>(first + block + lane));
+                const auto turns = static_cast<float>(static_cast<std::int32_t>(phase * 0.15915494f));
+                float sinPhase, cosPhase;
+                sinCos((phase - turns * 6.28125f) - turns * 1.9353071795864769e-3f, sinPhase, cosPhase);
+                red[lane] = sinPhase;
+                green[lane] = cosPhase;
+            }
+
+            const size_t filled = std::min(batch, end - block);
+            const size_t base = first + block + 1; //after the central body
+            std::copy_n(px, filled, bodies.x.data() + base);
+            std::copy_n(py, filled, bodies.y.data() + base);
+            std::copy_n(pz, filled, bodies.z.data() + base);
+            std::copy_n(pvx, filled, bodies.vx.data() + base);
+            std::copy_n(pvy, filled, bodies.vy.data() + base);
+            std::fill_n(bodies.vz.data() + base, filled, centreVz);
+            std::copy_n(pmass, filled, bodies.mass.data() + base);
+            std::copy_n(pradius, filled, bodies.radius.data() + base);
+            for (size_t lane = 0; lane < filled; lane++) {
+                bodies.colour[base + lane] = glm::vec3(red[lane], green[lane], 1.0f);
+            }
+        }
+    });
+}
+
+void body::generateBodies(BodyStore &bodies, unsigned int numBodies) {
+    const body sun(
         glm::vec3(CONFIG.screenWidth / 2.0f, CONFIG.screenHeight / 2.0f, 0),
         glm::vec3(0, 0, 0),
         glm::vec3(1, 1, 0),
         CONFIG.centralBodyRadius,
         CONFIG.centralBodyMass
     );
-    bodies.push_back(sun);
-
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<float> radius_dist(CONFIG.minOrbitRadius, CONFIG.maxOrbitRadius);
-    std::uniform_real_distribution<float> angle_dist(0.0f, 2.0f * 3.14159f);
-    std::uniform_real_distribution<float> inclination_dist(-0.8f, 0.8f);
-    std::uniform_real_distribution<float> mass_dist(CONFIG.minBodyMass, CONFIG.maxBodyMass);
-    std::uniform_real_distribution<float> body_radius_dist(CONFIG.minBodyRadius, CONFIG.maxBodyRadius);
-    std::uniform_real_distribution<float> z_dist(-200.0f, 200.0f);
-
-
-    for (size_t i = 0; i < numBodies; i++) {
-        float radius = radius_dist(gen);
-        float angle = angle_dist(gen);
-        float inclination = inclination_dist(gen);
-        glm::vec3 colour(std::sin(i), std::cos(i), 1);
-        float mass = mass_dist(gen);
-        float bodyRadius = body_radius_dist(gen);
-        body b = body::createStableOrbit(sun, radius, angle, inclination, colour, bodyRadius, mass);
-        b.position.z += z_dist(gen);
-        bodies.push_back(b);
+    bodies.clear();
+    bodies.resize(static_cast<size_t>(numBodies) + 1);
+    bodies.set(0, sun);
+    // with a floating origin the system is generated around the origin instead of at the sun
+    if (CONFIG.floatingOrigin) {
+        bodies.origin = glm::dvec3(sun.position);
+        bodies.setPosition(0, glm::vec3(0.0f));
+    }
+
+    unsigned int seed = CONFIG.seed;
+    if (seed == 0) {
+        std::random_device rd;
+        seed = rd();
+    }
+    CONFIG.generatedSeed = seed;
+    generateOrbits(bodies, 0, numBodies, seed);
+}
+
+// A count change on a running system: bodies beyond the new count are dropped from the end of
+// the store, missing ones are drawn for the indices they fill from the seed of the last
+// generation and put in orbit around the central body where it is now.
+void body::resizeBodies(BodyStore &bodies, unsigned int numBodies) {
+    const size_t target = static_cast<size_t>(numBodies) + 1;
+    const size_t live = bodies.size();
+    if (live == 0) {
+        generateBodies(bodies, numBodies);
+        return;
     }
-    return bodies;
+    if (target == live) return;
+    bodies.resize(target);
+    bodies.timestepLevel.resize(std::min(bodies.timestepLevel.size(), target));
+    if (target > live) generateOrbits(bodies, live - 1, target - live, CONFIG.generatedSeed);
 }
 
 void body::collisionCheck(body &other) {
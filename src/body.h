@@ -9,6 +9,8 @@ struct SphereData {
     std::vector<float> normals;
 };
 
+class BodyStore;
+
 class body {
 public:
     glm::vec3 position;
@@ -19,9 +21,14 @@ public:
 
     body(glm::vec3 position, glm::vec3 velocity, glm::vec3 colour, float radius, float mass);
 
+    static constexpr size_t generationGrain = 4096;
+
     static SphereData generateSphereVertices(float radius, int segments = 1);
 
-    static std::vector<body> generateBodies(unsigned int numBodies);
+    static void generateBodies(BodyStore &bodies, unsigned int numBodies);
+
+    // changes a running system to numBodies orbiting bodies, keeping the ones that stay
+    static void resizeBodies(BodyStore &bodies, unsigned int numBodies);
 
     void collisionCheck(body &other);
 
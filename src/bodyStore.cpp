@@ -0,0 +1,119 @@
+#include "bodyStore.h"
+
+void BodyStore::clear() {
+    x.clear();
+    y.clear();
+    z.clear();
+    vx.clear();
+    vy.clear();
+    vz.clear();
+    mass.clear();
+    radius.clear();
+    colour.clear();
+    origin = glm::dvec3(0.0);
+    accelerationsValid = false;
+}
+
+void BodyStore::reserve(size_t n) {
+    x.reserve(n);
+    y.reserve(n);
+    z.reserve(n);
+    vx.reserve(n);
+    vy.reserve(n);
+    vz.reserve(n);
+    mass.reserve(n);
+    radius.reserve(n);
+    colour.reserve(n);
+}
+
+void BodyStore::resize(size_t n) {
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    vx.resize(n);
+    vy.resize(n);
+    vz.resize(n);
+    mass.resize(n);
+    radius.resize(n);
+    colour.resize(n);
+    accelerationsValid = false;
+}
+
+void BodyStore::push_back(const body &b) {
+    x.push_back(b.position.x);
+    y.push_back(b.position.y);
+    z.push_back(b.position.z);
+    vx.push_back(b.velocity.x);
+    vy.push_back(b.velocity.y);
+    vz.push_back(b.velocity.z);
+    mass.push_back(b.mass);
+    radius.push_back(b.radius);
+    colour.push_back(b.colour);
+    accelerationsValid = false;
+}
+
+body BodyStore::get(size_t i) const {
+    return {position(i), velocity(i), colour[i], radius[i], mass[i]};
+}
+
+void BodyStore::set(size_t i, const body &b) {
+    setPosition(i, b.position);
+    setVelocity(i, b.velocity);
+    mass[i] = b.mass;
+    radius[i] = b.radius;
+    colour[i] = b.colour;
+    accelerationsValid = false;
+}
+
+void BodyStore::shiftOrigin(const glm::dvec3 &shift) {
+    const auto sx = static_cast<float>(shift.x), sy = static_cast<float>(shift.y), sz = static_cast<float>(shift.z);
+    for (size_t i = 0; i < size(); i++) {
+        x[i] -= sx;
+        y[i] -= sy;
+        z[i] -= sz;
+    }
+    origin += shift;
+}
+
+template<typename T>
+static void swapRemoveFrom(std::vector<T> &column, size_t i, size_t n) {
+    if (column.size() != n) return;
+    column[i] = column[n - 1];
+    column.pop_back();
+}
+
+void BodyStore::swapRemove(size_t i) {
+    const size_t n = size();
+    swapRemoveFrom(ax, i, n);
+    swapRemoveFrom(ay, i, n);
+    swapRemoveFrom(az, i, n);
+    swapRemoveFrom(timestepLevel, i, n);
+    swapRemoveFrom(x, i, n);
+    swapRemoveFrom(y, i, n);
+    swapRemoveFrom(z, i, n);
+    swapRemoveFrom(vx, i, n);
+    swapRemoveFrom(vy, i, n);
+    swapRemoveFrom(vz, i, n);
+    swapRemoveFrom(mass, i, n);
+    swapRemoveFrom(radius, i, n);
+    swapRemoveFrom(colour, i, n);
+    accelerationsValid = false;
+}
+
+void BodyStore::assign(const std::vector<body> &bodies) {
+    resize(bodies.size());
+    origin = glm::dvec3(0.0);
+    for (size_t i = 0; i < bodies.size(); i++) {
+        set(i, bodies[i]);
+    }
+}
+
+void BodyStore::toBodies(std::vector<body> &bodies) const {
+    bodies.clear();
+    bodies.reserve(size());
+    for (size_t i = 0; i < size(); i++) {
+        body b = get(i);
+        b.position = worldPosition(i);
+        bodies.push_back(b);
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef N_BODY_SIMULATION_GL_BODYSTORE_H
+#define N_BODY_SIMULATION_GL_BODYSTORE_H
+#include <vector>
+#include "glm/vec3.hpp"
+#include "body.h"
+
+// Structure-of-arrays body storage used by the physics hot loops. Every per-body
+// quantity is its own contiguous stream, the render-only colour is kept separate so
+// the force, integration and collision passes never pull it through the cache.
+class BodyStore {
+public:
+    std::vector<float> x, y, z;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> mass;
+    std::vector<float> radius;
+    std::vector<glm::vec3> colour;
+
+    // accelerations from the last force evaluation, reused by the symplectic integrators so a
+    // step needs only one evaluation. Anything that moves bodies outside the integrator clears
+    // accelerationsValid.
+    std::vector<float> ax, ay, az;
+    bool accelerationsValid = false;
+
+    // block timestep level per body (step = dt / 2^level), owned by physicsEngine
+    std::vector<unsigned char> timestepLevel;
+
+    // world position = origin + stored position. physicsEngine moves the origin with the
+    // centre of mass (CONFIG.floatingOrigin) so the stored floats stay small, and spend their
+    // precision on the orbits rather than on the distance to the world origin
+    glm::dvec3 origin{0.0};
+
+    [[nodiscard]] size_t size() const { return x.size(); }
+    [[nodiscard]] bool empty() const { return x.empty(); }
+
+    void clear();
+
+    void reserve(size_t n);
+
+    void resize(size_t n);
+
+    void push_back(const body &b);
+
+    [[nodiscard]] body get(size_t i) const;
+
+    void set(size_t i, const body &b);
+
+    [[nodiscard]] glm::vec3 position(size_t i) const { return {x[i], y[i], z[i]}; }
+    [[nodiscard]] glm::vec3 velocity(size_t i) const { return {vx[i], vy[i], vz[i]}; }
+
+    [[nodiscard]] glm::vec3 worldPosition(size_t i) const {
+        return glm::vec3(origin + glm::dvec3(x[i], y[i], z[i]));
+    }
+
+    // moves the origin by shift and every stored position by -shift, world positions unchanged
+    void shiftOrigin(const glm::dvec3 &shift);
+
+    void setPosition(size_t i, const glm::vec3 &p) {
+        x[i] = p.x;
+        y[i] = p.y;
+        z[i] = p.z;
+    }
+
+    void setVelocity(size_t i, const glm::vec3 &v) {
+        vx[i] = v.x;
+        vy[i] = v.y;
+        vz[i] = v.z;
+    }
+
+    // O(1) removal: the last body moves into slot i, so the order of the others changes. The
+    // per-body physics state (accelerations, timestep levels) moves with it when present.
+    void swapRemove(size_t i);
+
+    void assign(const std::vector<body> &bodies);
+
+    // world positions
+    void toBodies(std::vector<body> &bodies) const;
+};
+
+// SoA per-body force accumulator, reused between steps to avoid reallocating
+struct ForceBuffer {
+    std::vector<float> x, y, z;
+
+    void reset(size_t n) {
+        x.assign(n, 0.0f);
+        y.assign(n, 0.0f);
+        z.assign(n, 0.0f);
+    }
+};
+
+
+#endif //N_BODY_SIMULATION_GL_BODYSTORE_H
@@ -0,0 +1,446 @@
+#include "checkpoint.h"
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+#include "config.h"
+#include "mappedFile.h"
+
+static constexpr char magic[8] = {'N', 'B', 'O', 'D', 'Y', 'C', 'K', 'P'};
+static constexpr size_t columnAlignment = 64;
+static constexpr size_t settingNameBytes = 24;
+
+enum columnId : std::uint32_t {
+    columnX = 1,
+    columnY,
+    columnZ,
+    columnVx,
+    columnVy,
+    columnVz,
+    columnMass,
+    columnRadius,
+    columnColour,
+    columnTimestepLevel,
+    columnOrigin //one double triple, BodyStore::origin
+};
+
+enum elementType : std::uint32_t {
+    elementF32 = 1,
+    elementU8 = 2,
+    elementU32 = 3,
+    elementF64 = 4
+};
+
+enum rngAlgorithm : std::uint32_t {
+    rngMersenneTwister = 1, //std::mt19937 seeded with the seed setting, before philox
+    rngPhilox4x32 = 2 //philox keyed by the seed, counter = (body index, draw)
+};
+
+struct settingField {
+    const char *name;
+    std::uint32_t type;
+    size_t offset;
+};
+
+#define N_BODY_SETTING(member, type) {#member, type, offsetof(checkpointState, member)}
+static const settingField settingFields[] = {
+    N_BODY_SETTING(seed, elementU32),
+    N_BODY_SETTING(numBodies, elementU32),
+    N_BODY_SETTING(gravitationalConstant, elementF32),
+    N_BODY_SETTING(timeScale, elementF32),
+    N_BODY_SETTING(fixedTimeStep, elementF32),
+    N_BODY_SETTING(adaptiveTimestep, elementU32),
+    N_BODY_SETTING(energyTolerance, elementF32),
+    N_BODY_SETTING(diagnosticInterval, elementU32),
+    N_BODY_SETTING(minTimeStep, elementF32),
+    N_BODY_SETTING(maxTimeStep, elementF32),
+    N_BODY_SETTING(integrator, elementU32),
+    N_BODY_SETTING(blockTimesteps, elementU32),
+    N_BODY_SETTING(maxTimestepLevel, elementU32),
+    N_BODY_SETTING(timestepAccuracy, elementF32),
+    N_BODY_SETTING(solver, elementU32),
+    N_BODY_SETTING(openingAngle, elementF32),
+    N_BODY_SETTING(multipoleOrder, elementU32),
+    N_BODY_SETTING(precision, elementU32),
+    N_BODY_SETTING(floatingOrigin, elementU32),
+    N_BODY_SETTING(originTolerance, elementF32),
+    N_BODY_SETTING(law, elementU32),
+    N_BODY_SETTING(softeningLength, elementF32),
+    N_BODY_SETTING(cutoffRadius, elementF32),
+    N_BODY_SETTING(collisions, elementU32),
+    N_BODY_SETTING(centralBodyMass, elementF32),
+    N_BODY_SETTING(centralBodyRadius, elementF32),
+    N_BODY_SETTING(minOrbitRadius, elementF32),
+    N_BODY_SETTING(maxOrbitRadius, elementF32),
+    N_BODY_SETTING(minBodyMass, elementF32),
+    N_BODY_SETTING(maxBodyMass, elementF32),
+    N_BODY_SETTING(minBodyRadius, elementF32),
+    N_BODY_SETTING(maxBodyRadius, elementF32),
+};
+#undef N_BODY_SETTING
+
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "colour column is stored as packed float triples");
+
+checkpointState checkpointState::fromConfig(double simulationTime, unsigned long long step) {
+    checkpointState state;
+    state.simulationTime = simulationTime;
+    state.step = step;
+    state.seed = CONFIG.seed != 0 ? CONFIG.seed : CONFIG.generatedSeed;
+    state.numBodies = CONFIG.numBodies;
+    state.gravitationalConstant = CONFIG.gravitationalConstant;
+    state.timeScale = CONFIG.timeScale;
+    state.fixedTimeStep = CONFIG.fixedTimeStep;
+    state.adaptiveTimestep = CONFIG.adaptiveTimestep ? 1 : 0;
+    state.energyTolerance = CONFIG.energyTolerance;
+    state.diagnosticInterval = CONFIG.diagnosticInterval;
+    state.minTimeStep = CONFIG.minTimeStep;
+    state.maxTimeStep = CONFIG.maxTimeStep;
+    state.integrator = static_cast<unsigned int>(CONFIG.integrator);
+    state.blockTimesteps = CONFIG.blockTimesteps ? 1 : 0;
+    state.maxTimestepLevel = CONFIG.maxTimestepLevel;
+    state.timestepAccuracy = CONFIG.timestepAccuracy;
+    state.solver = static_cast<unsigned int>(CONFIG.solver);
+    state.openingAngle = CONFIG.openingAngle;
+    state.multipoleOrder = CONFIG.multipoleOrder;
+    state.precision = static_cast<unsigned int>(CONFIG.precision);
+    state.floatingOrigin = CONFIG.floatingOrigin ? 1 : 0;
+    state.originTolerance = CONFIG.originTolerance;
+    state.law = static_cast<unsigned int>(CONFIG.law);
+    state.softeningLength = CONFIG.softeningLength;
+    state.cutoffRadius = CONFIG.cutoffRadius;
+    state.collisions = static_cast<unsigned int>(CONFIG.collisions);
+    state.centralBodyMass = CONFIG.centralBodyMass;
+    state.centralBodyRadius = CONFIG.centralBodyRadius;
+    state.minOrbitRadius = CONFIG.minOrbitRadius;
+    state.maxOrbitRadius = CONFIG.maxOrbitRadius;
+    state.minBodyMass = CONFIG.minBodyMass;
+    state.maxBodyMass = CONFIG.maxBodyMass;
+    state.minBodyRadius = CONFIG.minBodyRadius;
+    state.maxBodyRadius = CONFIG.maxBodyRadius;
+    return state;
+}
+
+void checkpointState::applyToConfig() const {
+    CONFIG.seed = seed;
+    CONFIG.numBodies = numBodies;
+    CONFIG.gravitationalConstant = gravitationalConstant;
+    CONFIG.timeScale = timeScale;
+    CONFIG.fixedTimeStep = fixedTimeStep;
+    CONFIG.adaptiveTimestep = adaptiveTimestep != 0;
+    CONFIG.energyTolerance = energyTolerance;
+    CONFIG.diagnosticInterval = diagnosticInterval;
+    CONFIG.minTimeStep = minTimeStep;
+    CONFIG.maxTimeStep = maxTimeStep;
+    CONFIG.integrator = static_cast<integratorType>(integrator);
+    CONFIG.blockTimesteps = blockTimesteps != 0;
+    CONFIG.maxTimestepLevel = maxTimestepLevel;
+    CONFIG.timestepAccuracy = timestepAccuracy;
+    CONFIG.solver = static_cast<forceSolver>(solver);
+    CONFIG.openingAngle = openingAngle;
+    CONFIG.multipoleOrder = multipoleOrder;
+    CONFIG.precision = static_cast<scalarPrecision>(precision);
+    CONFIG.floatingOrigin = floatingOrigin != 0;
+    CONFIG.originTolerance = originTolerance;
+    CONFIG.law = static_cast<forceLaw>(law);
+    CONFIG.softeningLength = softeningLength;
+    CONFIG.cutoffRadius = cutoffRadius;
+    CONFIG.collisions = static_cast<collisionMode>(collisions);
+    CONFIG.centralBodyMass = centralBodyMass;
+    CONFIG.centralBodyRadius = centralBodyRadius;
+    CONFIG.minOrbitRadius = minOrbitRadius;
+    CONFIG.maxOrbitRadius = maxOrbitRadius;
+    CONFIG.minBodyMass = minBodyMass;
+    CONFIG.maxBodyMass = maxBodyMass;
+    CONFIG.minBodyRadius = minBodyRadius;
+    CONFIG.maxBodyRadius = maxBodyRadius;
+}
+
+static bool littleEndianHost() {
+    const std::uint16_t one = 1;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+// little-endian encoding independent of the host byte order
+static void putBytes(std::vector<unsigned char> &out, std::uint64_t value, size_t bytes) {
+    for (size_t b = 0; b < bytes; b++) {
+        out.push_back(static_cast<unsigned char>(value >> (8 * b)));
+    }
+}
+
+static std::uint64_t getBytes(const unsigned char *in, size_t bytes) {
+    std::uint64_t value = 0;
+    for (size_t b = 0; b < bytes; b++) {
+        value |= static_cast<std::uint64_t>(in[b]) << (8 * b);
+    }
+    return value;
+}
+
+template<typename T>
+static std::uint64_t bitsOf(T value) {
+    static_assert(sizeof(T) <= sizeof(std::uint64_t), "scalar only");
+    std::uint64_t bits = 0;
+    if (sizeof(T) == 4) {
+        std::uint32_t narrow;
+        std::memcpy(&narrow, &value, 4);
+        bits = narrow;
+    } else {
+        std::memcpy(&bits, &value, sizeof(T));
+    }
+    return bits;
+}
+
+template<typename T>
+static T fromBits(std::uint64_t bits) {
+    T value;
+    if (sizeof(T) == 4) {
+        const auto narrow = static_cast<std::uint32_t>(bits);
+        std::memcpy(&value, &narrow, 4);
+    } else {
+        std::memcpy(&value, &bits, sizeof(T));
+    }
+    return value;
+}
+
+// copies count elements of elementSize bytes from little-endian storage
+static void copyFromLittleEndian(void *destination, const unsigned char *source, size_t count, size_t elementSize) {
+    if (littleEndianHost() || elementSize == 1) {
+        std::memcpy(destination, source, count * elementSize);
+        return;
+    }
+    auto *out = static_cast<unsigned char *>(destination);
+    for (size_t i = 0; i < count; i++) {
+        for (size_t b = 0; b < elementSize; b++) {
+            out[i * elementSize + b] = source[i * elementSize + elementSize - 1 - b];
+        }
+    }
+}
+
+static bool writeLittleEndian(std::FILE *file, const void *data, size_t count, size_t elementSize) {
+    if (littleEndianHost() || elementSize == 1) {
+        return std::fwrite(data, elementSize, count, file) == count;
+    }
+    std::vector<unsigned char> swapped(count * elementSize);
+    const auto *in = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < count; i++) {
+        for (size_t b = 0; b < elementSize; b++) {
+            swapped[i * elementSize + b] = in[i * elementSize + elementSize - 1 - b];
+        }
+    }
+    return std::fwrite(swapped.data(), 1, swapped.size(), file) == swapped.size();
+}
+
+struct columnSource {
+    std::uint32_t id;
+    std::uint32_t type;
+    std::uint32_t components;
+    const void *data;
+    size_t elementSize;
+};
+
+bool checkpoint::save(const std::string &path, const BodyStore &bodies, const checkpointState &state) {
+    const size_t n = bodies.size();
+    std::vector<columnSource> columns = {
+        {columnX, elementF32, 1, bodies.x.data(), 4},
+        {columnY, elementF32, 1, bodies.y.data(), 4},
+        {columnZ, elementF32, 1, bodies.z.data(), 4},
+        {columnVx, elementF32, 1, bodies.vx.data(), 4},
+        {columnVy, elementF32, 1, bodies.vy.data(), 4},
+        {columnVz, elementF32, 1, bodies.vz.data(), 4},
+        {columnMass, elementF32, 1, bodies.mass.data(), 4},
+        {columnRadius, elementF32, 1, bodies.radius.data(), 4},
+        {columnColour, elementF32, 3, bodies.colour.data(), 4},
+    };
+    if (bodies.timestepLevel.size() == n) {
+        columns.push_back({columnTimestepLevel, elementU8, 1, bodies.timestepLevel.data(), 1});
+    }
+    static_assert(sizeof(glm::dvec3) == 3 * sizeof(double), "origin is stored as a packed double triple");
+    columns.push_back({columnOrigin, elementF64, 3, &bodies.origin, 8});
+
+    std::vector<unsigned char> header(magic, magic + sizeof(magic));
+    putBytes(header, version, 4);
+    putBytes(header, 0, 4); //header size, patched below
+    putBytes(header, n, 8);
+    putBytes(header, bitsOf(state.simulationTime), 8);
+    putBytes(header, state.step, 8);
+    const size_t settingCount = sizeof(settingFields) / sizeof(settingFields[0]);
+    putBytes(header, settingCount, 4);
+    putBytes(header, columns.size(), 4);
+    putBytes(header, 8, 4); //rng section bytes
+    putBytes(header, 0, 4);
+
+    for (const settingField &field: settingFields) {
+        char name[settingNameBytes] = {};
+        std::strncpy(name, field.name, settingNameBytes - 1);
+        header.insert(header.end(), name, name + settingNameBytes);
+        putBytes(header, field.type, 4);
+        std::uint32_t value;
+        std::memcpy(&value, reinterpret_cast<const unsigned char *>(&state) + field.offset, 4);
+        putBytes(header, value, 4);
+    }
+
+    putBytes(header, rngPhilox4x32, 4);
+    putBytes(header, state.seed, 4);
+
+    const size_t tableBytes = columns.size() * 24;
+    size_t offset = (header.size() + tableBytes + columnAlignment - 1) / columnAlignment * columnAlignment;
+    std::vector<size_t> offsets;
+    for (const columnSource &column: columns) {
+        const size_t count = column.id == columnOrigin ? 1 : n;
+        const size_t bytes = count * column.components * column.elementSize;
+        offsets.push_back(offset);
+        putBytes(header, column.id, 4);
+        putBytes(header, column.type | (column.components << 16), 4);
+        putBytes(header, offset, 8);
+        putBytes(header, bytes, 8);
+        offset = (offset + bytes + columnAlignment - 1) / columnAlignment * columnAlignment;
+    }
+    const size_t headerBytes = header.size();
+    header[12] = static_cast<unsigned char>(headerBytes);
+    header[13] = static_cast<unsigned char>(headerBytes >> 8);
+    header[14] = static_cast<unsigned char>(headerBytes >> 16);
+    header[15] = static_cast<unsigned char>(headerBytes >> 24);
+
+    const std::string temporary = path + ".tmp";
+    std::FILE *file = std::fopen(temporary.c_str(), "wb");
+    if (!file) return false;
+    std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+    bool ok = std::fwrite(header.data(), 1, header.size(), file) == header.size();
+    size_t written = header.size();
+    static const unsigned char padding[columnAlignment] = {};
+    for (size_t c = 0; c < columns.size() && ok; c++) {
+        ok = std::fwrite(padding, 1, offsets[c] - written, file) == offsets[c] - written;
+        const size_t count = (columns[c].id == columnOrigin ? 1 : n) * columns[c].components;
+        ok = ok && writeLittleEndian(file, columns[c].data, count, columns[c].elementSize);
+        written = offsets[c] + count * columns[c].elementSize;
+    }
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    return !error;
+}
+
+bool checkpoint::load(const std::string &path, BodyStore &bodies, checkpointState &state, std::string &error) {
+    mappedFile file;
+    if (!file.open(path)) {
+        error = "cannot open " + path;
+        return false;
+    }
+    const unsigned char *data = file.data();
+    const size_t size = file.size();
+    if (size < 56 || std::memcmp(data, magic, sizeof(magic)) != 0) {
+        error = path + " is not a checkpoint";
+        return false;
+    }
+    const auto fileVersion = static_cast<std::uint32_t>(getBytes(data + 8, 4));
+    if (fileVersion != version) {
+        error = "unsupported checkpoint version " + std::to_string(fileVersion);
+        return false;
+    }
+    const size_t headerBytes = getBytes(data + 12, 4);
+    const size_t n = getBytes(data + 16, 8);
+    const size_t settingCount = getBytes(data + 40, 4);
+    const size_t columnCount = getBytes(data + 44, 4);
+    const size_t rngBytes = getBytes(data + 48, 4);
+    //every body has at least its x column in the file, which bounds n before anything is allocated
+    if (headerBytes > size || 56 + settingCount * 32 + rngBytes + columnCount * 24 != headerBytes ||
+        n > size / sizeof(float)) {
+        error = "corrupt checkpoint header";
+        return false;
+    }
+
+    checkpointState loaded = checkpointState::fromConfig(0.0, 0);
+    loaded.simulationTime = fromBits<double>(getBytes(data + 24, 8));
+    loaded.step = getBytes(data + 32, 8);
+    const unsigned char *cursor = data + 56;
+    for (size_t s = 0; s < settingCount; s++, cursor += 32) {
+        char name[settingNameBytes + 1] = {};
+        std::memcpy(name, cursor, settingNameBytes);
+        const auto type = static_cast<std::uint32_t>(getBytes(cursor + settingNameBytes, 4));
+        const auto value = static_cast<std::uint32_t>(getBytes(cursor + settingNameBytes + 4, 4));
+        for (const settingField &field: settingFields) {
+            if (std::strcmp(field.name, name) == 0 && field.type == type) {
+                std::memcpy(reinterpret_cast<unsigned char *>(&loaded) + field.offset, &value, 4);
+            }
+        }
+    }
+    const std::uint64_t algorithm = rngBytes >= 8 ? getBytes(cursor, 4) : 0;
+    if (algorithm == rngMersenneTwister || algorithm == rngPhilox4x32) {
+        loaded.seed = static_cast<std::uint32_t>(getBytes(cursor + 4, 4));
+    }
+    cursor += rngBytes;
+
+    BodyStore restored;
+    restored.resize(n);
+    bool found[columnOrigin + 1] = {};
+    for (size_t c = 0; c < columnCount; c++, cursor += 24) {
+        const auto id = static_cast<std::uint32_t>(getBytes(cursor, 4));
+        const auto typeAndComponents = static_cast<std::uint32_t>(getBytes(cursor + 4, 4));
+        const size_t offset = getBytes(cursor + 8, 8);
+        const size_t bytes = getBytes(cursor + 16, 8);
+        const std::uint32_t type = typeAndComponents & 0xffffu;
+        const std::uint32_t components = typeAndComponents >> 16;
+        if (offset > size || bytes > size - offset) {
+            error = "checkpoint column out of range";
+            return false;
+        }
+
+        void *destination = nullptr;
+        std::uint32_t expectedType = elementF32, expectedComponents = 1;
+        switch (id) {
+            case columnX: destination = restored.x.data(); break;
+            case columnY: destination = restored.y.data(); break;
+            case columnZ: destination = restored.z.data(); break;
+            case columnVx: destination = restored.vx.data(); break;
+            case columnVy: destination = restored.vy.data(); break;
+            case columnVz: destination = restored.vz.data(); break;
+            case columnMass: destination = restored.mass.data(); break;
+            case columnRadius: destination = restored.radius.data(); break;
+            case columnColour:
+                destination = restored.colour.data();
+                expectedComponents = 3;
+                break;
+            case columnTimestepLevel:
+                restored.timestepLevel.resize(n);
+                destination = restored.timestepLevel.data();
+                expectedType = elementU8;
+                break;
+            case columnOrigin:
+                destination = &restored.origin;
+                expectedType = elementF64;
+                expectedComponents = 3;
+                break;
+            default:
+                continue; //written by a newer build, not needed here
+        }
+        const size_t elementSize = expectedType == elementU8 ? 1 : expectedType == elementF64 ? 8 : 4;
+        const size_t count = id == columnOrigin ? 1 : n;
+        if (type != expectedType || components != expectedComponents ||
+            bytes != count * components * elementSize) {
+            error = "checkpoint column " + std::to_string(id) + " has an unexpected layout";
+            return false;
+        }
+        copyFromLittleEndian(destination, data + offset, count * components, elementSize);
+        found[id] = true;
+    }
+    for (std::uint32_t id = columnX; id <= columnRadius; id++) {
+        if (!found[id]) {
+            error = "checkpoint is missing column " + std::to_string(id);
+            return false;
+        }
+    }
+    if (!found[columnColour]) {
+        for (auto &colour: restored.colour) colour = glm::vec3(1.0f);
+    }
+
+    bodies = std::move(restored);
+    bodies.accelerationsValid = false;
+    state = loaded;
+    return true;
+}
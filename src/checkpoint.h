@@ -0,0 +1,71 @@
+#ifndef N_BODY_SIMULATION_GL_CHECKPOINT_H
+#define N_BODY_SIMULATION_GL_CHECKPOINT_H
+#include <cstdint>
+#include <string>
+#include "bodyStore.h"
+
+// Everything besides the bodies needed to resume a run: the clock, the generator seed and
+// the physics / generation settings from CONFIG.
+struct checkpointState {
+    double simulationTime = 0.0;
+    unsigned long long step = 0;
+
+    unsigned int seed = 0;
+    unsigned int numBodies = 0;
+    float gravitationalConstant = 0.0f;
+    float timeScale = 0.0f;
+    float fixedTimeStep = 0.0f;
+    unsigned int adaptiveTimestep = 0;
+    float energyTolerance = 0.0f;
+    unsigned int diagnosticInterval = 0;
+    float minTimeStep = 0.0f;
+    float maxTimeStep = 0.0f;
+    unsigned int integrator = 0;
+    unsigned int blockTimesteps = 0;
+    unsigned int maxTimestepLevel = 0;
+    float timestepAccuracy = 0.0f;
+    unsigned int solver = 0;
+    float openingAngle = 0.0f;
+    unsigned int multipoleOrder = 0;
+    unsigned int precision = 0;
+    unsigned int floatingOrigin = 0;
+    float originTolerance = 0.0f;
+    unsigned int law = 0;
+    float softeningLength = 0.0f;
+    float cutoffRadius = 0.0f;
+    unsigned int collisions = 0;
+    float centralBodyMass = 0.0f;
+    float centralBodyRadius = 0.0f;
+    float minOrbitRadius = 0.0f;
+    float maxOrbitRadius = 0.0f;
+    float minBodyMass = 0.0f;
+    float maxBodyMass = 0.0f;
+    float minBodyRadius = 0.0f;
+    float maxBodyRadius = 0.0f;
+
+    static checkpointState fromConfig(double simulationTime, unsigned long long step);
+
+    void applyToConfig() const;
+};
+
+// Versioned, little-endian, column-oriented checkpoint file:
+//   header     magic "NBODYCKP", version, body count, clock, section counts
+//   settings   fixed 32-byte records {name[24], type, value}; unknown names are skipped and
+//              missing ones keep their defaults, so settings can be added without a new version
+//   rng        generator description (algorithm id and key)
+//   columns    table of {id, element type, offset, bytes}, then one 64-byte aligned array
+//              per body field, plus the double-precision origin as a single triple
+// Restore maps the file and copies each column straight into the BodyStore arrays, so its
+// cost is a memcpy per column rather than parsing.
+class checkpoint {
+public:
+    static constexpr std::uint32_t version = 1;
+
+    // writes to path + ".tmp" and renames, so a crash mid-save never leaves a torn file
+    static bool save(const std::string &path, const BodyStore &bodies, const checkpointState &state);
+
+    static bool load(const std::string &path, BodyStore &bodies, checkpointState &state, std::string &error);
+};
+
+
+#endif //N_BODY_SIMULATION_GL_CHECKPOINT_H
@@ -1,5 +1,37 @@
 #ifndef N_BODY_SIMULATION_GL_CONFIG_H
 #define N_BODY_SIMULATION_GL_CONFIG_H
+#include <atomic>
+
+enum class forceSolver {
+    direct,
+    barnesHut,
+    fastMultipole
+};
+
+enum class integratorType {
+    semiImplicitEuler,
+    leapfrog, //kick-drift-kick
+    velocityVerlet,
+    yoshida4
+};
+
+enum class scalarPrecision {
+    single, //float differences and sums
+    compensated, //float differences, Kahan-compensated float sums
+    doublePrecision //double differences and sums
+};
+
+enum class forceLaw {
+    newtonian,
+    plummer, //softened by CONFIG.softeningLength
+    cutoff //no force beyond CONFIG.cutoffRadius
+};
+
+enum class collisionMode {
+    none,
+    elastic,
+    merge //perfectly inelastic, touching bodies become one
+};
 
 class config {
 public:
@@ -18,14 +50,42 @@ public:
     unsigned int screenWidth = 1980;
     unsigned int screenHeight = 1080;
     const char *windowTitle = "N-Body Simulation OpenGL";
+    bool compactInstances = false; //half-float radius and colour in the instance buffer (20 vs 28 bytes)
 
     //simulation settings
     unsigned int numBodies = 1;
-    bool paused = false;
+    std::atomic<bool> paused{false}; //toggled by the render thread, read by the simulation thread
+    unsigned int numThreads = 0; //0 = one per hardware thread
+    unsigned int seed = 0; //0 = nondeterministic (std::random_device)
+    unsigned int generatedSeed = 0; //seed the last generateBodies actually used
 
     //physics settings
     float gravitationalConstant = 1000.0f;
     float timeScale = 1.0f;
+    float fixedTimeStep = 1.0f / 120.0f; //simulation thread step, before timeScale
+    unsigned int maxCatchUpSteps = 8; //steps per wake-up before the backlog is dropped
+    bool adaptiveTimestep = false; //timestepController picks the step instead of fixedTimeStep
+    float energyTolerance = 1e-5f; //relative energy change allowed between two checks
+    unsigned int diagnosticInterval = 10; //steps between energy and momentum checks
+    float minTimeStep = 1.0f / 7680.0f; //adaptive step bounds, before timeScale
+    float maxTimeStep = 1.0f / 30.0f;
+    bool taskGraphStep = true; //leapfrog steps as one task graph instead of a parallelFor per pass
+    integratorType integrator = integratorType::leapfrog;
+    bool blockTimesteps = false; //per-body power-of-two steps, always kick-drift-kick
+    unsigned int maxTimestepLevel = 6; //finest block step = step / 2^level
+    float timestepAccuracy = 0.02f; //eta in dt_i = eta * |a| / |da/dt|
+    forceSolver solver = forceSolver::direct;
+    float openingAngle = 0.5f; //barnes-hut / fmm theta, 0 = exact
+    unsigned int multipoleOrder = 4; //fmm expansion order, 1..10
+    scalarPrecision precision = scalarPrecision::single; //direct-sum accumulation
+    forceLaw law = forceLaw::newtonian; //direct and barnes-hut, fmm is always newtonian
+    float softeningLength = 5.0f; //plummer epsilon
+    float cutoffRadius = 1000.0f;
+    collisionMode collisions = collisionMode::elastic;
+    bool floatingOrigin = false; //store positions relative to a double origin kept near the centre of mass
+    float originTolerance = 64.0f; //centre of mass drift that moves the origin
+    bool validateForces = false; //compare the solver against the direct sum every step
+    unsigned int validationSamples = 64; //bodies checked per validation
 
     //body generation settings
     float centralBodyMass = 10000.0f;
@@ -0,0 +1,499 @@
+#include "domainDecomposition.h"
+#include "config.h"
+#include "physicsEngine.h"
+#include "profiler.h"
+#include "threadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace {
+    enum command : std::uint32_t {
+        commandAccelerate, //accelerations of every slab, no kick
+        commandStep, //kick-drift-kick
+        commandMigrate, //copy the slabs into the other buffer in `order`
+        commandExit
+    };
+
+    enum column : unsigned int {
+        columnX, columnY, columnZ,
+        columnVx, columnVy, columnVz,
+        columnMass, columnRadius,
+        columnAx, columnAy, columnAz,
+        columnId, //original index, as a uint32
+        columnCount
+    };
+
+    constexpr std::uint32_t segmentMagic = 0x4e424453; //"NBDS"
+    constexpr size_t segmentAlignment = 4096;
+
+    // A worker that dies would leave the others waiting in the barrier for good, so its exit
+    // ends the coordinator too, unless the coordinator is stopping the workers itself
+    volatile std::sig_atomic_t stopping = 0;
+
+    void workerExited(int) {
+        if (stopping) return;
+        const char message[] = "domain worker exited unexpectedly\n";
+        [[maybe_unused]] const ssize_t written = write(STDERR_FILENO, message, sizeof(message) - 1);
+        _exit(1);
+    }
+}
+
+// Everything the processes share. Plain data only: it is mapped at a different address in
+// every process, and the barrier is process-shared.
+struct domainDecomposition::segmentHeader {
+    std::uint32_t magic;
+    std::uint32_t domains;
+    std::uint64_t capacity;
+    std::uint64_t columnStride; //bytes between columns
+    std::uint64_t columnsOffset; //bytes from the header to buffer 0
+    pthread_barrier_t barrier;
+
+    //command, written by the coordinator before the start barrier
+    std::uint32_t command;
+    std::uint32_t current; //buffer holding the state, 0 or 1
+    double deltaTime;
+    std::uint64_t begin[maxDomains + 1]; //domain d owns [begin[d], begin[d + 1])
+    double forceSeconds[maxDomains]; //summed since the last repartition
+
+    //settings of the coordinator's CONFIG the workers need
+    float gravitationalConstant;
+    float openingAngle;
+    float softeningLength;
+    float cutoffRadius;
+    std::uint32_t multipoleOrder;
+    std::uint32_t solver;
+    std::uint32_t precision;
+    std::uint32_t law;
+    std::uint32_t threads;
+
+    [[nodiscard]] unsigned char *columns() { return reinterpret_cast<unsigned char *>(this) + columnsOffset; }
+
+    template<typename T = float>
+    [[nodiscard]] T *get(unsigned int buffer, unsigned int c) {
+        return reinterpret_cast<T *>(columns() + (buffer * columnCount + c) * columnStride);
+    }
+
+    // the migration permutation, new slot -> old slot
+    [[nodiscard]] std::uint32_t *order() {
+        return reinterpret_cast<std::uint32_t *>(columns() + 2 * columnCount * columnStride);
+    }
+
+    [[nodiscard]] size_t size() const { return begin[domains]; }
+
+    void wait() { pthread_barrier_wait(&barrier); }
+};
+
+static size_t segmentBytes(size_t capacity, size_t &columnStride, size_t &columnsOffset) {
+    columnStride = (capacity * sizeof(float) + 63) / 64 * 64;
+    columnsOffset = (sizeof(domainDecomposition::segmentHeader) + 63) / 64 * 64;
+    const size_t bytes = columnsOffset + (2 * columnCount + 1) * columnStride;
+    return (bytes + segmentAlignment - 1) / segmentAlignment * segmentAlignment;
+}
+
+// The work of domain `index` for the current command, shared by the coordinator and the
+// workers. `mirror` is the process's own copy of every position and mass, which the solvers
+// take as a BodyStore.
+static void runCommand(domainDecomposition::segmentHeader &h, unsigned int index, BodyStore &mirror,
+                       std::vector<unsigned int> &targets) {
+    const unsigned int buffer = h.current;
+    const size_t n = h.size();
+    const size_t begin = h.begin[index], end = h.begin[index + 1];
+    float *x = h.get(buffer, columnX), *y = h.get(buffer, columnY), *z = h.get(buffer, columnZ);
+    float *vx = h.get(buffer, columnVx), *vy = h.get(buffer, columnVy), *vz = h.get(buffer, columnVz);
+    float *ax = h.get(buffer, columnAx), *ay = h.get(buffer, columnAy), *az = h.get(buffer, columnAz);
+    const auto halfStep = static_cast<float>(0.5 * h.deltaTime);
+    const auto fullStep = static_cast<float>(h.deltaTime);
+
+    if (h.command == commandMigrate) {
+        const std::uint32_t *order = h.order();
+        //moved as raw words, the id column is not a float
+        for (unsigned int c = 0; c < columnCount; c++) {
+            const auto *from = h.get<std::uint32_t>(buffer, c);
+            auto *to = h.get<std::uint32_t>(buffer ^ 1u, c);
+            for (size_t k = begin; k < end; k++) to[k] = from[order[k]];
+        }
+        return;
+    }
+
+    if (h.command == commandStep) {
+        for (size_t i = begin; i < end; i++) {
+            vx[i] += ax[i] * halfStep;
+            vy[i] += ay[i] * halfStep;
+            vz[i] += az[i] * halfStep;
+            x[i] += vx[i] * fullStep;
+            y[i] += vy[i] * fullStep;
+            z[i] += vz[i] * fullStep;
+        }
+        //every slab has drifted before anyone reads positions
+        h.wait();
+    }
+
+    const auto forceStart = std::chrono::steady_clock::now();
+    mirror.resize(n);
+    mirror.ax.resize(n);
+    mirror.ay.resize(n);
+    mirror.az.resize(n);
+    std::copy_n(x, n, mirror.x.data());
+    std::copy_n(y, n, mirror.y.data());
+    std::copy_n(z, n, mirror.z.data());
+    std::copy_n(h.get(buffer, columnMass), n, mirror.mass.data());
+    targets.resize(end - begin);
+    for (size_t i = begin; i < end; i++) targets[i - begin] = static_cast<unsigned int>(i);
+    physicsEngine::calculateAccelerations(mirror, targets);
+    for (size_t i = begin; i < end; i++) {
+        ax[i] = mirror.ax[i];
+        ay[i] = mirror.ay[i];
+        az[i] = mirror.az[i];
+    }
+    h.forceSeconds[index] += std::chrono::duration<double>(std::chrono::steady_clock::now() - forceStart).count();
+
+    if (h.command == commandStep) {
+        for (size_t i = begin; i < end; i++) {
+            vx[i] += ax[i] * halfStep;
+            vy[i] += ay[i] * halfStep;
+            vz[i] += az[i] * halfStep;
+        }
+    }
+}
+
+static void applySettings(const domainDecomposition::segmentHeader &h) {
+    CONFIG.gravitationalConstant = h.gravitationalConstant;
+    CONFIG.openingAngle = h.openingAngle;
+    CONFIG.softeningLength = h.softeningLength;
+    CONFIG.cutoffRadius = h.cutoffRadius;
+    CONFIG.multipoleOrder = h.multipoleOrder;
+    CONFIG.solver = static_cast<forceSolver>(h.solver);
+    CONFIG.precision = static_cast<scalarPrecision>(h.precision);
+    CONFIG.law = static_cast<forceLaw>(h.law);
+    CONFIG.numThreads = h.threads;
+    threadPool::getInstance().resize(CONFIG.numThreads);
+}
+
+domainDecomposition::~domainDecomposition() {
+    stop();
+}
+
+bool domainDecomposition::start(const BodyStore &bodies, const domainOptions &requested, const char *executable,
+                                std::string &error) {
+    if (running()) stop();
+    options = requested;
+    const unsigned int domains = options.processes;
+    if (domains < 1 || domains > maxDomains) {
+        error = "domain count must be between 1 and " + std::to_string(maxDomains);
+        return false;
+    }
+    if (CONFIG.blockTimesteps || CONFIG.integrator != integratorType::leapfrog) {
+        error = "domain decomposition steps with leapfrog only, without block timesteps";
+        return false;
+    }
+    if (CONFIG.collisions == collisionMode::merge) {
+        error = "domain decomposition needs a fixed body count, merge collisions are not supported";
+        return false;
+    }
+    const size_t n = bodies.size();
+    if (n < domains) {
+        error = "fewer bodies than domains";
+        return false;
+    }
+
+    size_t columnStride, columnsOffset;
+    const size_t bytes = segmentBytes(n, columnStride, columnsOffset);
+    segmentName = "/n_body_domains_" + std::to_string(getpid());
+    const int fd = shm_open(segmentName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        error = "could not create shared memory " + segmentName;
+        return false;
+    }
+    void *mapped = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(bytes)) == 0) {
+        mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        shm_unlink(segmentName.c_str());
+        error = "could not map " + std::to_string(bytes) + " bytes of shared memory";
+        return false;
+    }
+    mappedBytes = bytes;
+    header = static_cast<segmentHeader *>(mapped);
+    segmentHeader &h = *header;
+    h.magic = segmentMagic;
+    h.domains = domains;
+    h.capacity = n;
+    h.columnStride = columnStride;
+    h.columnsOffset = columnsOffset;
+    pthread_barrierattr_t attributes;
+    pthread_barrierattr_init(&attributes);
+    pthread_barrierattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&h.barrier, &attributes, domains);
+    pthread_barrierattr_destroy(&attributes);
+
+    unsigned int threads = options.threadsPerProcess;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency() / domains);
+    h.gravitationalConstant = CONFIG.gravitationalConstant;
+    h.openingAngle = CONFIG.openingAngle;
+    h.softeningLength = CONFIG.softeningLength;
+    h.cutoffRadius = CONFIG.cutoffRadius;
+    h.multipoleOrder = CONFIG.multipoleOrder;
+    h.solver = static_cast<std::uint32_t>(CONFIG.solver);
+    h.precision = static_cast<std::uint32_t>(CONFIG.precision);
+    h.law = static_cast<std::uint32_t>(CONFIG.law);
+    h.threads = threads;
+
+    // the initial slabs are even by count, the first rebalance sorts them spatially
+    h.current = 0;
+    for (unsigned int d = 0; d <= domains; d++) h.begin[d] = n * d / domains;
+    std::copy_n(bodies.x.data(), n, h.get(0, columnX));
+    std::copy_n(bodies.y.data(), n, h.get(0, columnY));
+    std::copy_n(bodies.z.data(), n, h.get(0, columnZ));
+    std::copy_n(bodies.vx.data(), n, h.get(0, columnVx));
+    std::copy_n(bodies.vy.data(), n, h.get(0, columnVy));
+    std::copy_n(bodies.vz.data(), n, h.get(0, columnVz));
+    std::copy_n(bodies.mass.data(), n, h.get(0, columnMass));
+    std::copy_n(bodies.radius.data(), n, h.get(0, columnRadius));
+    auto *ids = h.get<std::uint32_t>(0, columnId);
+    for (size_t i = 0; i < n; i++) ids[i] = static_cast<std::uint32_t>(i);
+    colours = bodies.colour;
+    origin = bodies.origin;
+
+    stopping = 0;
+    std::signal(SIGCHLD, workerExited);
+    for (unsigned int d = 1; d < domains; d++) {
+        const std::string index = std::to_string(d);
+        char *arguments[] = {const_cast<char *>(executable), const_cast<char *>("--domain-worker"),
+                             const_cast<char *>(segmentName.c_str()), const_cast<char *>(index.c_str()), nullptr};
+        pid_t pid;
+        if (posix_spawn(&pid, executable, nullptr, nullptr, arguments, environ) != 0) {
+            error = std::string("could not start a worker from ") + executable;
+            stop();
+            return false;
+        }
+        workers.push_back(pid);
+    }
+
+    applySettings(h);
+    steps = 0;
+    statistics = {};
+    accelerationsValid = false;
+    rebalance();
+    // every worker has opened the segment by the end of the first command
+    shm_unlink(segmentName.c_str());
+    return true;
+}
+
+void domainDecomposition::issue(unsigned int c) {
+    header->command = c;
+    header->wait();
+    runCommand(*header, 0, mirror, targets);
+    header->wait();
+}
+
+void domainDecomposition::step(double deltaTime) {
+    PROFILE_SCOPE("domain step");
+    if (!accelerationsValid) {
+        issue(commandAccelerate);
+        accelerationsValid = true;
+    }
+    header->deltaTime = deltaTime;
+    issue(commandStep);
+    steps++;
+    if (CONFIG.collisions == collisionMode::elastic) resolveContacts();
+    if (options.rebalanceInterval != 0 && steps % options.rebalanceInterval == 0) {
+        // bodies that drift out of their slab are still integrated correctly, the repartition
+        // only restores locality and balance, so it waits until the times diverge
+        if (measureImbalance() > options.imbalanceTolerance) {
+            rebalance();
+            statistics.rebalances++;
+        }
+    }
+}
+
+double domainDecomposition::measureImbalance() {
+    segmentHeader &h = *header;
+    double slowest = 0.0, total = 0.0;
+    for (unsigned int d = 0; d < h.domains; d++) {
+        slowest = std::max(slowest, h.forceSeconds[d]);
+        total += h.forceSeconds[d];
+    }
+    if (total > 0.0) statistics.imbalance = slowest * h.domains / total;
+    return statistics.imbalance;
+}
+
+// Slab decomposition along the widest axis. Each body is charged its domain's mean force time
+// per body since the last repartition, and the boundaries go where the running cost crosses a
+// multiple of the total / domains.
+void domainDecomposition::rebalance() {
+    PROFILE_SCOPE("domain rebalance");
+    segmentHeader &h = *header;
+    const unsigned int domains = h.domains;
+    const unsigned int buffer = h.current;
+    const size_t n = h.size();
+    const float *position[3] = {h.get(buffer, columnX), h.get(buffer, columnY), h.get(buffer, columnZ)};
+
+    glm::vec3 low(position[0][0], position[1][0], position[2][0]), high = low;
+    for (size_t i = 0; i < n; i++) {
+        const glm::vec3 p(position[0][i], position[1][i], position[2][i]);
+        low = glm::min(low, p);
+        high = glm::max(high, p);
+    }
+    const glm::vec3 extent = high - low;
+    const unsigned int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+
+    std::vector<double> bodyCost(n);
+    std::vector<unsigned int> oldDomain(n);
+    for (unsigned int d = 0; d < domains; d++) {
+        const size_t count = h.begin[d + 1] - h.begin[d];
+        const double seconds = h.forceSeconds[d];
+        const double cost = seconds > 0.0 && count > 0 ? seconds / static_cast<double>(count) : 1.0;
+        for (size_t i = h.begin[d]; i < h.begin[d + 1]; i++) {
+            bodyCost[i] = cost;
+            oldDomain[i] = d;
+        }
+    }
+
+    std::vector<std::pair<float, std::uint32_t>> keys(n);
+    for (size_t i = 0; i < n; i++) keys[i] = {position[axis][i], static_cast<std::uint32_t>(i)};
+    std::sort(keys.begin(), keys.end());
+
+    double totalCost = 0.0;
+    for (double cost: bodyCost) totalCost += cost;
+    std::uint32_t *order = h.order();
+    double running = 0.0;
+    size_t k = 0;
+    for (unsigned int d = 0; d < domains; d++) {
+        h.begin[d] = k;
+        const double share = totalCost * (d + 1) / domains;
+        // the boundary goes to whichever side of a body is closer to the share
+        while (k < n && (d + 1 == domains || running + 0.5 * bodyCost[keys[k].second] < share)) {
+            order[k] = keys[k].second;
+            running += bodyCost[keys[k].second];
+            if (oldDomain[keys[k].second] != d) statistics.migrated++;
+            k++;
+        }
+    }
+    h.begin[domains] = n;
+
+    issue(commandMigrate);
+    h.current ^= 1u;
+    for (unsigned int d = 0; d < domains; d++) h.forceSeconds[d] = 0.0;
+}
+
+// Contacts need every pair that may touch, across slabs, so the coordinator resolves them on
+// a gathered copy between steps, as physicsEngine::collisionCheck does in one process. The copy
+// is in the original order so pairs resolve in the same sequence as there, whatever the slabs.
+void domainDecomposition::resolveContacts() {
+    segmentHeader &h = *header;
+    const unsigned int buffer = h.current;
+    const size_t n = h.size();
+    const auto *ids = h.get<std::uint32_t>(buffer, columnId);
+    float *columns[] = {h.get(buffer, columnX), h.get(buffer, columnY), h.get(buffer, columnZ),
+                        h.get(buffer, columnVx), h.get(buffer, columnVy), h.get(buffer, columnVz),
+                        h.get(buffer, columnMass), h.get(buffer, columnRadius)};
+    contacts.resize(n);
+    std::vector<float> *copies[] = {&contacts.x, &contacts.y, &contacts.z, &contacts.vx, &contacts.vy, &contacts.vz,
+                                    &contacts.mass, &contacts.radius};
+    for (unsigned int c = 0; c < 8; c++) {
+        float *to = copies[c]->data();
+        for (size_t k = 0; k < n; k++) to[ids[k]] = columns[c][k];
+    }
+    if (physicsEngine::collisionCheck(contacts) == 0) return;
+    // elastic contacts only move positions and velocities
+    for (unsigned int c = 0; c < 6; c++) {
+        const float *from = copies[c]->data();
+        for (size_t k = 0; k < n; k++) columns[c][k] = from[ids[k]];
+    }
+    accelerationsValid = false;
+}
+
+void domainDecomposition::gather(BodyStore &bodies) const {
+    segmentHeader &h = *header;
+    const unsigned int buffer = h.current;
+    const size_t n = h.size();
+    const auto *ids = h.get<std::uint32_t>(buffer, columnId);
+    bodies.resize(n);
+    bodies.ax.resize(n);
+    bodies.ay.resize(n);
+    bodies.az.resize(n);
+    bodies.timestepLevel.clear();
+    bodies.origin = origin;
+    std::vector<float> *destination[] = {&bodies.x, &bodies.y, &bodies.z, &bodies.vx, &bodies.vy, &bodies.vz,
+                                         &bodies.mass, &bodies.radius, &bodies.ax, &bodies.ay, &bodies.az};
+    for (unsigned int c = 0; c < columnId; c++) {
+        const float *from = h.get(buffer, c);
+        float *to = destination[c]->data();
+        for (size_t k = 0; k < n; k++) to[ids[k]] = from[k];
+    }
+    bodies.colour = colours;
+    bodies.accelerationsValid = accelerationsValid;
+}
+
+void domainDecomposition::stop() {
+    if (!header) return;
+    stopping = 1;
+    if (workers.size() + 1 == header->domains) {
+        header->command = commandExit;
+        header->wait();
+    } else {
+        for (int pid: workers) kill(pid, SIGTERM);
+    }
+    for (int pid: workers) waitpid(pid, nullptr, 0);
+    workers.clear();
+    std::signal(SIGCHLD, SIG_DFL);
+    pthread_barrier_destroy(&header->barrier);
+    munmap(header, mappedBytes);
+    header = nullptr;
+    shm_unlink(segmentName.c_str());
+}
+
+int domainDecomposition::runWorker(const char *segment, unsigned int index) {
+    // a worker never outlives its coordinator
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    const int fd = shm_open(segment, O_RDWR, 0600);
+    if (fd < 0) {
+        std::fprintf(stderr, "domain %u: could not open %s\n", index, segment);
+        return 1;
+    }
+    segmentHeader probe{};
+    if (read(fd, &probe, sizeof(probe)) != static_cast<ssize_t>(sizeof(probe)) || probe.magic != segmentMagic ||
+        index == 0 || index >= probe.domains) {
+        std::fprintf(stderr, "domain %u: %s is not a domain segment for this index\n", index, segment);
+        close(fd);
+        return 1;
+    }
+    size_t columnStride, columnsOffset;
+    const size_t bytes = segmentBytes(probe.capacity, columnStride, columnsOffset);
+    void *mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        std::fprintf(stderr, "domain %u: could not map %s\n", index, segment);
+        return 1;
+    }
+    auto &h = *static_cast<segmentHeader *>(mapped);
+    applySettings(h);
+    profiler::getInstance().nameThread(("domain " + std::to_string(index)).c_str());
+
+    BodyStore mirror;
+    std::vector<unsigned int> targets;
+    while (true) {
+        h.wait();
+        if (h.command == commandExit) break;
+        runCommand(h, index, mirror, targets);
+        h.wait();
+    }
+    munmap(mapped, bytes);
+    return 0;
+}
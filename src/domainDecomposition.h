@@ -0,0 +1,92 @@
+#ifndef N_BODY_SIMULATION_GL_DOMAINDECOMPOSITION_H
+#define N_BODY_SIMULATION_GL_DOMAINDECOMPOSITION_H
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "bodyStore.h"
+
+struct domainOptions {
+    unsigned int processes = 2; //domains, the coordinator is domain 0
+    unsigned int rebalanceInterval = 10; //steps between load checks, 0 = only the initial partition
+    double imbalanceTolerance = 1.1; //slowest / mean force time that triggers a repartition
+    unsigned int threadsPerProcess = 0; //0 = the hardware threads split between the processes
+};
+
+struct domainStats {
+    unsigned long long rebalances = 0; //repartitions after the initial one
+    unsigned long long migrated = 0; //bodies that changed domain, the initial spatial sort included
+    double imbalance = 1.0; //slowest / mean force time at the last load check
+};
+
+// One simulation split across local processes (Linux only). The bodies live in a POSIX
+// shared memory segment, ordered so that each domain owns a contiguous slab along the widest
+// axis of the system; every process integrates and evaluates forces for its own slab only,
+// and reads the others' positions straight from the segment instead of exchanging messages.
+// Steps are kick-drift-kick with a process-shared barrier between the drift and the force
+// pass. Every rebalanceInterval steps the coordinator compares the domains' force times, and
+// past imbalanceTolerance re-sorts the bodies and moves the slab boundaries so the times even
+// out. The bodies that change domain migrate:
+// each process copies its new slab into the segment's second buffer, so a domain's pages are
+// written by the process that uses them. Contacts are resolved by the coordinator between
+// steps.
+class domainDecomposition {
+public:
+    domainDecomposition() = default;
+
+    ~domainDecomposition();
+
+    domainDecomposition(const domainDecomposition &) = delete;
+
+    domainDecomposition &operator=(const domainDecomposition &) = delete;
+
+    // Copies bodies into a new segment and starts processes - 1 workers running
+    // `executable --domain-worker <segment> <index>`. Needs the leapfrog integrator without
+    // block timesteps, and elastic or no collisions.
+    bool start(const BodyStore &bodies, const domainOptions &options, const char *executable, std::string &error);
+
+    // one kick-drift-kick step of deltaTime (timeScale already applied) across every domain
+    void step(double deltaTime);
+
+    // the current state, in the order the bodies were passed to start
+    void gather(BodyStore &bodies) const;
+
+    // stops and reaps the workers and removes the segment
+    void stop();
+
+    [[nodiscard]] bool running() const { return header != nullptr; }
+    [[nodiscard]] const domainStats &stats() const { return statistics; }
+
+    // entry point of a worker process, returns its exit code
+    static int runWorker(const char *segment, unsigned int index);
+
+    static constexpr unsigned int maxDomains = 64;
+
+    struct segmentHeader;
+
+private:
+    segmentHeader *header = nullptr;
+    size_t mappedBytes = 0;
+    std::string segmentName;
+    std::vector<int> workers;
+    std::vector<glm::vec3> colours; //by original index, never needed by the workers
+    glm::dvec3 origin{0.0};
+    unsigned long long steps = 0;
+    bool accelerationsValid = false;
+    domainOptions options;
+    domainStats statistics;
+    BodyStore mirror; //domain 0's copy of every position and mass
+    std::vector<unsigned int> targets;
+    BodyStore contacts;
+
+    void issue(unsigned int command);
+
+    // measured imbalance of the slabs since the last repartition
+    double measureImbalance();
+
+    void rebalance();
+
+    void resolveContacts();
+};
+
+
+#endif //N_BODY_SIMULATION_GL_DOMAINDECOMPOSITION_H
@@ -0,0 +1,312 @@
+#include "fmm.h"
+#include <algorithm>
+#include <cmath>
+#include "threadPool.h"
+
+// For a source cell with multipoles M_a = sum_j m_j (x_j - c)^a the potential sum_j m_j / |x - x_j|
+// is sum_a (-1)^|a| M_a D_a(x - c), D_a = d^a(1/r) / a!. Shifting that to a local expansion
+// sum_b L_b (x - c')^b about the target centre gives
+// L_b = sum_a (-1)^|a| C(a + b, b) M_a D_(a+b)(c' - c), and the acceleration is G * grad phi.
+
+void fmm::prepare(unsigned int requestedOrder) {
+    requestedOrder = std::clamp(requestedOrder, 1u, maxOrder);
+    if (!row) row = forceKernel::select(forceKernel::detect());
+    if (requestedOrder == order) return;
+    order = requestedOrder;
+
+    termI.clear();
+    termJ.clear();
+    termK.clear();
+    termIndex.assign((order + 1) * (order + 1) * (order + 1), 0);
+    for (unsigned int n = 0; n <= order; n++) {
+        for (unsigned int i = n + 1; i-- > 0;) {
+            for (unsigned int j = n - i + 1; j-- > 0;) {
+                const unsigned int k = n - i - j;
+                termIndex[(i * (order + 1) + j) * (order + 1) + k] = static_cast<unsigned short>(termI.size());
+                termI.push_back(static_cast<unsigned short>(i));
+                termJ.push_back(static_cast<unsigned short>(j));
+                termK.push_back(static_cast<unsigned short>(k));
+            }
+        }
+    }
+    termCount = static_cast<unsigned int>(termI.size());
+
+    std::vector<double> binomial((order + 1) * (order + 1), 0.0);
+    auto choose = [&](unsigned int n, unsigned int k) -> double & { return binomial[n * (order + 1) + k]; };
+    for (unsigned int n = 0; n <= order; n++) {
+        choose(n, 0) = 1.0;
+        for (unsigned int k = 1; k <= n; k++) {
+            choose(n, k) = choose(n - 1, k - 1) + (k <= n - 1 ? choose(n - 1, k) : 0.0);
+        }
+    }
+
+    shiftTerms.clear();
+    interactionTerms.clear();
+    for (unsigned int u = 0; u < termCount; u++) {
+        for (unsigned int l = 0; l < termCount; l++) {
+            if (termI[l] > termI[u] || termJ[l] > termJ[u] || termK[l] > termK[u]) continue;
+            shiftTerms.push_back({
+                static_cast<unsigned short>(u), static_cast<unsigned short>(l),
+                static_cast<unsigned short>(index(termI[u] - termI[l], termJ[u] - termJ[l],
+                                                  termK[u] - termK[l])),
+                choose(termI[u], termI[l]) * choose(termJ[u], termJ[l]) * choose(termK[u], termK[l])
+            });
+        }
+    }
+    for (unsigned int b = 0; b < termCount; b++) {
+        for (unsigned int a = 0; a < termCount; a++) {
+            const unsigned int i = termI[a] + termI[b], j = termJ[a] + termJ[b], k = termK[a] + termK[b];
+            if (i + j + k > order) continue;
+            const double sign = (termI[a] + termJ[a] + termK[a]) % 2 == 0 ? 1.0 : -1.0;
+            interactionTerms.push_back({
+                static_cast<unsigned short>(b), static_cast<unsigned short>(a),
+                static_cast<unsigned short>(index(i, j, k)),
+                sign * choose(i, termI[b]) * choose(j, termJ[b]) * choose(k, termK[b])
+            });
+        }
+    }
+}
+
+void fmm::monomials(double dx, double dy, double dz, double *out) const {
+    double px[maxOrder + 1], py[maxOrder + 1], pz[maxOrder + 1];
+    px[0] = py[0] = pz[0] = 1.0;
+    for (unsigned int p = 1; p <= order; p++) {
+        px[p] = px[p - 1] * dx;
+        py[p] = py[p - 1] * dy;
+        pz[p] = pz[p - 1] * dz;
+    }
+    for (unsigned int t = 0; t < termCount; t++) {
+        out[t] = px[termI[t]] * py[termJ[t]] * pz[termK[t]];
+    }
+}
+
+// Taylor coefficients D_a(r) of 1/r from the recurrence
+// n r^2 D_a + (2n - 1) sum_i r_i D_(a - e_i) + (n - 1) sum_i D_(a - 2e_i) = 0, n = |a|
+void fmm::derivatives(double rx, double ry, double rz, double *out) const {
+    const double distanceSquared = rx * rx + ry * ry + rz * rz;
+    const double inverseDistanceSquared = 1.0 / distanceSquared;
+    out[0] = std::sqrt(inverseDistanceSquared);
+    for (unsigned int t = 1; t < termCount; t++) {
+        const unsigned int i = termI[t], j = termJ[t], k = termK[t];
+        const double n = i + j + k;
+        double sum = 0.0;
+        if (i >= 1) sum += (2.0 * n - 1.0) * rx * out[index(i - 1, j, k)];
+        if (j >= 1) sum += (2.0 * n - 1.0) * ry * out[index(i, j - 1, k)];
+        if (k >= 1) sum += (2.0 * n - 1.0) * rz * out[index(i, j, k - 1)];
+        if (i >= 2) sum += (n - 1.0) * out[index(i - 2, j, k)];
+        if (j >= 2) sum += (n - 1.0) * out[index(i, j - 2, k)];
+        if (k >= 2) sum += (n - 1.0) * out[index(i, j, k - 2)];
+        out[t] = -sum * inverseDistanceSquared / n;
+    }
+}
+
+void fmm::calculateAccelerations(const BodyStore &bodies, unsigned int requestedOrder, float openingAngle, float G,
+                                 ForceBuffer &accelerations) {
+    const size_t n = bodies.size();
+    accelerations.reset(n);
+    if (n == 0) return;
+    prepare(requestedOrder);
+    theta = openingAngle;
+
+    tree.build(bodies, leafCapacity);
+    const auto &nodes = tree.getNodes();
+    const auto &indices = tree.getIndices();
+
+    // contiguous copies in tree order so every leaf is a slice the row kernel can stream
+    sortedX.resize(n);
+    sortedY.resize(n);
+    sortedZ.resize(n);
+    sortedMass.resize(n);
+    for (size_t k = 0; k < n; k++) {
+        const unsigned int j = indices[k];
+        sortedX[k] = bodies.x[j];
+        sortedY[k] = bodies.y[j];
+        sortedZ[k] = bodies.z[j];
+        sortedMass[k] = bodies.mass[j];
+    }
+    sortedAx.assign(n, 0.0f);
+    sortedAy.assign(n, 0.0f);
+    sortedAz.assign(n, 0.0f);
+
+    centres.resize(3 * nodes.size());
+    radii.assign(nodes.size(), 0.0f);
+    multipoles.assign(nodes.size() * termCount, 0.0);
+    locals.assign(nodes.size() * termCount, 0.0);
+    upward(0);
+
+    // Cells near the top are split until every thread has several to work on. A walk rooted at
+    // one target cell only writes that cell's subtree, so the walks need no synchronisation.
+    threadPool &pool = threadPool::getInstance();
+    targetCells.assign(1, 0);
+    while (targetCells.size() < 8 * static_cast<size_t>(pool.size())) {
+        std::vector<unsigned int> expanded;
+        bool split = false;
+        for (unsigned int cell: targetCells) {
+            if (nodes[cell].firstChild == 0) {
+                expanded.push_back(cell);
+                continue;
+            }
+            split = true;
+            for (unsigned int o = 0; o < 8; o++) {
+                const unsigned int child = nodes[cell].firstChild + o;
+                if (nodes[child].end > nodes[child].begin) expanded.push_back(child);
+            }
+        }
+        targetCells.swap(expanded);
+        if (!split) break;
+    }
+
+    pool.parallelFor(targetCells.size(), 1, [&](size_t begin, size_t end, unsigned int) {
+        std::vector<double> scratch(termCount);
+        for (size_t c = begin; c < end; c++) {
+            interact(targetCells[c], 0, scratch);
+            downward(targetCells[c], scratch);
+        }
+    });
+
+    for (size_t k = 0; k < n; k++) {
+        const unsigned int j = indices[k];
+        accelerations.x[j] = G * sortedAx[k];
+        accelerations.y[j] = G * sortedAy[k];
+        accelerations.z[j] = G * sortedAz[k];
+    }
+}
+
+// P2M at the leaves and M2M up the tree, together with each cell's bounding radius
+void fmm::upward(unsigned int nodeIndex) {
+    const octree::node &cell = tree.getNodes()[nodeIndex];
+    const double cx = cell.centreOfMass.x, cy = cell.centreOfMass.y, cz = cell.centreOfMass.z;
+    centres[3 * nodeIndex] = cx;
+    centres[3 * nodeIndex + 1] = cy;
+    centres[3 * nodeIndex + 2] = cz;
+    double *expansion = &multipoles[nodeIndex * termCount];
+    double mono[(maxOrder + 1) * (maxOrder + 2) * (maxOrder + 3) / 6];
+    double radius = 0.0;
+
+    if (cell.firstChild == 0) {
+        for (unsigned int k = cell.begin; k < cell.end; k++) {
+            const double dx = sortedX[k] - cx, dy = sortedY[k] - cy, dz = sortedZ[k] - cz;
+            monomials(dx, dy, dz, mono);
+            for (unsigned int t = 0; t < termCount; t++) {
+                expansion[t] += sortedMass[k] * mono[t];
+            }
+            radius = std::max(radius, std::sqrt(dx * dx + dy * dy + dz * dz));
+        }
+    } else {
+        for (unsigned int o = 0; o < 8; o++) {
+            const unsigned int child = cell.firstChild + o;
+            if (tree.getNodes()[child].end == tree.getNodes()[child].begin) continue;
+            upward(child);
+            const double dx = centres[3 * child] - cx;
+            const double dy = centres[3 * child + 1] - cy;
+            const double dz = centres[3 * child + 2] - cz;
+            monomials(dx, dy, dz, mono);
+            const double *childExpansion = &multipoles[child * termCount];
+            for (const shiftTerm &s: shiftTerms) {
+                expansion[s.upper] += s.coefficient * childExpansion[s.lower] * mono[s.offset];
+            }
+            radius = std::max(radius, std::sqrt(dx * dx + dy * dy + dz * dz) + radii[child]);
+        }
+    }
+    radii[nodeIndex] = static_cast<float>(radius);
+}
+
+// everything in `source` acting on everything in `target`
+void fmm::interact(unsigned int target, unsigned int source, std::vector<double> &scratch) {
+    const auto &nodes = tree.getNodes();
+    const octree::node &t = nodes[target];
+    const octree::node &s = nodes[source];
+    if (t.end == t.begin || s.end == s.begin) return;
+
+    // sparse cells are cheaper summed directly than through an expansion, cell ranges are
+    // contiguous in tree order so this works for inner cells as well as leaves
+    if (static_cast<size_t>(t.end - t.begin) * (s.end - s.begin) <= interactionTerms.size()) {
+        nearField(target, source);
+        return;
+    }
+
+    const double dx = centres[3 * target] - centres[3 * source];
+    const double dy = centres[3 * target + 1] - centres[3 * source + 1];
+    const double dz = centres[3 * target + 2] - centres[3 * source + 2];
+    const double reach = static_cast<double>(radii[target]) + radii[source];
+    if (reach * reach < theta * theta * (dx * dx + dy * dy + dz * dz)) {
+        multipoleToLocal(target, source, scratch);
+        return;
+    }
+
+    const bool targetLeaf = t.firstChild == 0;
+    const bool sourceLeaf = s.firstChild == 0;
+    if (targetLeaf && sourceLeaf) {
+        nearField(target, source);
+    } else if (sourceLeaf || (!targetLeaf && radii[target] >= radii[source])) {
+        for (unsigned int o = 0; o < 8; o++) {
+            interact(t.firstChild + o, source, scratch);
+        }
+    } else {
+        for (unsigned int o = 0; o < 8; o++) {
+            interact(target, s.firstChild + o, scratch);
+        }
+    }
+}
+
+void fmm::multipoleToLocal(unsigned int target, unsigned int source, std::vector<double> &scratch) {
+    derivatives(centres[3 * target] - centres[3 * source],
+                centres[3 * target + 1] - centres[3 * source + 1],
+                centres[3 * target + 2] - centres[3 * source + 2], scratch.data());
+    double *local = &locals[target * termCount];
+    const double *multipole = &multipoles[source * termCount];
+    for (const interactionTerm &term: interactionTerms) {
+        local[term.local] += term.coefficient * multipole[term.multipole] * scratch[term.derivative];
+    }
+}
+
+void fmm::nearField(unsigned int target, unsigned int source) {
+    static const forceLawParameters newtonian; //the expansions are only valid for 1 / r
+    const octree::node &s = tree.getNodes()[source];
+    const octree::node &t = tree.getNodes()[target];
+    for (unsigned int k = t.begin; k < t.end; k++) {
+        float acceleration[3] = {};
+        row(sortedX.data() + s.begin, sortedY.data() + s.begin, sortedZ.data() + s.begin,
+            sortedMass.data() + s.begin, s.end - s.begin, sortedX[k], sortedY[k], sortedZ[k], newtonian,
+            acceleration);
+        sortedAx[k] += acceleration[0];
+        sortedAy[k] += acceleration[1];
+        sortedAz[k] += acceleration[2];
+    }
+}
+
+// L2L down to the leaves, then L2P: a = grad sum_b L_b z^b
+void fmm::downward(unsigned int nodeIndex, std::vector<double> &scratch) {
+    const octree::node &cell = tree.getNodes()[nodeIndex];
+    const double *local = &locals[nodeIndex * termCount];
+    const double cx = centres[3 * nodeIndex], cy = centres[3 * nodeIndex + 1], cz = centres[3 * nodeIndex + 2];
+
+    if (cell.firstChild == 0) {
+        for (unsigned int k = cell.begin; k < cell.end; k++) {
+            monomials(sortedX[k] - cx, sortedY[k] - cy, sortedZ[k] - cz, scratch.data());
+            double ax = 0.0, ay = 0.0, az = 0.0;
+            for (unsigned int t = 1; t < termCount; t++) {
+                const unsigned int i = termI[t], j = termJ[t], k2 = termK[t];
+                if (i > 0) ax += local[t] * i * scratch[index(i - 1, j, k2)];
+                if (j > 0) ay += local[t] * j * scratch[index(i, j - 1, k2)];
+                if (k2 > 0) az += local[t] * k2 * scratch[index(i, j, k2 - 1)];
+            }
+            sortedAx[k] += static_cast<float>(ax);
+            sortedAy[k] += static_cast<float>(ay);
+            sortedAz[k] += static_cast<float>(az);
+        }
+        return;
+    }
+
+    for (unsigned int o = 0; o < 8; o++) {
+        const unsigned int child = cell.firstChild + o;
+        if (tree.getNodes()[child].end == tree.getNodes()[child].begin) continue;
+        monomials(centres[3 * child] - cx, centres[3 * child + 1] - cy, centres[3 * child + 2] - cz,
+                  scratch.data());
+        double *childLocal = &locals[child * termCount];
+        for (const shiftTerm &s: shiftTerms) {
+            childLocal[s.lower] += s.coefficient * local[s.upper] * scratch[s.offset];
+        }
+        downward(child, scratch);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef N_BODY_SIMULATION_GL_FMM_H
+#define N_BODY_SIMULATION_GL_FMM_H
+#include <vector>
+#include "bodyStore.h"
+#include "forceKernel.h"
+#include "octree.h"
+
+// Fast multipole method on the Barnes-Hut octree, using Cartesian Taylor expansions of 1/r
+// truncated at total order p (multipoles about each cell's centre of mass, locals about the
+// same point). Cells interact through a dual tree walk: a pair is accepted when
+// (rA + rB) < theta * |cA - cB|, otherwise the larger cell is split and leaf pairs fall back to
+// direct summation with the SIMD row kernel. Cost is O(N) for a fixed order and theta.
+class fmm {
+public:
+    static constexpr unsigned int maxOrder = 10;
+    static constexpr unsigned int leafCapacity = 32;
+
+    // writes G * sum_j m_j r_ij / |r_ij|^3 for every body
+    void calculateAccelerations(const BodyStore &bodies, unsigned int order, float theta, float G,
+                                ForceBuffer &accelerations);
+
+private:
+    // pairs lower <= upper (per axis): M2M adds C(upper, lower) M_lower d^offset into upper,
+    // L2L adds C(upper, lower) L_upper d^offset into lower
+    struct shiftTerm {
+        unsigned short upper, lower, offset;
+        double coefficient;
+    };
+
+    struct interactionTerm {
+        unsigned short local, multipole, derivative;
+        double coefficient;
+    };
+
+    octree tree;
+    std::vector<double> centres; // 3 per node, the expansion centre
+    std::vector<float> radii; // distance from the centre to the furthest body in the cell
+    std::vector<double> multipoles, locals; // termCount per node
+    std::vector<float> sortedX, sortedY, sortedZ, sortedMass; // bodies in tree order
+    std::vector<float> sortedAx, sortedAy, sortedAz;
+    std::vector<unsigned int> targetCells;
+
+    // multi-indices (i, j, k) with i + j + k <= order, sorted by total order
+    unsigned int order = 0;
+    unsigned int termCount = 0;
+    std::vector<unsigned short> termI, termJ, termK;
+    std::vector<unsigned short> termIndex; // (order + 1)^3 lookup
+    std::vector<shiftTerm> shiftTerms;
+    std::vector<interactionTerm> interactionTerms;
+    accelerationRowFunction row = nullptr;
+    float theta = 0.5f;
+
+    void prepare(unsigned int order);
+
+    [[nodiscard]] unsigned int index(unsigned int i, unsigned int j, unsigned int k) const {
+        return termIndex[(i * (order + 1) + j) * (order + 1) + k];
+    }
+
+    void monomials(double dx, double dy, double dz, double *out) const;
+
+    void derivatives(double rx, double ry, double rz, double *out) const;
+
+    void upward(unsigned int nodeIndex);
+
+    void interact(unsigned int target, unsigned int source, std::vector<double> &scratch);
+
+    void multipoleToLocal(unsigned int target, unsigned int source, std::vector<double> &scratch);
+
+    void nearField(unsigned int target, unsigned int source);
+
+    void downward(unsigned int nodeIndex, std::vector<double> &scratch);
+};
+
+
+#endif //N_BODY_SIMULATION_GL_FMM_H
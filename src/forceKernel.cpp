@@ -0,0 +1,149 @@
+#include "forceKernel.h"
+#include <cmath>
+#include "precision.h"
+
+#ifdef N_BODY_X86_KERNELS
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, static_cast<int>(leaf), static_cast<int>(subleaf));
+    for (int k = 0; k < 4; k++) regs[k] = static_cast<unsigned int>(r[k]);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// XCR0, which register states the OS saves on context switch
+static unsigned long long xgetbv0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+}
+#endif
+
+simdLevel forceKernel::detect() {
+    static const simdLevel level = [] {
+#ifdef N_BODY_X86_KERNELS
+        unsigned int regs[4];
+        cpuid(0, 0, regs);
+        const unsigned int maxLeaf = regs[0];
+        if (maxLeaf < 1) return simdLevel::scalar;
+
+        cpuid(1, 0, regs);
+        const bool sse41 = regs[2] & (1u << 19);
+        const bool osxsave = regs[2] & (1u << 27);
+        const bool avx = regs[2] & (1u << 28);
+        const bool fma = regs[2] & (1u << 12);
+        if (!sse41) return simdLevel::scalar;
+        if (!osxsave || !avx) return simdLevel::sse4;
+
+        const unsigned long long xcr0 = xgetbv0();
+        // XMM and YMM state enabled by the OS
+        if ((xcr0 & 0x6) != 0x6 || maxLeaf < 7) return simdLevel::sse4;
+
+        cpuid(7, 0, regs);
+        const bool avx2 = regs[1] & (1u << 5);
+        const bool avx512f = regs[1] & (1u << 16);
+        // opmask and both halves of the ZMM state enabled by the OS
+        if (avx512f && (xcr0 & 0xE6) == 0xE6) return simdLevel::avx512;
+        if (avx2 && fma) return simdLevel::avx2;
+        return simdLevel::sse4;
+#else
+        return simdLevel::scalar;
+#endif
+    }();
+    return level;
+}
+
+// every row specialisation of one law
+template<class Law>
+static accelerationRowFunction selectRow(simdLevel level, scalarPrecision precision) {
+    switch (precision) {
+        case scalarPrecision::compensated:
+            return accelerationRowPrecise<float, compensatedSum, Law>;
+        case scalarPrecision::doublePrecision:
+            return accelerationRowPrecise<double, plainSum, Law>;
+        default:
+            break;
+    }
+    switch (level) {
+#ifdef N_BODY_X86_KERNELS
+        case simdLevel::avx512:
+            return forceKernel::accelerationRowAVX512<Law>;
+        case simdLevel::avx2:
+            return forceKernel::accelerationRowAVX2<Law>;
+        case simdLevel::sse4:
+            return forceKernel::accelerationRowSSE4<Law>;
+#endif
+        default:
+            return forceKernel::accelerationRowScalar<Law>;
+    }
+}
+
+accelerationRowFunction forceKernel::select(simdLevel level) {
+    return selectRow<newtonianLaw>(level, scalarPrecision::single);
+}
+
+accelerationRowFunction forceKernel::select(simdLevel level, scalarPrecision precision, forceLaw law) {
+    switch (law) {
+        case forceLaw::plummer:
+            return selectRow<plummerLaw>(level, precision);
+        case forceLaw::cutoff:
+            return selectRow<cutoffLaw>(level, precision);
+        default:
+            return selectRow<newtonianLaw>(level, precision);
+    }
+}
+
+const char *forceKernel::name(simdLevel level) {
+    switch (level) {
+        case simdLevel::avx512:
+            return "AVX-512";
+        case simdLevel::avx2:
+            return "AVX2";
+        case simdLevel::sse4:
+            return "SSE4.1";
+        default:
+            return "Scalar";
+    }
+}
+
+template<class Law>
+void forceKernel::accelerationRowScalar(const float *x, const float *y, const float *z, const float *m, size_t n,
+                                        float xi, float yi, float zi, const forceLawParameters &law,
+                                        float *acceleration) {
+    float ax = 0.0f, ay = 0.0f, az = 0.0f;
+    for (size_t j = 0; j < n; j++) {
+        const float dx = x[j] - xi;
+        const float dy = y[j] - yi;
+        const float dz = z[j] - zi;
+        const float s = m[j] * inverseDistanceCubed<Law>(dx * dx + dy * dy + dz * dz, law);
+        ax += dx * s;
+        ay += dy * s;
+        az += dz * s;
+    }
+    acceleration[0] += ax;
+    acceleration[1] += ay;
+    acceleration[2] += az;
+}
+
+const char *forceKernel::name(scalarPrecision precision) {
+    switch (precision) {
+        case scalarPrecision::compensated:
+            return "Compensated";
+        case scalarPrecision::doublePrecision:
+            return "Double";
+        default:
+            return "Single";
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef N_BODY_SIMULATION_GL_FORCEKERNEL_H
+#define N_BODY_SIMULATION_GL_FORCEKERNEL_H
+#include <cstddef>
+#include "config.h"
+#include "physicsPolicies.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define N_BODY_X86_KERNELS 1
+#endif
+
+enum class simdLevel {
+    scalar,
+    sse4,
+    avx2,
+    avx512
+};
+
+// Accumulates sum_j m_j * r_ij * inverseDistanceCubed(|r_ij|^2) for the target point
+// (xi, yi, zi) over the sources [0, n) into acceleration[0..2], under the force law the row
+// was instantiated for. Sources at zero distance (the target itself) contribute nothing. The
+// caller scales by G (and m_i for a force).
+using accelerationRowFunction = void (*)(const float *x, const float *y, const float *z, const float *m, size_t n,
+                                         float xi, float yi, float zi, const forceLawParameters &law,
+                                         float *acceleration);
+
+class forceKernel {
+public:
+    // best level supported by this CPU and OS, detected once via CPUID
+    static simdLevel detect();
+
+    // the newtonian row
+    static accelerationRowFunction select(simdLevel level);
+
+    // the SIMD row for scalarPrecision::single, otherwise the scalar accelerationRowPrecise
+    // instantiation for that precision, specialised on the law
+    static accelerationRowFunction select(simdLevel level, scalarPrecision precision, forceLaw law);
+
+    static const char *name(simdLevel level);
+
+    static const char *name(scalarPrecision precision);
+
+    template<class Law>
+    static void accelerationRowScalar(const float *x, const float *y, const float *z, const float *m, size_t n,
+                                      float xi, float yi, float zi, const forceLawParameters &law,
+                                      float *acceleration);
+
+#ifdef N_BODY_X86_KERNELS
+    // each of these lives in its own translation unit built with the matching -m / /arch flags,
+    // which also holds the explicit instantiations for every law
+    template<class Law>
+    static void accelerationRowSSE4(const float *x, const float *y, const float *z, const float *m, size_t n,
+                                    float xi, float yi, float zi, const forceLawParameters &law, float *acceleration);
+
+    template<class Law>
+    static void accelerationRowAVX2(const float *x, const float *y, const float *z, const float *m, size_t n,
+                                    float xi, float yi, float zi, const forceLawParameters &law, float *acceleration);
+
+    template<class Law>
+    static void accelerationRowAVX512(const float *x, const float *y, const float *z, const float *m, size_t n,
+                                      float xi, float yi, float zi, const forceLawParameters &law,
+                                      float *acceleration);
+#endif
+};
+
+// explicit instantiations of a row template for every law, in the translation unit that defines it
+#define N_BODY_INSTANTIATE_ROWS(row) \
+    template void forceKernel::row<newtonianLaw>(const float *, const float *, const float *, const float *, size_t, \
+                                                 float, float, float, const forceLawParameters &, float *); \
+    template void forceKernel::row<plummerLaw>(const float *, const float *, const float *, const float *, size_t, \
+                                               float, float, float, const forceLawParameters &, float *); \
+    template void forceKernel::row<cutoffLaw>(const float *, const float *, const float *, const float *, size_t, \
+                                              float, float, float, const forceLawParameters &, float *);
+
+
+#endif //N_BODY_SIMULATION_GL_FORCEKERNEL_H
@@ -0,0 +1,75 @@
+#include "forceKernel.h"
+
+#ifdef N_BODY_X86_KERNELS
+#include <immintrin.h>
+
+// Only intrinsics in this file, it is built with AVX2/FMA enabled and must not emit
+// out-of-line helpers that the linker could share with the baseline code.
+template<class Law>
+static inline void rowStep(__m256 xj, __m256 yj, __m256 zj, __m256 mj, __m256 xi, __m256 yi, __m256 zi,
+                           __m256 softening, __m256 cutoff, __m256 &ax, __m256 &ay, __m256 &az) {
+    const __m256 dx = _mm256_sub_ps(xj, xi);
+    const __m256 dy = _mm256_sub_ps(yj, yi);
+    const __m256 dz = _mm256_sub_ps(zj, zi);
+    __m256 r2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+    // zero-distance lanes (the target itself, padding) become NaN below, they are masked out
+    __m256 live = _mm256_cmp_ps(r2, _mm256_setzero_ps(), _CMP_GT_OQ);
+    if constexpr (Law::truncated) live = _mm256_and_ps(live, _mm256_cmp_ps(r2, cutoff, _CMP_LT_OQ));
+    if constexpr (Law::softened) {
+        r2 = _mm256_add_ps(r2, softening);
+        live = _mm256_cmp_ps(r2, _mm256_setzero_ps(), _CMP_GT_OQ);
+    }
+    // rsqrt estimate plus one Newton-Raphson step: inv * (1.5 - 0.5 * r2 * inv^2)
+    __m256 inv = _mm256_rsqrt_ps(r2);
+    const __m256 halfR2 = _mm256_mul_ps(_mm256_set1_ps(0.5f), r2);
+    inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(halfR2, _mm256_mul_ps(inv, inv), _mm256_set1_ps(1.5f)));
+    inv = _mm256_and_ps(inv, live);
+    const __m256 s = _mm256_mul_ps(mj, _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv)));
+    ax = _mm256_fmadd_ps(dx, s, ax);
+    ay = _mm256_fmadd_ps(dy, s, ay);
+    az = _mm256_fmadd_ps(dz, s, az);
+}
+
+static inline float horizontalSum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    return _mm_cvtss_f32(sum);
+}
+
+template<class Law>
+void forceKernel::accelerationRowAVX2(const float *x, const float *y, const float *z, const float *m, size_t n,
+                                      float xi, float yi, float zi, const forceLawParameters &law,
+                                      float *acceleration) {
+    const __m256 softening = _mm256_set1_ps(law.softeningSquared);
+    const __m256 cutoff = _mm256_set1_ps(law.cutoffSquared);
+    const __m256 vxi = _mm256_set1_ps(xi);
+    const __m256 vyi = _mm256_set1_ps(yi);
+    const __m256 vzi = _mm256_set1_ps(zi);
+    __m256 ax = _mm256_setzero_ps(), ay = _mm256_setzero_ps(), az = _mm256_setzero_ps();
+
+    size_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+        rowStep<Law>(_mm256_loadu_ps(x + j), _mm256_loadu_ps(y + j), _mm256_loadu_ps(z + j),
+                     _mm256_loadu_ps(m + j), vxi, vyi, vzi, softening, cutoff, ax, ay, az);
+    }
+    if (j < n) {
+        // pad the tail with massless sources sitting on the target
+        alignas(32) float tx[8], ty[8], tz[8], tm[8];
+        for (size_t k = 0; k < 8; k++) {
+            const bool live = j + k < n;
+            tx[k] = live ? x[j + k] : xi;
+            ty[k] = live ? y[j + k] : yi;
+            tz[k] = live ? z[j + k] : zi;
+            tm[k] = live ? m[j + k] : 0.0f;
+        }
+        rowStep<Law>(_mm256_load_ps(tx), _mm256_load_ps(ty), _mm256_load_ps(tz), _mm256_load_ps(tm),
+                     vxi, vyi, vzi, softening, cutoff, ax, ay, az);
+    }
+    acceleration[0] += horizontalSum(ax);
+    acceleration[1] += horizontalSum(ay);
+    acceleration[2] += horizontalSum(az);
+}
+
+N_BODY_INSTANTIATE_ROWS(accelerationRowAVX2)
+#endif
@@ -0,0 +1,51 @@
+#include "forceKernel.h"
+
+#ifdef N_BODY_X86_KERNELS
+#include <immintrin.h>
+
+// Only intrinsics in this file, it is built with AVX-512F enabled and must not emit
+// out-of-line helpers that the linker could share with the baseline code.
+template<class Law>
+void forceKernel::accelerationRowAVX512(const float *x, const float *y, const float *z, const float *m, size_t n,
+                                        float xi, float yi, float zi, const forceLawParameters &law,
+                                        float *acceleration) {
+    const __m512 softening = _mm512_set1_ps(law.softeningSquared);
+    const __m512 cutoff = _mm512_set1_ps(law.cutoffSquared);
+    const __m512 vxi = _mm512_set1_ps(xi);
+    const __m512 vyi = _mm512_set1_ps(yi);
+    const __m512 vzi = _mm512_set1_ps(zi);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 threeHalves = _mm512_set1_ps(1.5f);
+    __m512 ax = _mm512_setzero_ps(), ay = _mm512_setzero_ps(), az = _mm512_setzero_ps();
+
+    for (size_t j = 0; j < n; j += 16) {
+        // the tail is a masked load, inactive lanes read as massless sources at the origin
+        const __mmask16 live = n - j >= 16 ? static_cast<__mmask16>(0xFFFF)
+                                           : static_cast<__mmask16>((1u << (n - j)) - 1u);
+        const __m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(live, x + j), vxi);
+        const __m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(live, y + j), vyi);
+        const __m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(live, z + j), vzi);
+        const __m512 mj = _mm512_maskz_loadu_ps(live, m + j);
+        __m512 r2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+        // drop zero-distance lanes (the target itself) and the tail
+        __mmask16 valid = _mm512_mask_cmp_ps_mask(live, r2, _mm512_setzero_ps(), _CMP_GT_OQ);
+        if constexpr (Law::truncated) valid = _mm512_mask_cmp_ps_mask(valid, r2, cutoff, _CMP_LT_OQ);
+        if constexpr (Law::softened) {
+            r2 = _mm512_add_ps(r2, softening);
+            valid = _mm512_mask_cmp_ps_mask(live, r2, _mm512_setzero_ps(), _CMP_GT_OQ);
+        }
+        // rsqrt14 estimate plus one Newton-Raphson step: inv * (1.5 - 0.5 * r2 * inv^2)
+        __m512 inv = _mm512_rsqrt14_ps(r2);
+        inv = _mm512_mul_ps(inv, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(inv, inv), threeHalves));
+        const __m512 s = _mm512_maskz_mul_ps(valid, mj, _mm512_mul_ps(inv, _mm512_mul_ps(inv, inv)));
+        ax = _mm512_fmadd_ps(dx, s, ax);
+        ay = _mm512_fmadd_ps(dy, s, ay);
+        az = _mm512_fmadd_ps(dz, s, az);
+    }
+    acceleration[0] += _mm512_reduce_add_ps(ax);
+    acceleration[1] += _mm512_reduce_add_ps(ay);
+    acceleration[2] += _mm512_reduce_add_ps(az);
+}
+
+N_BODY_INSTANTIATE_ROWS(accelerationRowAVX512)
+#endif
@@ -0,0 +1,74 @@
+#include "forceKernel.h"
+
+#ifdef N_BODY_X86_KERNELS
+#include <immintrin.h>
+
+// Only intrinsics in this file, it is built with SSE4.1 enabled and must not emit
+// out-of-line helpers that the linker could share with the baseline code.
+template<class Law>
+static inline void rowStep(__m128 xj, __m128 yj, __m128 zj, __m128 mj, __m128 xi, __m128 yi, __m128 zi,
+                           __m128 softening, __m128 cutoff, __m128 &ax, __m128 &ay, __m128 &az) {
+    const __m128 dx = _mm_sub_ps(xj, xi);
+    const __m128 dy = _mm_sub_ps(yj, yi);
+    const __m128 dz = _mm_sub_ps(zj, zi);
+    __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+    // zero-distance lanes (the target itself, padding) become NaN below, they are masked out
+    __m128 live = _mm_cmpgt_ps(r2, _mm_setzero_ps());
+    if constexpr (Law::truncated) live = _mm_and_ps(live, _mm_cmplt_ps(r2, cutoff));
+    if constexpr (Law::softened) {
+        r2 = _mm_add_ps(r2, softening);
+        live = _mm_cmpgt_ps(r2, _mm_setzero_ps());
+    }
+    // rsqrt estimate plus one Newton-Raphson step: inv * (1.5 - 0.5 * r2 * inv^2)
+    __m128 inv = _mm_rsqrt_ps(r2);
+    const __m128 halfR2 = _mm_mul_ps(_mm_set1_ps(0.5f), r2);
+    inv = _mm_mul_ps(inv, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(halfR2, _mm_mul_ps(inv, inv))));
+    inv = _mm_and_ps(inv, live);
+    const __m128 s = _mm_mul_ps(mj, _mm_mul_ps(inv, _mm_mul_ps(inv, inv)));
+    ax = _mm_add_ps(ax, _mm_mul_ps(dx, s));
+    ay = _mm_add_ps(ay, _mm_mul_ps(dy, s));
+    az = _mm_add_ps(az, _mm_mul_ps(dz, s));
+}
+
+static inline float horizontalSum(__m128 v) {
+    v = _mm_hadd_ps(v, v);
+    v = _mm_hadd_ps(v, v);
+    return _mm_cvtss_f32(v);
+}
+
+template<class Law>
+void forceKernel::accelerationRowSSE4(const float *x, const float *y, const float *z, const float *m, size_t n,
+                                      float xi, float yi, float zi, const forceLawParameters &law,
+                                      float *acceleration) {
+    const __m128 softening = _mm_set1_ps(law.softeningSquared);
+    const __m128 cutoff = _mm_set1_ps(law.cutoffSquared);
+    const __m128 vxi = _mm_set1_ps(xi);
+    const __m128 vyi = _mm_set1_ps(yi);
+    const __m128 vzi = _mm_set1_ps(zi);
+    __m128 ax = _mm_setzero_ps(), ay = _mm_setzero_ps(), az = _mm_setzero_ps();
+
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        rowStep<Law>(_mm_loadu_ps(x + j), _mm_loadu_ps(y + j), _mm_loadu_ps(z + j), _mm_loadu_ps(m + j),
+                     vxi, vyi, vzi, softening, cutoff, ax, ay, az);
+    }
+    if (j < n) {
+        // pad the tail with massless sources sitting on the target
+        alignas(16) float tx[4] = {xi, xi, xi, xi}, ty[4] = {yi, yi, yi, yi}, tz[4] = {zi, zi, zi, zi};
+        alignas(16) float tm[4] = {};
+        for (size_t k = 0; j + k < n; k++) {
+            tx[k] = x[j + k];
+            ty[k] = y[j + k];
+            tz[k] = z[j + k];
+            tm[k] = m[j + k];
+        }
+        rowStep<Law>(_mm_load_ps(tx), _mm_load_ps(ty), _mm_load_ps(tz), _mm_load_ps(tm), vxi, vyi, vzi,
+                     softening, cutoff, ax, ay, az);
+    }
+    acceleration[0] += horizontalSum(ax);
+    acceleration[1] += horizontalSum(ay);
+    acceleration[2] += horizontalSum(az);
+}
+
+N_BODY_INSTANTIATE_ROWS(accelerationRowSSE4)
+#endif
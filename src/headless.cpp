@@ -0,0 +1,374 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "bodyStore.h"
+#include "checkpoint.h"
+#include "physicsEngine.h"
+#include "threadPool.h"
+#include "timestepController.h"
+#include "trajectory.h"
+#include "profiler.h"
+#include "config.h"
+#ifdef N_BODY_DOMAINS
+#include "domainDecomposition.h"
+#endif
+
+static void printUsage(const char *program) {
+    std::printf("usage: %s [options]\n"
+                "  --bodies N      number of orbiting bodies (default 1000)\n"
+                "  --steps N       simulation steps to run (default 100)\n"
+                "  --dt SECONDS    timestep per step before timeScale (default 0.01)\n"
+                "  --seed N        generator seed, 0 = nondeterministic (default 1)\n"
+                "  --threads N     worker threads, 0 = all hardware threads (default 0)\n"
+                "  --scheduler X   leapfrog steps as a task graph or one parallelFor per pass:\n"
+                "                  graph | fork-join (default graph)\n"
+                "  --integrator X  euler | leapfrog | verlet | yoshida4 (default leapfrog)\n"
+                "  --block-levels N  per-body block timesteps down to dt / 2^N (default off)\n"
+                "  --eta X         block timestep accuracy (default 0.02)\n"
+                "  --adaptive X    pick the step from the energy drift, keeping the relative energy change\n"
+                "                  per check under X; --dt is the first step (default off)\n"
+                "  --check-every N  steps between energy and momentum checks (default 10)\n"
+                "  --solver NAME   direct | barnes-hut | fmm (default direct)\n"
+                "  --theta X       barnes-hut / fmm opening angle (default 0.5)\n"
+                "  --order N       fmm expansion order, 1..10 (default 4)\n"
+                "  --precision X   direct-sum accumulation: single | compensated | double (default single)\n"
+                "  --floating-origin  keep positions relative to a double origin at the centre of mass\n"
+                "  --law X         newtonian | plummer | cutoff (default newtonian)\n"
+                "  --softening X   plummer softening length (default 5)\n"
+                "  --cutoff X      cutoff law radius (default 1000)\n"
+                "  --collisions X  none | elastic | merge (default elastic); merge absorbs touching bodies\n"
+                "  --validate N    check the solver against the direct sum on N bodies before and after\n"
+                "  --trace FILE    write a Chrome trace_event JSON of every phase (chrome://tracing)\n"
+                "  --restore FILE  resume from a checkpoint; its bodies, clock and settings replace the above\n"
+                "  --checkpoint FILE  save a checkpoint after the last step\n"
+                "  --record FILE   write positions and velocities to a compressed trajectory file\n"
+                "  --record-every N  steps between recorded frames (default 10)\n"
+                "  --quantise BITS  low mantissa bits dropped from recorded values, 0 = lossless (default 0)\n"
+                "  --record-queue N  frames buffered for the writer thread (default 4)\n"
+                "  --report N      print progress every N steps, 0 = only the summary (default 0)\n",
+                program);
+#ifdef N_BODY_DOMAINS
+    std::printf("  --processes N   split the bodies into N spatial domains, one process each (default 1);\n"
+                "                  --threads is then per process\n"
+                "  --rebalance N   steps between domain load checks, the slabs move once the slowest\n"
+                "                  is 10%% over the mean; 0 = only the initial partition (default 10)\n");
+#endif
+}
+
+int main(int argc, char **argv) {
+    unsigned int numBodies = 1000;
+    unsigned long steps = 100;
+    double deltaTime = 0.01;
+    unsigned long report = 0;
+    size_t validateSamples = 0;
+    std::string tracePath;
+    std::string restorePath;
+    std::string checkpointPath;
+    std::string recordPath;
+    trajectoryOptions recordOptions;
+    CONFIG.seed = 1;
+#ifdef N_BODY_DOMAINS
+    domainOptions domains;
+    domains.processes = 1;
+    if (argc == 4 && std::strcmp(argv[1], "--domain-worker") == 0) {
+        return domainDecomposition::runWorker(argv[2], static_cast<unsigned int>(std::strtoul(argv[3], nullptr, 10)));
+    }
+#endif
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (arg == "--floating-origin") {
+            CONFIG.floatingOrigin = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "missing value for %s\n", arg.c_str());
+            printUsage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (arg == "--bodies") {
+            numBodies = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--steps") {
+            steps = std::strtoul(value, nullptr, 10);
+        } else if (arg == "--dt") {
+            deltaTime = std::strtod(value, nullptr);
+        } else if (arg == "--seed") {
+            CONFIG.seed = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--threads") {
+            CONFIG.numThreads = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--scheduler") {
+            if (std::strcmp(value, "graph") == 0) {
+                CONFIG.taskGraphStep = true;
+            } else if (std::strcmp(value, "fork-join") == 0) {
+                CONFIG.taskGraphStep = false;
+            } else {
+                std::fprintf(stderr, "unknown scheduler %s\n", value);
+                return 1;
+            }
+        } else if (arg == "--integrator") {
+            if (std::strcmp(value, "euler") == 0) {
+                CONFIG.integrator = integratorType::semiImplicitEuler;
+            } else if (std::strcmp(value, "leapfrog") == 0) {
+                CONFIG.integrator = integratorType::leapfrog;
+            } else if (std::strcmp(value, "verlet") == 0) {
+                CONFIG.integrator = integratorType::velocityVerlet;
+            } else if (std::strcmp(value, "yoshida4") == 0) {
+                CONFIG.integrator = integratorType::yoshida4;
+            } else {
+                std::fprintf(stderr, "unknown integrator %s\n", value);
+                return 1;
+            }
+        } else if (arg == "--block-levels") {
+            CONFIG.blockTimesteps = true;
+            CONFIG.maxTimestepLevel = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--eta") {
+            CONFIG.timestepAccuracy = std::strtof(value, nullptr);
+        } else if (arg == "--adaptive") {
+            CONFIG.adaptiveTimestep = true;
+            CONFIG.energyTolerance = std::strtof(value, nullptr);
+        } else if (arg == "--check-every") {
+            CONFIG.diagnosticInterval = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--solver") {
+            if (std::strcmp(value, "direct") == 0) {
+                CONFIG.solver = forceSolver::direct;
+            } else if (std::strcmp(value, "barnes-hut") == 0) {
+                CONFIG.solver = forceSolver::barnesHut;
+            } else if (std::strcmp(value, "fmm") == 0) {
+                CONFIG.solver = forceSolver::fastMultipole;
+            } else {
+                std::fprintf(stderr, "unknown solver %s\n", value);
+                return 1;
+            }
+        } else if (arg == "--theta") {
+            CONFIG.openingAngle = std::strtof(value, nullptr);
+        } else if (arg == "--order") {
+            CONFIG.multipoleOrder = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--precision") {
+            if (std::strcmp(value, "single") == 0) {
+                CONFIG.precision = scalarPrecision::single;
+            } else if (std::strcmp(value, "compensated") == 0) {
+                CONFIG.precision = scalarPrecision::compensated;
+            } else if (std::strcmp(value, "double") == 0) {
+                CONFIG.precision = scalarPrecision::doublePrecision;
+            } else {
+                std::fprintf(stderr, "unknown precision %s\n", value);
+                return 1;
+            }
+        } else if (arg == "--law") {
+            if (std::strcmp(value, "newtonian") == 0) {
+                CONFIG.law = forceLaw::newtonian;
+            } else if (std::strcmp(value, "plummer") == 0) {
+                CONFIG.law = forceLaw::plummer;
+            } else if (std::strcmp(value, "cutoff") == 0) {
+                CONFIG.law = forceLaw::cutoff;
+            } else {
+                std::fprintf(stderr, "unknown force law %s\n", value);
+                return 1;
+            }
+        } else if (arg == "--softening") {
+            CONFIG.softeningLength = std::strtof(value, nullptr);
+        } else if (arg == "--cutoff") {
+            CONFIG.cutoffRadius = std::strtof(value, nullptr);
+        } else if (arg == "--collisions") {
+            if (std::strcmp(value, "none") == 0) {
+                CONFIG.collisions = collisionMode::none;
+            } else if (std::strcmp(value, "elastic") == 0) {
+                CONFIG.collisions = collisionMode::elastic;
+            } else if (std::strcmp(value, "merge") == 0) {
+                CONFIG.collisions = collisionMode::merge;
+            } else {
+                std::fprintf(stderr, "unknown collision mode %s\n", value);
+                return 1;
+            }
+        } else if (arg == "--validate") {
+            validateSamples = std::strtoul(value, nullptr, 10);
+        } else if (arg == "--trace") {
+            tracePath = value;
+        } else if (arg == "--restore") {
+            restorePath = value;
+        } else if (arg == "--checkpoint") {
+            checkpointPath = value;
+        } else if (arg == "--record") {
+            recordPath = value;
+        } else if (arg == "--record-every") {
+            recordOptions.interval = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--quantise") {
+            recordOptions.quantiseBits = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--record-queue") {
+            recordOptions.queueFrames = std::strtoul(value, nullptr, 10);
+        } else if (arg == "--report") {
+            report = std::strtoul(value, nullptr, 10);
+#ifdef N_BODY_DOMAINS
+        } else if (arg == "--processes") {
+            domains.processes = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--rebalance") {
+            domains.rebalanceInterval = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+#endif
+        } else {
+            std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    CONFIG.numBodies = numBodies;
+
+    using clock = std::chrono::steady_clock;
+    auto generateStart = clock::now();
+    BodyStore bodies;
+    checkpointState restored;
+    if (restorePath.empty()) {
+        body::generateBodies(bodies, CONFIG.numBodies);
+    } else {
+        std::string error;
+        if (!checkpoint::load(restorePath, bodies, restored, error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        restored.applyToConfig();
+    }
+    auto generateEnd = clock::now();
+
+    threadPool::getInstance().resize(CONFIG.numThreads);
+    std::printf("bodies %zu, steps %lu, dt %g, seed %u, threads %u, precision %s%s\n",
+                bodies.size(), steps, deltaTime, CONFIG.seed, threadPool::getInstance().size(),
+                forceKernel::name(CONFIG.precision), CONFIG.floatingOrigin ? ", floating origin" : "");
+
+    auto printValidation = [&](const char *when) {
+        if (validateSamples == 0) return;
+        const forceValidation validation = physicsEngine::validateForces(bodies, validateSamples);
+        std::printf("force error %s: rms %.3e, max %.3e over %zu bodies\n",
+                    when, validation.rmsError, validation.maxError, validation.samples);
+    };
+    printValidation("at start");
+
+    if (!tracePath.empty()) {
+        profiler::setEnabled(true);
+        profiler::getInstance().nameThread("main");
+        profiler::getInstance().startTrace();
+    }
+
+    trajectoryWriter trajectory;
+    if (!recordPath.empty() && !trajectory.open(recordPath, recordOptions)) {
+        std::fprintf(stderr, "could not write %s\n", recordPath.c_str());
+        return 1;
+    }
+
+#ifdef N_BODY_DOMAINS
+    domainDecomposition decomposition;
+    if (domains.processes > 1 && CONFIG.adaptiveTimestep) {
+        std::fprintf(stderr, "--adaptive needs a single process\n");
+        return 1;
+    }
+    if (domains.processes > 1) {
+        domains.threadsPerProcess = CONFIG.numThreads;
+        std::string error;
+        if (!decomposition.start(bodies, domains, "/proc/self/exe", error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        std::printf("domains %u, threads per process %u\n", domains.processes, threadPool::getInstance().size());
+    }
+#endif
+
+    timestepController controller;
+    controller.reset(deltaTime);
+    double simulationTime = restored.simulationTime;
+
+    auto runStart = clock::now();
+    for (unsigned long step = 1; step <= steps; step++) {
+        const double stepDuration = CONFIG.adaptiveTimestep ? controller.deltaTime() : deltaTime;
+#ifdef N_BODY_DOMAINS
+        if (decomposition.running()) {
+            decomposition.step(stepDuration * CONFIG.timeScale);
+            // the bodies are only gathered for the frames the trajectory keeps
+            if (trajectory.isOpen() && recordOptions.interval != 0 &&
+                (restored.step + step) % recordOptions.interval == 0) {
+                decomposition.gather(bodies);
+            }
+        } else {
+            physicsEngine::update(bodies, stepDuration);
+        }
+#else
+        physicsEngine::update(bodies, stepDuration);
+#endif
+        simulationTime += stepDuration * CONFIG.timeScale;
+        if (CONFIG.adaptiveTimestep) controller.stepTaken(bodies);
+        trajectory.submit(bodies, simulationTime, restored.step + step);
+        if (report != 0 && step % report == 0) {
+            double elapsed = std::chrono::duration<double>(clock::now() - runStart).count();
+            std::printf("step %lu  %.3f s\n", step, elapsed);
+        }
+    }
+#ifdef N_BODY_DOMAINS
+    if (decomposition.running()) {
+        decomposition.gather(bodies);
+        const domainStats &domainRun = decomposition.stats();
+        std::printf("domains: %llu rebalances, %llu bodies migrated, force time imbalance %.2f\n",
+                    domainRun.rebalances, domainRun.migrated, domainRun.imbalance);
+        decomposition.stop();
+    }
+#endif
+    auto runEnd = clock::now();
+    if (CONFIG.adaptiveTimestep) {
+        const timestepStats adaptive = controller.stats();
+        std::printf("adaptive step: dt %.4g after %llu checks, energy drift %.3e (last check %.3e), "
+                    "momentum drift %.3e, simulated %.4g s\n",
+                    adaptive.deltaTime, adaptive.checks, adaptive.energyDrift, adaptive.checkError,
+                    adaptive.momentumDrift, simulationTime - restored.simulationTime);
+    }
+    if (trajectory.isOpen()) {
+        trajectory.close();
+        const trajectoryStats recorded = trajectory.stats();
+        std::printf("trajectory: %llu frames, %llu dropped, %llu stalls (%.3f s), %.1f MB -> %.1f MB (%.2fx), "
+                    "writer %.1f MB/s%s\n",
+                    recorded.framesWritten, recorded.framesDropped, recorded.stalls, recorded.stallSeconds,
+                    static_cast<double>(recorded.rawBytes) * 1e-6, static_cast<double>(recorded.writtenBytes) * 1e-6,
+                    recorded.writtenBytes ? static_cast<double>(recorded.rawBytes) /
+                                            static_cast<double>(recorded.writtenBytes) : 0.0,
+                    recorded.writeSeconds > 0.0 ? static_cast<double>(recorded.rawBytes) * 1e-6 / recorded.writeSeconds
+                                                : 0.0,
+                    recorded.failed ? ", write failed" : "");
+    }
+    if (!tracePath.empty()) {
+        if (profiler::getInstance().stopTrace(tracePath)) {
+            std::printf("trace written to %s\n", tracePath.c_str());
+        } else {
+            std::fprintf(stderr, "could not write %s\n", tracePath.c_str());
+        }
+        profiler::setEnabled(false);
+    }
+    printValidation("at end");
+
+    if (!checkpointPath.empty()) {
+        const auto saveStart = clock::now();
+        if (!checkpoint::save(checkpointPath, bodies,
+                              checkpointState::fromConfig(simulationTime, restored.step + steps))) {
+            std::fprintf(stderr, "could not write %s\n", checkpointPath.c_str());
+            return 1;
+        }
+        std::printf("checkpoint written to %s in %.3f s\n", checkpointPath.c_str(),
+                    std::chrono::duration<double>(clock::now() - saveStart).count());
+    }
+
+    if (CONFIG.collisions == collisionMode::merge) {
+        std::printf("bodies remaining %zu\n", bodies.size());
+    }
+
+    const double generateSeconds = std::chrono::duration<double>(generateEnd - generateStart).count();
+    const double runSeconds = std::chrono::duration<double>(runEnd - runStart).count();
+    std::printf("%s %.3f s, run %.3f s, %.3f ms/step\n",
+                restorePath.empty() ? "generate" : "restore", generateSeconds, runSeconds,
+                steps ? 1000.0 * runSeconds / static_cast<double>(steps) : 0.0);
+    if (!bodies.empty()) {
+        glm::vec3 p = bodies.worldPosition(bodies.size() - 1);
+        std::printf("last body at (%g, %g, %g)\n", p.x, p.y, p.z);
+    }
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "instancePacking.h"
+#include <cstring>
+
+// inlined into the packing loop, the branches left are taken only for out of range values
+static inline std::uint16_t floatToHalf(float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const auto sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000u);
+    const std::uint32_t magnitude = bits & 0x7fffffffu;
+
+    if (magnitude >= 0x7f800000u) {
+        // infinity stays infinity, NaN keeps a quiet payload bit
+        return static_cast<std::uint16_t>(sign | 0x7c00u | (magnitude > 0x7f800000u ? 0x200u : 0u));
+    }
+    if (magnitude >= 0x477ff000u) {
+        // rounds past the largest half (65504)
+        return static_cast<std::uint16_t>(sign | 0x7c00u);
+    }
+    if (magnitude < 0x38800000u) {
+        // subnormal half, or zero below half the smallest subnormal
+        if (magnitude < 0x33000000u) return sign;
+        const std::uint32_t exponent = magnitude >> 23;
+        const std::uint32_t mantissa = (magnitude & 0x7fffffu) | 0x800000u;
+        const std::uint32_t shift = 126 - exponent;
+        std::uint32_t half = mantissa >> shift;
+        const std::uint32_t remainder = mantissa & ((1u << shift) - 1u);
+        const std::uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1u))) half++;
+        return static_cast<std::uint16_t>(sign | half);
+    }
+    // normal: rebias the exponent from 127 to 15 and round the mantissa from 23 to 10 bits. The
+    // bias rounds to nearest even without a data-dependent branch, a carry moves into the exponent
+    const std::uint32_t bias = 0xfffu + ((magnitude >> 13) & 1u);
+    return static_cast<std::uint16_t>(sign | ((magnitude - 0x38000000u + bias) >> 13));
+}
+
+size_t instancePacking::stride(instanceFormat format) {
+    return format == instanceFormat::compact ? sizeof(compactInstance) : sizeof(fullInstance);
+}
+
+// index(i) maps output slot i to a body, identity or a gather through a visible list
+template<typename Index>
+static void packBodies(const BodyStore &bodies, size_t count, instanceFormat format, void *destination,
+                       Index index) {
+    // destination is usually write-combined mapped GPU memory: fill a local struct and store it
+    // once, sequentially, never read back. Instances are in world space.
+    const glm::vec3 origin(bodies.origin);
+    if (format == instanceFormat::compact) {
+        auto *out = static_cast<compactInstance *>(destination);
+        for (size_t i = 0; i < count; i++) {
+            const size_t b = index(i);
+            compactInstance instance{};
+            instance.x = bodies.x[b] + origin.x;
+            instance.y = bodies.y[b] + origin.y;
+            instance.z = bodies.z[b] + origin.z;
+            instance.radius = floatToHalf(bodies.radius[b]);
+            instance.r = floatToHalf(bodies.colour[b].r);
+            instance.g = floatToHalf(bodies.colour[b].g);
+            instance.b = floatToHalf(bodies.colour[b].b);
+            std::memcpy(out + i, &instance, sizeof(instance));
+        }
+        return;
+    }
+    auto *out = static_cast<fullInstance *>(destination);
+    for (size_t i = 0; i < count; i++) {
+        const size_t b = index(i);
+        fullInstance instance{};
+        instance.x = bodies.x[b] + origin.x;
+        instance.y = bodies.y[b] + origin.y;
+        instance.z = bodies.z[b] + origin.z;
+        instance.radius = bodies.radius[b];
+        instance.r = bodies.colour[b].r;
+        instance.g = bodies.colour[b].g;
+        instance.b = bodies.colour[b].b;
+        std::memcpy(out + i, &instance, sizeof(instance));
+    }
+}
+
+void instancePacking::pack(const BodyStore &bodies, size_t count, instanceFormat format, void *destination) {
+    packBodies(bodies, count, format, destination, [](size_t i) { return i; });
+}
+
+void instancePacking::pack(const BodyStore &bodies, const unsigned int *indices, size_t count, instanceFormat format,
+                           void *destination) {
+    packBodies(bodies, count, format, destination, [indices](size_t i) { return static_cast<size_t>(indices[i]); });
+}
+
+std::uint16_t instancePacking::toHalf(float value) {
+    return floatToHalf(value);
+}
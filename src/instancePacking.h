@@ -0,0 +1,45 @@
+#ifndef N_BODY_SIMULATION_GL_INSTANCEPACKING_H
+#define N_BODY_SIMULATION_GL_INSTANCEPACKING_H
+#include <cstddef>
+#include <cstdint>
+#include "bodyStore.h"
+
+enum class instanceFormat {
+    full, //position, radius, colour as 32-bit floats, 28 bytes
+    compact //32-bit position, half-float radius and colour, 20 bytes
+};
+
+struct fullInstance {
+    float x, y, z;
+    float radius;
+    float r, g, b;
+};
+
+struct compactInstance {
+    float x, y, z;
+    std::uint16_t radius;
+    std::uint16_t r, g, b;
+};
+
+static_assert(sizeof(fullInstance) == 28, "instance layout must match the vertex attributes");
+static_assert(sizeof(compactInstance) == 20, "instance layout must match the vertex attributes");
+
+// Writes the per-instance attributes the renderer draws with. Kept free of GL so the packing
+// cost can be measured headless.
+class instancePacking {
+public:
+    static size_t stride(instanceFormat format);
+
+    // bodies [0, count) into destination, which holds at least count * stride(format) bytes
+    static void pack(const BodyStore &bodies, size_t count, instanceFormat format, void *destination);
+
+    // bodies indices[0, count) in that order
+    static void pack(const BodyStore &bodies, const unsigned int *indices, size_t count, instanceFormat format,
+                     void *destination);
+
+    // IEEE 754 binary16, round to nearest even
+    static std::uint16_t toHalf(float value);
+};
+
+
+#endif //N_BODY_SIMULATION_GL_INSTANCEPACKING_H
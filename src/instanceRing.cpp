@@ -0,0 +1,72 @@
+#include "instanceRing.h"
+#include "instancePacking.h"
+#include "profiler.h"
+#include <algorithm>
+#include <numeric>
+
+// a section holds a whole number of instances in either format, so baseInstance lands exactly
+// where beginFrame writes
+static constexpr size_t sectionAlignment = std::lcm(sizeof(fullInstance), sizeof(compactInstance));
+
+static size_t alignSection(size_t bytes) {
+    return (bytes + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+}
+
+instanceRing::~instanceRing() {
+    release();
+}
+
+bool instanceRing::reserve(size_t bytes) {
+    if (id != 0 && bytes <= sectionBytes) return false;
+    const size_t grown = sectionBytes + sectionBytes / 2;
+    release();
+    sectionBytes = alignSection(std::max<size_t>({bytes, grown, 1024}));
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &id);
+    glBindBuffer(GL_ARRAY_BUFFER, id);
+    glBufferStorage(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(sections * sectionBytes), nullptr, flags);
+    mapped = static_cast<unsigned char *>(glMapBufferRange(GL_ARRAY_BUFFER, 0,
+                                                           static_cast<GLsizeiptr>(sections * sectionBytes), flags));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    current = 0;
+    return true;
+}
+
+void *instanceRing::beginFrame() {
+    current = (current + 1) % sections;
+    wait(current);
+    return mapped + current * sectionBytes;
+}
+
+void instanceRing::endFrame() {
+    if (fences[current]) glDeleteSync(fences[current]);
+    fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void instanceRing::wait(unsigned int section) {
+    if (!fences[section]) return;
+    PROFILE_SCOPE("instance fence wait");
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (true) {
+        const GLenum status = glClientWaitSync(fences[section], flags, 1000000);
+        if (status != GL_TIMEOUT_EXPIRED) break;
+        flags = 0;
+    }
+    glDeleteSync(fences[section]);
+    fences[section] = nullptr;
+}
+
+void instanceRing::release() {
+    if (id == 0) return;
+    for (unsigned int s = 0; s < sections; s++) {
+        wait(s);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, id);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDeleteBuffers(1, &id);
+    id = 0;
+    mapped = nullptr;
+    sectionBytes = 0;
+}
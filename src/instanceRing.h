@@ -0,0 +1,55 @@
+#ifndef N_BODY_SIMULATION_GL_INSTANCERING_H
+#define N_BODY_SIMULATION_GL_INSTANCERING_H
+#include <glad/glad.h>
+#include <cstddef>
+
+// Instance buffer split into three sections behind one persistent, coherent mapping
+// (glBufferStorage). Each frame writes the next section in place and fences it after the
+// draw, so the CPU only waits if it gets three frames ahead of the GPU and nothing is
+// reallocated or copied by the driver.
+class instanceRing {
+public:
+    static constexpr unsigned int sections = 3;
+
+    instanceRing() = default;
+
+    ~instanceRing();
+
+    instanceRing(const instanceRing &) = delete;
+
+    instanceRing &operator=(const instanceRing &) = delete;
+
+    // grows the storage so each section holds at least `bytes`, and by at least half its size so
+    // a slowly growing system does not recreate it every frame. True if the buffer was recreated
+    bool reserve(size_t bytes);
+
+    // waits until the GPU is done with the next section and returns its mapped memory
+    void *beginFrame();
+
+    // fences the section written by the last beginFrame, call after the draws that read it
+    void endFrame();
+
+    // first instance of the current section for glDraw*BaseInstance with this stride
+    [[nodiscard]] GLuint baseInstance(size_t stride) const {
+        return static_cast<GLuint>(current * (sectionBytes / stride));
+    }
+
+    [[nodiscard]] size_t capacity(size_t stride) const { return sectionBytes / stride; }
+
+    [[nodiscard]] GLuint buffer() const { return id; }
+
+    // must run while the GL context is still current
+    void release();
+
+private:
+    GLuint id = 0;
+    unsigned char *mapped = nullptr;
+    size_t sectionBytes = 0;
+    unsigned int current = 0;
+    GLsync fences[sections] = {};
+
+    void wait(unsigned int section);
+};
+
+
+#endif //N_BODY_SIMULATION_GL_INSTANCERING_H
@@ -1,8 +1,12 @@
+#include <chrono>
+#include <future>
+#include <vector>
 #include "renderer.h"
 #include "shader.h"
 #include "menuGUI.h"
-#include "physicsEngine.h"
+#include "simulation.h"
 #include "config.h"
+#include "profiler.h"
 
 
 int main() {
@@ -10,12 +14,26 @@ int main() {
     menuGUI menu(renderEngine.getWindow());
     Shader shader("shaders/shader.vert", "shaders/shader.frag");
 
+    std::vector<SphereData> sphereLods;
+    for (int segments: renderer::lodSegments) {
+        sphereLods.push_back(body::generateSphereVertices(1.0f, segments));
+    }
+    renderEngine.setupBuffers(sphereLods, menu.targetBodyCount);
+    // the settings the running system was last built or updated with
+    menuSettings applied = menu.settings();
 
-    auto bodies = body::generateBodies(menu.targetBodyCount);
-    auto sphereData = body::generateSphereVertices(1.0f, 32);
+    // declared after the renderer so the physics thread stops before the GL context goes away
+    simulation sim;
+    const unsigned int initialBodies = menu.targetBodyCount;
+    sim.post([initialBodies](BodyStore &bodies) {
+        body::generateBodies(bodies, initialBodies);
+    });
+    sim.start();
 
-    renderEngine.setupBuffers(sphereData, menu.targetBodyCount);
+    std::future<bool> pendingSave;
+    std::future<checkpointState> pendingSeek;
 
+    profiler::getInstance().nameThread("render");
     double deltaTime = 0.0f;
     double lastFrame = 0.0f;
     while (!renderEngine.shouldClose()) {
@@ -23,32 +41,136 @@ int main() {
         deltaTime = currentTime - lastFrame;
         lastFrame = currentTime;
 
-        renderEngine.processInput(deltaTime);
-
-        if (menu.needsUpdate) {
-            menu.update();
-            bodies = body::generateBodies(CONFIG.numBodies);
-            renderEngine.setupBuffers(sphereData, CONFIG.numBodies);
-            menu.needsUpdate = false;
+        {
+            PROFILE_SCOPE("input");
+            renderEngine.processInput(deltaTime);
         }
+
         if (menu.needsReset) {
             menu.reset();
-            menu.update();
-            bodies = body::generateBodies(CONFIG.numBodies);
-            renderEngine.setupBuffers(sphereData, CONFIG.numBodies);
+            menu.needsRegenerate = true;
             menu.needsReset = false;
         }
-        if (!CONFIG.paused) {
-            physicsEngine::update(bodies, deltaTime);
+        if (menu.needsUpdate || menu.needsRegenerate) {
+            PROFILE_SCOPE("apply settings");
+            const menuSettings settings = menu.settings();
+            if (menu.needsRegenerate || settings.changesGeneration(applied)) {
+                sim.post([settings](BodyStore &bodies) {
+                    settings.apply();
+                    body::generateBodies(bodies, CONFIG.numBodies);
+                });
+            } else {
+                // everything else takes effect on the running system
+                sim.post([settings, applied](BodyStore &bodies) {
+                    settings.applyLive(bodies, applied);
+                });
+            }
+            applied = settings;
+            renderEngine.reserveInstances(static_cast<size_t>(menu.targetBodyCount) + 1);
+            renderEngine.setInstanceFormat(menu.targetCompactInstances ? instanceFormat::compact
+                                                                      : instanceFormat::full);
+            menu.needsUpdate = false;
+            menu.needsRegenerate = false;
         }
 
-        renderEngine.renderFrame(bodies, shader);
-        menuGUI::newFrame();
-        menu.render();
-        renderEngine.swapBuffers();
-    }
-    return 0;
-}
+        if (menu.needsSave) {
+            if (!pendingSave.valid()) {
+                pendingSave = sim.saveCheckpoint(menu.checkpointPath);
+                menu.checkpointStatus = "saving";
+            }
+            menu.needsSave = false;
+        }
+        if (pendingSave.valid() && pendingSave.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            menu.checkpointStatus = pendingSave.get() ? "saved" : "save failed";
+        }
+        if (menu.needsLoad) {
+            BodyStore restored;
+            checkpointState state;
+            std::string error;
+            if (checkpoint::load(menu.checkpointPath, restored, state, error)) {
+                menu.load(state);
+                applied = menu.settings();
+                renderEngine.reserveInstances(restored.size());
+                sim.restore(std::move(restored), state);
+                menu.checkpointStatus = "loaded";
+            } else {
+                menu.checkpointStatus = error;
+            }
+            menu.needsLoad = false;
+        }
+
+        if (menu.needsRecordingToggle) {
+            if (menu.recording) {
+                sim.stopRecording();
+            } else {
+                sim.startRecording(menu.trajectoryPath, menu.trajectory);
+            }
+            menu.recording = !menu.recording;
+            menu.needsRecordingToggle = false;
+        }
+        menu.recordingStats = sim.recordingStats();
 
+        if (menu.needsRewindToggle) {
+            if (menu.keepingHistory) {
+                sim.stopRewind();
+                menu.scrubbing = false;
+            } else {
+                sim.startRewind(menu.rewind);
+            }
+            menu.keepingHistory = !menu.keepingHistory;
+            menu.needsRewindToggle = false;
+        }
+        // unpausing from the keyboard ends a preview
+        if (menu.scrubbing && !CONFIG.paused) menu.scrubbing = false;
+        if (menu.needsPreview) {
+            CONFIG.paused = true;
+            sim.preview(menu.scrubStep);
+            menu.scrubbing = true;
+            menu.needsPreview = false;
+        }
+        if (menu.needsEndPreview) {
+            sim.endPreview();
+            CONFIG.paused = false;
+            menu.scrubbing = false;
+            menu.needsEndPreview = false;
+        }
+        if (menu.needsSeek) {
+            if (!pendingSeek.valid()) {
+                pendingSeek = sim.seek(menu.scrubStep);
+                CONFIG.paused = false;
+                menu.scrubbing = false;
+            }
+            menu.needsSeek = false;
+        }
+        if (pendingSeek.valid() && pendingSeek.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            // the run continues under the settings the step was recorded with
+            menu.load(pendingSeek.get());
+            applied = menu.settings();
+        }
+        menu.rewindState = sim.rewindState();
 
+        {
+            PROFILE_SCOPE("acquire snapshot");
+            sim.acquireLatest();
+        }
+        menu.simulationStepRate = sim.getStepRate();
+        menu.timestepState = sim.timestepState();
 
+        renderEngine.renderFrame(sim.latest().bodies, shader);
+        menu.liveBodies = sim.latest().bodies.size();
+        menu.visibleBodies = renderEngine.visibleBodies();
+        menu.drawnTriangles = renderEngine.drawnTriangles();
+        {
+            PROFILE_SCOPE("menu");
+            menuGUI::newFrame();
+            menu.render();
+        }
+        {
+            PROFILE_SCOPE("swap");
+            renderEngine.swapBuffers();
+        }
+        if (profiler::enabled()) profiler::getInstance().endFrame();
+    }
+    sim.stop();
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "mappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mappedFile::~mappedFile() {
+    close();
+}
+
+#ifdef _WIN32
+bool mappedFile::open(const std::string &path) {
+    close();
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                       FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        file = nullptr;
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        close();
+        return false;
+    }
+    length = static_cast<size_t>(fileSize.QuadPart);
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        close();
+        return false;
+    }
+    view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void mappedFile::close() {
+    if (view) UnmapViewOfFile(view);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+    view = nullptr;
+    mapping = nullptr;
+    file = nullptr;
+    length = 0;
+}
+#else
+bool mappedFile::open(const std::string &path) {
+    close();
+    const int descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) return false;
+    struct stat status{};
+    if (fstat(descriptor, &status) != 0 || status.st_size <= 0) {
+        ::close(descriptor);
+        return false;
+    }
+    length = static_cast<size_t>(status.st_size);
+    void *address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    // the mapping keeps its own reference to the file
+    ::close(descriptor);
+    if (address == MAP_FAILED) {
+        length = 0;
+        return false;
+    }
+    view = address;
+    // columns are read front to back exactly once
+    madvise(view, length, MADV_SEQUENTIAL);
+    return true;
+}
+
+void mappedFile::close() {
+    if (view) munmap(view, length);
+    view = nullptr;
+    length = 0;
+}
+#endif
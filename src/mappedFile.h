@@ -0,0 +1,34 @@
+#ifndef N_BODY_SIMULATION_GL_MAPPEDFILE_H
+#define N_BODY_SIMULATION_GL_MAPPEDFILE_H
+#include <cstddef>
+#include <string>
+
+// Read-only memory map of a whole file (mmap, or a file mapping on Windows)
+class mappedFile {
+public:
+    mappedFile() = default;
+
+    ~mappedFile();
+
+    mappedFile(const mappedFile &) = delete;
+
+    mappedFile &operator=(const mappedFile &) = delete;
+
+    bool open(const std::string &path);
+
+    void close();
+
+    [[nodiscard]] const unsigned char *data() const { return static_cast<const unsigned char *>(view); }
+    [[nodiscard]] size_t size() const { return length; }
+
+private:
+    void *view = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void *file = nullptr;
+    void *mapping = nullptr;
+#endif
+};
+
+
+#endif //N_BODY_SIMULATION_GL_MAPPEDFILE_H
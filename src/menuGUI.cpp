@@ -1,7 +1,14 @@
 #include "menuGUI.h"
+#include "body.h"
 #include "config.h"
+#include "forceKernel.h"
+#include "physicsEngine.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
 
-menuGUI::menuGUI(GLFWwindow *window) : targetBodyCount(CONFIG.numBodies), window(window) {
+menuGUI::menuGUI(GLFWwindow *window) : window(window) {
+    targetBodyCount = CONFIG.numBodies;
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
     ImGuiIO &io = ImGui::GetIO();
@@ -26,8 +33,9 @@ void menuGUI::newFrame() {
 void menuGUI::render() {
     int display_w, display_h;
     glfwGetFramebufferSize(window, &display_w, &display_h);
-    ImVec2 menuPos(display_w - 375, display_h - 475);
-    ImGui::SetNextWindowPos(menuPos);
+    // anchor the bottom-right corner so the panel grows up and left as it auto-resizes
+    ImVec2 menuPos(display_w - 10, display_h - 10);
+    ImGui::SetNextWindowPos(menuPos, ImGuiCond_Always, ImVec2(1.0f, 1.0f));
     ImGui::SetNextWindowBgAlpha(0.75f);
 
     ImGuiWindowFlags flags = ImGuiWindowFlags_NoDecoration |
@@ -46,14 +54,79 @@ void menuGUI::render() {
         ImGui::Text("Body Count");
         ImGui::InputInt("##BodyCount", &targetBodyCount, 1, 100);
         if (targetBodyCount < 0) targetBodyCount = 0;
+        ImGui::InputInt("Seed (0 = random)", &targetSeed, 1, 100);
+        if (targetSeed < 0) targetSeed = 0;
+        ImGui::Checkbox("Compact instances (half float)", &targetCompactInstances);
+        ImGui::Text("Drawn: %zu of %zu bodies, %zu triangles", visibleBodies, liveBodies, drawnTriangles);
 
         ImGui::Separator();
         ImGui::Text("Physics Settings");
+        ImGui::Text("Force kernel: %s", forceKernel::name(forceKernel::detect()));
         ImGui::InputFloat("Gravitational Constant", &targetGravitationalConstant, 100.0f, 1000.0f);
         if (targetGravitationalConstant < 0) targetGravitationalConstant = 0;
         ImGui::InputFloat("timescale", &targetTimeScale, 0.1f, 10.0f);
         if (targetTimeScale < 0) targetTimeScale = 0;
-
+        const char *integratorNames[] = {"Semi-implicit Euler", "Leapfrog (KDK)", "Velocity Verlet", "Yoshida 4th order"};
+        ImGui::Combo("Integrator", &targetIntegrator, integratorNames, 4);
+        ImGui::Checkbox("Block timesteps", &targetBlockTimesteps);
+        if (targetBlockTimesteps) {
+            ImGui::InputInt("Max level", &targetMaxTimestepLevel, 1, 2);
+            if (targetMaxTimestepLevel < 0) targetMaxTimestepLevel = 0;
+            if (targetMaxTimestepLevel > 16) targetMaxTimestepLevel = 16;
+            ImGui::InputFloat("Accuracy (eta)", &targetTimestepAccuracy, 0.005f, 0.05f, "%.3f");
+            if (targetTimestepAccuracy < 1e-4f) targetTimestepAccuracy = 1e-4f;
+        }
+        const char *solverNames[] = {"Direct", "Barnes-Hut", "Fast Multipole"};
+        ImGui::Combo("Solver", &targetSolver, solverNames, 3);
+        if (targetSolver != static_cast<int>(forceSolver::direct)) {
+            ImGui::InputFloat("Opening Angle", &targetOpeningAngle, 0.05f, 0.25f);
+            if (targetOpeningAngle < 0) targetOpeningAngle = 0;
+        }
+        if (targetSolver == static_cast<int>(forceSolver::fastMultipole)) {
+            ImGui::InputInt("Expansion order", &targetMultipoleOrder, 1, 2);
+            if (targetMultipoleOrder < 1) targetMultipoleOrder = 1;
+            if (targetMultipoleOrder > static_cast<int>(fmm::maxOrder)) targetMultipoleOrder = fmm::maxOrder;
+        }
+        if (targetSolver == static_cast<int>(forceSolver::direct)) {
+            const char *precisionNames[] = {"Single", "Compensated (Kahan)", "Double"};
+            ImGui::Combo("Precision", &targetPrecision, precisionNames, 3);
+        }
+        if (targetSolver != static_cast<int>(forceSolver::fastMultipole)) {
+            const char *lawNames[] = {"Newtonian", "Plummer softened", "Cutoff"};
+            ImGui::Combo("Force law", &targetForceLaw, lawNames, 3);
+            if (targetForceLaw == static_cast<int>(forceLaw::plummer)) {
+                ImGui::InputFloat("Softening", &targetSofteningLength, 0.5f, 5.0f);
+                if (targetSofteningLength < 0) targetSofteningLength = 0;
+            }
+            if (targetForceLaw == static_cast<int>(forceLaw::cutoff)) {
+                ImGui::InputFloat("Cutoff radius", &targetCutoffRadius, 50.0f, 500.0f);
+                if (targetCutoffRadius < 0) targetCutoffRadius = 0;
+            }
+        }
+        const char *collisionNames[] = {"None", "Elastic", "Merge"};
+        ImGui::Combo("Collisions", &targetCollisions, collisionNames, 3);
+        ImGui::Checkbox("Floating origin", &targetFloatingOrigin);
+        ImGui::Checkbox("Validate forces", &targetValidateForces);
+        if (targetValidateForces) {
+            const forceValidation validation = physicsEngine::lastValidation();
+            ImGui::Text("Force error: rms %.2e, max %.2e", validation.rmsError, validation.maxError);
+        }
+        ImGui::InputInt("Threads (0 = all)", &targetThreadCount, 1, 4);
+        if (targetThreadCount < 0) targetThreadCount = 0;
+        ImGui::Checkbox("Task graph step", &targetTaskGraphStep);
+        ImGui::InputFloat("Fixed timestep", &targetFixedTimeStep, 0.001f, 0.01f, "%.4f");
+        if (targetFixedTimeStep < 1e-5f) targetFixedTimeStep = 1e-5f;
+        ImGui::Checkbox("Adaptive timestep", &targetAdaptiveTimestep);
+        if (targetAdaptiveTimestep) {
+            ImGui::InputFloat("Energy tolerance", &targetEnergyTolerance, 0.0f, 0.0f, "%.1e");
+            if (targetEnergyTolerance < 1e-12f) targetEnergyTolerance = 1e-12f;
+            ImGui::InputInt("Check every N steps", &targetDiagnosticInterval, 1, 10);
+            if (targetDiagnosticInterval < 1) targetDiagnosticInterval = 1;
+            ImGui::Text("Step %.5f, energy drift %.2e (last check %.2e)", timestepState.deltaTime,
+                        timestepState.energyDrift, timestepState.checkError);
+            ImGui::Text("Momentum drift %.2e", timestepState.momentumDrift);
+        }
+        ImGui::Text("Physics rate: %.0f steps/s", simulationStepRate);
 
         ImGui::Separator();
         ImGui::Text("Central Body");
@@ -89,11 +162,39 @@ void menuGUI::render() {
             targetMaxBodyRadius = targetMinBodyRadius;
         }
 
+        ImGui::Separator();
+        ImGui::Text("Checkpoint");
+        ImGui::InputText("##CheckpointPath", checkpointPath, sizeof(checkpointPath));
+        if (ImGui::Button("Save")) {
+            needsSave = true;
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Load")) {
+            needsLoad = true;
+        }
+        if (!checkpointStatus.empty()) {
+            ImGui::SameLine();
+            ImGui::Text("%s", checkpointStatus.c_str());
+        }
+
+        ImGui::Separator();
+        renderTrajectory();
+
+        ImGui::Separator();
+        renderRewind();
+
+        ImGui::Separator();
+        renderProfiler();
+
         ImGui::Separator();
         if (ImGui::Button("Apply Changes")) {
             needsUpdate = true;
         }
         ImGui::SameLine();
+        if (ImGui::Button("Regenerate")) {
+            needsRegenerate = true;
+        }
+        ImGui::SameLine();
         if (ImGui::Button("Reset Simulation")) {
             needsReset = true;
         }
@@ -103,10 +204,91 @@ void menuGUI::render() {
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
-void menuGUI::update() const {
+// Applies immediately rather than through Apply Changes, the profiler is safe to toggle from
+// the render thread
+void menuGUI::renderProfiler() {
+    if (ImGui::Checkbox("Profiling", &profiling)) {
+        profiler::setEnabled(profiling);
+    }
+    if (!profiling) return;
+
+    profiler &profile = profiler::getInstance();
+    profile.history(phaseHistories);
+    for (const auto &phase: phaseHistories) {
+        char overlay[64];
+        std::snprintf(overlay, sizeof(overlay), "%.3f ms", phase.average);
+        ImGui::PlotLines(phase.name, phase.milliseconds.data(), static_cast<int>(phase.milliseconds.size()),
+                         0, overlay, 0.0f, FLT_MAX, ImVec2(200.0f, 30.0f));
+    }
+
+    if (!profile.tracing()) {
+        if (ImGui::Button("Record trace")) {
+            profile.startTrace();
+            traceStatus = "recording";
+        }
+    } else if (ImGui::Button("Stop and save trace")) {
+        const char *path = "n_body_trace.json";
+        traceStatus = profile.stopTrace(path) ? std::string("saved ") + path : std::string("could not write ") + path;
+    }
+    if (!traceStatus.empty()) {
+        ImGui::SameLine();
+        ImGui::Text("%s", traceStatus.c_str());
+    }
+}
+
+void menuGUI::renderTrajectory() {
+    ImGui::Text("Trajectory");
+    if (!recording) {
+        ImGui::InputText("##TrajectoryPath", trajectoryPath, sizeof(trajectoryPath));
+        int interval = static_cast<int>(trajectory.interval);
+        ImGui::InputInt("Record every N steps", &interval, 1, 10);
+        trajectory.interval = static_cast<unsigned int>(interval < 1 ? 1 : interval);
+        int quantise = static_cast<int>(trajectory.quantiseBits);
+        ImGui::InputInt("Dropped mantissa bits", &quantise, 1, 4);
+        trajectory.quantiseBits = static_cast<unsigned int>(quantise < 0 ? 0 : quantise > 20 ? 20 : quantise);
+        ImGui::Checkbox("Drop frames when the writer falls behind", &trajectory.dropWhenFull);
+    }
+    if (ImGui::Button(recording ? "Stop recording" : "Record")) {
+        needsRecordingToggle = true;
+    }
+    const trajectoryStats &s = recordingStats;
+    if (s.framesWritten > 0 || recording) {
+        ImGui::Text("%llu frames, %llu dropped, %llu stalls (%.2f s), queue %zu",
+                    s.framesWritten, s.framesDropped, s.stalls, s.stallSeconds, s.queued);
+        ImGui::Text("%.1f MB written, %.2fx, writer %.0f MB/s%s",
+                    static_cast<double>(s.writtenBytes) * 1e-6,
+                    s.writtenBytes ? static_cast<double>(s.rawBytes) / static_cast<double>(s.writtenBytes) : 0.0,
+                    s.writeSeconds > 0.0 ? static_cast<double>(s.rawBytes) * 1e-6 / s.writeSeconds : 0.0,
+                    s.failed ? ", write failed" : "");
+    }
+}
+
+void menuSettings::apply() const {
     CONFIG.numBodies = targetBodyCount;
+    CONFIG.seed = targetSeed;
+    CONFIG.compactInstances = targetCompactInstances;
     CONFIG.gravitationalConstant = targetGravitationalConstant;
     CONFIG.timeScale = targetTimeScale;
+    CONFIG.integrator = static_cast<integratorType>(targetIntegrator);
+    CONFIG.blockTimesteps = targetBlockTimesteps;
+    CONFIG.maxTimestepLevel = targetMaxTimestepLevel;
+    CONFIG.timestepAccuracy = targetTimestepAccuracy;
+    CONFIG.solver = static_cast<forceSolver>(targetSolver);
+    CONFIG.openingAngle = targetOpeningAngle;
+    CONFIG.multipoleOrder = targetMultipoleOrder;
+    CONFIG.precision = static_cast<scalarPrecision>(targetPrecision);
+    CONFIG.floatingOrigin = targetFloatingOrigin;
+    CONFIG.law = static_cast<forceLaw>(targetForceLaw);
+    CONFIG.softeningLength = targetSofteningLength;
+    CONFIG.cutoffRadius = targetCutoffRadius;
+    CONFIG.collisions = static_cast<collisionMode>(targetCollisions);
+    CONFIG.validateForces = targetValidateForces;
+    CONFIG.numThreads = targetThreadCount;
+    CONFIG.taskGraphStep = targetTaskGraphStep;
+    CONFIG.fixedTimeStep = targetFixedTimeStep;
+    CONFIG.adaptiveTimestep = targetAdaptiveTimestep;
+    CONFIG.energyTolerance = targetEnergyTolerance;
+    CONFIG.diagnosticInterval = targetDiagnosticInterval;
     CONFIG.centralBodyMass = targetCentralBodyMass;
     CONFIG.centralBodyRadius = targetCentralBodyRadius;
     CONFIG.minOrbitRadius = targetMinOrbitRadius;
@@ -117,16 +299,103 @@ void menuGUI::update() const {
     CONFIG.maxBodyRadius = targetMaxBodyRadius;
 }
 
+bool menuSettings::changesGeneration(const menuSettings &applied) const {
+    return targetSeed != applied.targetSeed ||
+           targetMinOrbitRadius != applied.targetMinOrbitRadius ||
+           targetMaxOrbitRadius != applied.targetMaxOrbitRadius ||
+           targetMinBodyMass != applied.targetMinBodyMass ||
+           targetMaxBodyMass != applied.targetMaxBodyMass ||
+           targetMinBodyRadius != applied.targetMinBodyRadius ||
+           targetMaxBodyRadius != applied.targetMaxBodyRadius;
+}
+
+void menuSettings::applyLive(BodyStore &bodies, const menuSettings &applied) const {
+    apply();
+    if (!bodies.empty() && (targetCentralBodyMass != applied.targetCentralBodyMass ||
+                            targetCentralBodyRadius != applied.targetCentralBodyRadius)) {
+        bodies.mass[0] = CONFIG.centralBodyMass;
+        bodies.radius[0] = CONFIG.centralBodyRadius;
+        bodies.accelerationsValid = false;
+    }
+    if (targetBodyCount != applied.targetBodyCount) {
+        body::resizeBodies(bodies, CONFIG.numBodies);
+    }
+}
+
+void menuSettings::load(const checkpointState &state) {
+    targetBodyCount = static_cast<int>(state.numBodies);
+    targetSeed = static_cast<int>(state.seed);
+    targetGravitationalConstant = state.gravitationalConstant;
+    targetTimeScale = state.timeScale;
+    targetIntegrator = static_cast<int>(state.integrator);
+    targetBlockTimesteps = state.blockTimesteps != 0;
+    targetMaxTimestepLevel = static_cast<int>(state.maxTimestepLevel);
+    targetTimestepAccuracy = state.timestepAccuracy;
+    targetSolver = static_cast<int>(state.solver);
+    targetOpeningAngle = state.openingAngle;
+    targetMultipoleOrder = static_cast<int>(state.multipoleOrder);
+    targetPrecision = static_cast<int>(state.precision);
+    targetFloatingOrigin = state.floatingOrigin != 0;
+    targetForceLaw = static_cast<int>(state.law);
+    targetSofteningLength = state.softeningLength;
+    targetCutoffRadius = state.cutoffRadius;
+    targetCollisions = static_cast<int>(state.collisions);
+    targetFixedTimeStep = state.fixedTimeStep;
+    targetAdaptiveTimestep = state.adaptiveTimestep != 0;
+    targetEnergyTolerance = state.energyTolerance;
+    targetDiagnosticInterval = static_cast<int>(state.diagnosticInterval);
+    targetCentralBodyMass = state.centralBodyMass;
+    targetCentralBodyRadius = state.centralBodyRadius;
+    targetMinOrbitRadius = state.minOrbitRadius;
+    targetMaxOrbitRadius = state.maxOrbitRadius;
+    targetMinBodyMass = state.minBodyMass;
+    targetMaxBodyMass = state.maxBodyMass;
+    targetMinBodyRadius = state.minBodyRadius;
+    targetMaxBodyRadius = state.maxBodyRadius;
+}
+
 void menuGUI::reset() {
-    targetBodyCount = 1;
-    targetGravitationalConstant = 1000.0f;
-    targetTimeScale = 1.0f;
-    targetCentralBodyMass = 10000.0f;
-    targetCentralBodyRadius = 100.0f;
-    targetMinOrbitRadius = 170.0f;
-    targetMaxOrbitRadius = 400.0f;
-    targetMinBodyMass = 1.0f;
-    targetMaxBodyMass = 10.0f;
-    targetMinBodyRadius = 15.0f;
-    targetMaxBodyRadius = 30.0f;
+    static_cast<menuSettings &>(*this) = menuSettings();
+}
+
+// Scrubbing pauses the run and shows recorded steps; Resume continues from the shown step,
+// Back to live returns to where the run was paused
+void menuGUI::renderRewind() {
+    ImGui::Text("History");
+    if (!keepingHistory) {
+        int budget = static_cast<int>(rewind.budgetBytes >> 20);
+        ImGui::InputInt("Memory budget (MB)", &budget, 16, 128);
+        rewind.budgetBytes = static_cast<size_t>(budget < 1 ? 1 : budget) << 20;
+        int interval = static_cast<int>(rewind.keyframeInterval);
+        ImGui::InputInt("Steps between keyframes", &interval, 10, 100);
+        rewind.keyframeInterval = static_cast<unsigned int>(interval < 1 ? 1 : interval);
+        int quantise = static_cast<int>(rewind.quantiseBits);
+        ImGui::InputInt("Dropped delta bits", &quantise, 1, 4);
+        rewind.quantiseBits = static_cast<unsigned int>(quantise < 0 ? 0 : quantise > 20 ? 20 : quantise);
+    }
+    if (ImGui::Button(keepingHistory ? "Stop history" : "Keep history")) {
+        needsRewindToggle = true;
+    }
+    const rewindStats &s = rewindState;
+    if (!keepingHistory || s.keyframes == 0) return;
+    ImGui::Text("Steps %llu - %llu, %.1f s, %zu keyframes", s.firstStep, s.lastStep, s.lastTime - s.firstTime,
+                s.keyframes);
+    ImGui::Text("%.1f of %.0f MB, deltas %.2fx", static_cast<double>(s.bytes) * 1e-6,
+                static_cast<double>(rewind.budgetBytes) * 1e-6,
+                s.deltaBytes ? static_cast<double>(s.rawDeltaBytes) / static_cast<double>(s.deltaBytes) : 0.0);
+    const auto span = static_cast<int>(s.lastStep - s.firstStep);
+    int offset = scrubbing ? static_cast<int>(std::clamp(scrubStep, s.firstStep, s.lastStep) - s.firstStep) : span;
+    if (ImGui::SliderInt("Step##rewind", &offset, 0, span)) {
+        scrubStep = s.firstStep + static_cast<unsigned long long>(offset);
+        needsPreview = true;
+    }
+    if (scrubbing) {
+        if (ImGui::Button("Resume from here")) {
+            needsSeek = true;
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Back to live")) {
+            needsEndPreview = true;
+        }
+    }
 }
@@ -5,8 +5,67 @@
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 #include <GLFW/glfw3.h>
+#include <string>
+#include <vector>
+#include "bodyStore.h"
+#include "checkpoint.h"
+#include "profiler.h"
+#include "rewindBuffer.h"
+#include "timestepController.h"
+#include "trajectory.h"
 
-class menuGUI {
+// Values edited in the panel. Plain data, so the render thread can hand a copy to the
+// simulation thread and have it applied to CONFIG there between steps.
+struct menuSettings {
+    int targetBodyCount = 1;
+    int targetSeed = 0;
+    bool targetCompactInstances = false;
+    float targetGravitationalConstant = 1000.0f;
+    float targetTimeScale = 1.0f;
+    int targetIntegrator = 1;
+    bool targetBlockTimesteps = false;
+    int targetMaxTimestepLevel = 6;
+    float targetTimestepAccuracy = 0.02f;
+    int targetSolver = 0;
+    float targetOpeningAngle = 0.5f;
+    int targetMultipoleOrder = 4;
+    int targetPrecision = 0;
+    bool targetFloatingOrigin = false;
+    int targetForceLaw = 0;
+    float targetSofteningLength = 5.0f;
+    float targetCutoffRadius = 1000.0f;
+    int targetCollisions = 1;
+    bool targetValidateForces = false;
+    int targetThreadCount = 0;
+    bool targetTaskGraphStep = true;
+    float targetFixedTimeStep = 1.0f / 120.0f;
+    bool targetAdaptiveTimestep = false;
+    float targetEnergyTolerance = 1e-5f;
+    int targetDiagnosticInterval = 10;
+    float targetCentralBodyMass = 10000.0f;
+    float targetCentralBodyRadius = 100.0f;
+    float targetMinOrbitRadius = 170.0f;
+    float targetMaxOrbitRadius = 400.0f;
+    float targetMinBodyMass = 1.0f;
+    float targetMaxBodyMass = 10.0f;
+    float targetMinBodyRadius = 15.0f;
+    float targetMaxBodyRadius = 30.0f;
+
+    void apply() const;
+
+    // true if the seed or a distribution of the generated bodies differs from `applied`, which
+    // only a new system can show
+    [[nodiscard]] bool changesGeneration(const menuSettings &applied) const;
+
+    // apply() plus the changes since `applied` made to the running system: the central body
+    // takes its new mass and radius, and a new body count adds or removes only the difference
+    void applyLive(BodyStore &bodies, const menuSettings &applied) const;
+
+    // takes the physics and generation settings of a restored checkpoint
+    void load(const checkpointState &state);
+};
+
+class menuGUI : public menuSettings {
 public:
     menuGUI(GLFWwindow *window);
 
@@ -16,26 +75,48 @@ public:
 
     static void newFrame();
 
-    void update() const;
+    [[nodiscard]] menuSettings settings() const { return *this; }
 
     void reset();
 
-    int targetBodyCount = 1;
-    float targetGravitationalConstant = 1000.0f;
-    float targetTimeScale = 1.0f;
-    float targetCentralBodyMass = 10000.0f;
-    float targetCentralBodyRadius = 100.0f;
-    float targetMinOrbitRadius = 170.0f;
-    float targetMaxOrbitRadius = 400.0f;
-    float targetMinBodyMass = 1.0f;
-    float targetMaxBodyMass = 10.0f;
-    float targetMinBodyRadius = 15.0f;
-    float targetMaxBodyRadius = 30.0f;
+    double simulationStepRate = 0.0;
+    timestepStats timestepState;
+    size_t liveBodies = 0;
+    size_t visibleBodies = 0;
+    size_t drawnTriangles = 0;
     bool needsUpdate = false;
+    bool needsRegenerate = false;
     bool needsReset = false;
+    bool needsSave = false;
+    bool needsLoad = false;
+    char checkpointPath[256] = "n_body.checkpoint";
+    std::string checkpointStatus;
+    bool needsRecordingToggle = false;
+    bool recording = false;
+    char trajectoryPath[256] = "n_body.trajectory";
+    trajectoryOptions trajectory;
+    trajectoryStats recordingStats;
+    bool needsRewindToggle = false;
+    bool keepingHistory = false;
+    rewindOptions rewind;
+    rewindStats rewindState;
+    bool scrubbing = false;
+    unsigned long long scrubStep = 0;
+    bool needsPreview = false;
+    bool needsEndPreview = false;
+    bool needsSeek = false;
 
 private:
     GLFWwindow *window{};
+    bool profiling = false;
+    std::vector<profiler::phaseHistory> phaseHistories;
+    std::string traceStatus;
+
+    void renderProfiler();
+
+    void renderTrajectory();
+
+    void renderRewind();
 };
 
 
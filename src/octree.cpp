@@ -0,0 +1,223 @@
+#include "octree.h"
+#include <algorithm>
+#include <cmath>
+#include "forceKernel.h"
+
+void octree::build(const BodyStore &bodies, unsigned int leafCapacity) {
+    this->leafCapacity = leafCapacity > 0 ? leafCapacity : 1;
+    nodes.clear();
+    indices.resize(bodies.size());
+    scratch.resize(bodies.size());
+    leafOf.resize(bodies.size());
+    for (size_t i = 0; i < bodies.size(); i++) {
+        indices[i] = static_cast<unsigned int>(i);
+    }
+    if (bodies.empty()) return;
+
+    // Bounding cube of every body
+    glm::vec3 minCorner = bodies.position(0);
+    glm::vec3 maxCorner = bodies.position(0);
+    for (size_t i = 1; i < bodies.size(); i++) {
+        minCorner = glm::min(minCorner, bodies.position(i));
+        maxCorner = glm::max(maxCorner, bodies.position(i));
+    }
+    glm::vec3 extent = maxCorner - minCorner;
+    float halfSize = 0.5f * std::max(extent.x, std::max(extent.y, extent.z));
+    // pad slightly so bodies on the max faces still fall inside the cube
+    halfSize = halfSize * 1.001f + 1e-3f;
+
+    node root{};
+    root.centre = 0.5f * (minCorner + maxCorner);
+    root.halfSize = halfSize;
+    root.begin = 0;
+    root.end = static_cast<unsigned int>(bodies.size());
+    nodes.reserve(2 * bodies.size() / leafCapacity + 1);
+    nodes.push_back(root);
+    subdivide(bodies, 0, 0);
+
+    sortedX.resize(bodies.size());
+    sortedY.resize(bodies.size());
+    sortedZ.resize(bodies.size());
+    sortedMass.resize(bodies.size());
+    for (size_t k = 0; k < bodies.size(); k++) {
+        const unsigned int j = indices[k];
+        sortedX[k] = bodies.x[j];
+        sortedY[k] = bodies.y[j];
+        sortedZ[k] = bodies.z[j];
+        sortedMass[k] = bodies.mass[j];
+    }
+}
+
+void octree::subdivide(const BodyStore &bodies, unsigned int nodeIndex, unsigned int depth) {
+    const unsigned int begin = nodes[nodeIndex].begin;
+    const unsigned int end = nodes[nodeIndex].end;
+    const glm::vec3 centre = nodes[nodeIndex].centre;
+    const float halfSize = nodes[nodeIndex].halfSize;
+
+    if (end - begin <= leafCapacity || depth >= maxDepth) {
+        float mass = 0.0f;
+        glm::vec3 weighted(0.0f);
+        for (unsigned int k = begin; k < end; k++) {
+            const unsigned int j = indices[k];
+            mass += bodies.mass[j];
+            weighted += bodies.position(j) * bodies.mass[j];
+            leafOf[j] = nodeIndex;
+        }
+        nodes[nodeIndex].mass = mass;
+        nodes[nodeIndex].centreOfMass = mass > 0.0f ? weighted / mass : centre;
+        nodes[nodeIndex].firstChild = 0;
+        return;
+    }
+
+    // Counting sort of the body range by octant
+    unsigned int counts[8] = {};
+    for (unsigned int k = begin; k < end; k++) {
+        const unsigned int j = indices[k];
+        unsigned int octant = (bodies.x[j] >= centre.x) |
+                              ((bodies.y[j] >= centre.y) << 1) |
+                              ((bodies.z[j] >= centre.z) << 2);
+        counts[octant]++;
+    }
+    unsigned int offsets[8];
+    unsigned int running = begin;
+    for (int o = 0; o < 8; o++) {
+        offsets[o] = running;
+        running += counts[o];
+    }
+    unsigned int cursor[8];
+    std::copy(offsets, offsets + 8, cursor);
+    for (unsigned int k = begin; k < end; k++) {
+        const unsigned int j = indices[k];
+        unsigned int octant = (bodies.x[j] >= centre.x) |
+                              ((bodies.y[j] >= centre.y) << 1) |
+                              ((bodies.z[j] >= centre.z) << 2);
+        scratch[cursor[octant]++] = indices[k];
+    }
+    std::copy(scratch.begin() + begin, scratch.begin() + end, indices.begin() + begin);
+
+    const auto firstChild = static_cast<unsigned int>(nodes.size());
+    nodes[nodeIndex].firstChild = firstChild;
+    const float childHalf = 0.5f * halfSize;
+    for (unsigned int o = 0; o < 8; o++) {
+        node child{};
+        child.centre = centre + glm::vec3(o & 1 ? childHalf : -childHalf,
+                                          o & 2 ? childHalf : -childHalf,
+                                          o & 4 ? childHalf : -childHalf);
+        child.halfSize = childHalf;
+        child.begin = offsets[o];
+        child.end = offsets[o] + counts[o];
+        nodes.push_back(child);
+    }
+
+    float mass = 0.0f;
+    glm::vec3 weighted(0.0f);
+    for (unsigned int o = 0; o < 8; o++) {
+        if (counts[o] > 0) {
+            subdivide(bodies, firstChild + o, depth + 1);
+        }
+        mass += nodes[firstChild + o].mass;
+        weighted += nodes[firstChild + o].centreOfMass * nodes[firstChild + o].mass;
+    }
+    nodes[nodeIndex].mass = mass;
+    nodes[nodeIndex].centreOfMass = mass > 0.0f ? weighted / mass : centre;
+}
+
+void octree::gatherInteractions(unsigned int leaf, float theta, interactionList &list) const {
+    list.x.clear();
+    list.y.clear();
+    list.z.clear();
+    list.mass.clear();
+    const node &target = nodes[leaf];
+    glm::vec3 low(sortedX[target.begin], sortedY[target.begin], sortedZ[target.begin]);
+    glm::vec3 high = low;
+    for (unsigned int k = target.begin + 1; k < target.end; k++) {
+        const glm::vec3 position(sortedX[k], sortedY[k], sortedZ[k]);
+        low = glm::min(low, position);
+        high = glm::max(high, position);
+    }
+    const float thetaSquared = theta * theta;
+
+    unsigned int stack[8 * maxDepth + 8];
+    unsigned int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const node &n = nodes[stack[--top]];
+        if (n.firstChild == 0) {
+            // the leaf's own bodies sit at zero distance from themselves and contribute nothing
+            list.x.insert(list.x.end(), sortedX.begin() + n.begin, sortedX.begin() + n.end);
+            list.y.insert(list.y.end(), sortedY.begin() + n.begin, sortedY.begin() + n.end);
+            list.z.insert(list.z.end(), sortedZ.begin() + n.begin, sortedZ.begin() + n.end);
+            list.mass.insert(list.mass.end(), sortedMass.begin() + n.begin, sortedMass.begin() + n.end);
+            continue;
+        }
+
+        // distance from the centre of mass to the nearest point of the box, so the cell is
+        // accepted only if it would be for every body of the leaf. Ancestors are always opened.
+        const bool ancestor = n.begin <= target.begin && target.end <= n.end;
+        const glm::vec3 gap = glm::max(glm::max(low - n.centreOfMass, n.centreOfMass - high), glm::vec3(0.0f));
+        const float size = 2.0f * n.halfSize;
+        if (!ancestor && size * size < thetaSquared * glm::dot(gap, gap)) {
+            list.x.push_back(n.centreOfMass.x);
+            list.y.push_back(n.centreOfMass.y);
+            list.z.push_back(n.centreOfMass.z);
+            list.mass.push_back(n.mass);
+        } else {
+            for (unsigned int o = 0; o < 8; o++) {
+                if (nodes[n.firstChild + o].mass > 0.0f) stack[top++] = n.firstChild + o;
+            }
+        }
+    }
+}
+
+template<class Law>
+glm::vec3 octree::calculateForce(const BodyStore &bodies, size_t i, float theta, float G,
+                                 const forceLawParameters &law) const {
+    static const accelerationRowFunction row =
+        forceKernel::select(forceKernel::detect(), scalarPrecision::single, Law::type);
+    if (nodes.empty()) return glm::vec3(0.0f);
+
+    static thread_local interactionList list;
+    gatherInteractions(leafOf[i], theta, list);
+    float acceleration[3] = {};
+    row(list.x.data(), list.y.data(), list.z.data(), list.mass.data(), list.x.size(),
+        bodies.x[i], bodies.y[i], bodies.z[i], law, acceleration);
+    return glm::vec3(acceleration[0], acceleration[1], acceleration[2]) * (G * bodies.mass[i]);
+}
+
+template<class Law>
+void octree::calculateForces(const BodyStore &bodies, size_t begin, size_t end, float theta, float G,
+                             const forceLawParameters &law, ForceBuffer &forces) const {
+    static const accelerationRowFunction row =
+        forceKernel::select(forceKernel::detect(), scalarPrecision::single, Law::type);
+    static thread_local interactionList list;
+    size_t k = begin;
+    while (k < end) {
+        const unsigned int leaf = leafOf[indices[k]];
+        gatherInteractions(leaf, theta, list);
+        const size_t last = std::min<size_t>(nodes[leaf].end, end);
+        for (; k < last; k++) {
+            const unsigned int i = indices[k];
+            float acceleration[3] = {};
+            row(list.x.data(), list.y.data(), list.z.data(), list.mass.data(), list.x.size(),
+                bodies.x[i], bodies.y[i], bodies.z[i], law, acceleration);
+            const glm::vec3 force = glm::vec3(acceleration[0], acceleration[1], acceleration[2]) *
+                                    (G * bodies.mass[i]);
+            forces.x[i] = force.x;
+            forces.y[i] = force.y;
+            forces.z[i] = force.z;
+        }
+    }
+}
+
+template glm::vec3 octree::calculateForce<newtonianLaw>(const BodyStore &, size_t, float, float,
+                                                        const forceLawParameters &) const;
+template glm::vec3 octree::calculateForce<plummerLaw>(const BodyStore &, size_t, float, float,
+                                                      const forceLawParameters &) const;
+template glm::vec3 octree::calculateForce<cutoffLaw>(const BodyStore &, size_t, float, float,
+                                                     const forceLawParameters &) const;
+template void octree::calculateForces<newtonianLaw>(const BodyStore &, size_t, size_t, float, float,
+                                                    const forceLawParameters &, ForceBuffer &) const;
+template void octree::calculateForces<plummerLaw>(const BodyStore &, size_t, size_t, float, float,
+                                                  const forceLawParameters &, ForceBuffer &) const;
+template void octree::calculateForces<cutoffLaw>(const BodyStore &, size_t, size_t, float, float,
+                                                 const forceLawParameters &, ForceBuffer &) const;
@@ -0,0 +1,64 @@
+#ifndef N_BODY_SIMULATION_GL_OCTREE_H
+#define N_BODY_SIMULATION_GL_OCTREE_H
+#include <vector>
+#include "glm/vec3.hpp"
+#include "bodyStore.h"
+#include "physicsPolicies.h"
+
+// Barnes-Hut octree. Nodes live in one flat array, the 8 children of a node are stored
+// contiguously and every node owns a contiguous range of the sorted body index list. The
+// positions and masses are copied into that order too, so a leaf is a slice the forceKernel
+// rows can stream. The walk is done once per leaf, with cells accepted against the bounding
+// box of its bodies, and the resulting interaction list is shared by all of them.
+class octree {
+public:
+    struct node {
+        glm::vec3 centre;
+        float halfSize;
+        glm::vec3 centreOfMass;
+        float mass;
+        unsigned int firstChild; // 0 = leaf (the root can never be a child)
+        unsigned int begin;
+        unsigned int end;
+    };
+
+    static constexpr unsigned int defaultLeafCapacity = 8;
+    static constexpr unsigned int maxDepth = 32;
+
+    void build(const BodyStore &bodies, unsigned int leafCapacity = defaultLeafCapacity);
+
+    // force on bodies[i], cells with size / distance < theta are treated as point masses.
+    // Instantiated for every law in physicsPolicies.h.
+    template<class Law = newtonianLaw>
+    [[nodiscard]] glm::vec3 calculateForce(const BodyStore &bodies, size_t i, float theta, float G,
+                                           const forceLawParameters &law = {}) const;
+
+    // forces on the bodies at positions [begin, end) of getIndices(), stored at their body
+    // index. Matches calculateForce bit for bit, but walks the tree once per leaf.
+    template<class Law = newtonianLaw>
+    void calculateForces(const BodyStore &bodies, size_t begin, size_t end, float theta, float G,
+                         const forceLawParameters &law, ForceBuffer &forces) const;
+
+    [[nodiscard]] const std::vector<node> &getNodes() const { return nodes; }
+    [[nodiscard]] const std::vector<unsigned int> &getIndices() const { return indices; }
+
+private:
+    std::vector<node> nodes;
+    std::vector<unsigned int> indices;
+    std::vector<unsigned int> scratch;
+    std::vector<float> sortedX, sortedY, sortedZ, sortedMass; // bodies in tree order
+    std::vector<unsigned int> leafOf; // leaf node of every body
+    unsigned int leafCapacity = defaultLeafCapacity;
+
+    struct interactionList {
+        std::vector<float> x, y, z, mass;
+    };
+
+    void subdivide(const BodyStore &bodies, unsigned int nodeIndex, unsigned int depth);
+
+    // point masses acting on the bodies of a leaf, including the leaf's own bodies
+    void gatherInteractions(unsigned int leaf, float theta, interactionList &list) const;
+};
+
+
+#endif //N_BODY_SIMULATION_GL_OCTREE_H
@@ -0,0 +1,83 @@
+#ifndef N_BODY_SIMULATION_GL_PHILOX_H
+#define N_BODY_SIMULATION_GL_PHILOX_H
+#include <cstddef>
+#include <cstdint>
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random numbers: as easy as
+// 1, 2, 3"). Each 128-bit counter maps to four independent 32-bit outputs under a 64-bit key,
+// so any body's random numbers come straight from its index with no shared generator state.
+class philox {
+public:
+    struct block {
+        std::uint32_t v[4];
+    };
+
+    explicit philox(std::uint64_t key)
+        : key0(static_cast<std::uint32_t>(key)), key1(static_cast<std::uint32_t>(key >> 32)) {
+    }
+
+    [[nodiscard]] block operator()(std::uint64_t counterLow, std::uint32_t counterHigh) const {
+        std::uint32_t c0 = static_cast<std::uint32_t>(counterLow);
+        std::uint32_t c1 = static_cast<std::uint32_t>(counterLow >> 32);
+        std::uint32_t c2 = counterHigh;
+        std::uint32_t c3 = 0;
+        std::uint32_t k0 = key0, k1 = key1;
+        for (int round = 0; round < 10; round++) {
+            const std::uint64_t p0 = static_cast<std::uint64_t>(multiplier0) * c0;
+            const std::uint64_t p1 = static_cast<std::uint64_t>(multiplier1) * c2;
+            const auto hi0 = static_cast<std::uint32_t>(p0 >> 32), lo0 = static_cast<std::uint32_t>(p0);
+            const auto hi1 = static_cast<std::uint32_t>(p1 >> 32), lo1 = static_cast<std::uint32_t>(p1);
+            c0 = hi1 ^ c1 ^ k0;
+            c1 = lo1;
+            c2 = hi0 ^ c3 ^ k1;
+            c3 = lo0;
+            k0 += weyl0;
+            k1 += weyl1;
+        }
+        return {{c0, c1, c2, c3}};
+    }
+
+    // The same mapping for the batch of counters (first + lane, high), one output word per
+    // array. The round loop runs across a fixed number of lanes so it vectorises.
+    static constexpr size_t batch = 64;
+
+    void fill(std::uint64_t first, std::uint32_t counterHigh, std::uint32_t (&out)[4][batch]) const {
+        std::uint32_t c0[batch], c1[batch], c2[batch], c3[batch];
+        for (size_t lane = 0; lane < batch; lane++) {
+            c0[lane] = static_cast<std::uint32_t>(first + lane);
+            c1[lane] = static_cast<std::uint32_t>((first + lane) >> 32);
+            c2[lane] = counterHigh;
+            c3[lane] = 0;
+        }
+        std::uint32_t k0 = key0, k1 = key1;
+        for (int round = 0; round < 10; round++) {
+            for (size_t lane = 0; lane < batch; lane++) {
+                const std::uint64_t p0 = static_cast<std::uint64_t>(multiplier0) * c0[lane];
+                const std::uint64_t p1 = static_cast<std::uint64_t>(multiplier1) * c2[lane];
+                c0[lane] = static_cast<std::uint32_t>(p1 >> 32) ^ c1[lane] ^ k0;
+                c1[lane] = static_cast<std::uint32_t>(p1);
+                c2[lane] = static_cast<std::uint32_t>(p0 >> 32) ^ c3[lane] ^ k1;
+                c3[lane] = static_cast<std::uint32_t>(p0);
+            }
+            k0 += weyl0;
+            k1 += weyl1;
+        }
+        for (size_t lane = 0; lane < batch; lane++) {
+            out[0][lane] = c0[lane];
+            out[1][lane] = c1[lane];
+            out[2][lane] = c2[lane];
+            out[3][lane] = c3[lane];
+        }
+    }
+
+private:
+    static constexpr std::uint32_t multiplier0 = 0xD2511F53u;
+    static constexpr std::uint32_t multiplier1 = 0xCD9E8D57u;
+    static constexpr std::uint32_t weyl0 = 0x9E3779B9u;
+    static constexpr std::uint32_t weyl1 = 0xBB67AE85u;
+
+    std::uint32_t key0, key1;
+};
+
+
+#endif //N_BODY_SIMULATION_GL_PHILOX_H
@@ -1,38 +1,913 @@
 #include "physicsEngine.h"
 #include "config.h"
+#include "threadPool.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <type_traits>
+#include "glm/geometric.hpp"
 
-void physicsEngine::update(std::vector<body> &bodies, double deltaTime) {
+octree physicsEngine::tree;
+fmm physicsEngine::multipoleSolver;
+ForceBuffer physicsEngine::forces;
+ForceBuffer physicsEngine::solverAccelerations;
+std::atomic<float> physicsEngine::validationRmsError{0.0f};
+std::atomic<float> physicsEngine::validationMaxError{0.0f};
+std::atomic<size_t> physicsEngine::validationSamples{0};
+std::vector<ForceBuffer> physicsEngine::threadForces;
+spatialHash physicsEngine::collisionGrid;
+std::vector<unsigned int> physicsEngine::collisionCandidates;
+std::vector<unsigned char> physicsEngine::absorbed;
+std::vector<unsigned int> physicsEngine::removed;
+taskGraph physicsEngine::stepGraph;
+std::vector<std::vector<unsigned int>> physicsEngine::tilePairs;
+std::vector<std::vector<unsigned int>> physicsEngine::threadCandidates;
+std::vector<unsigned int> physicsEngine::activeBodies;
+std::vector<float> physicsEngine::previousAccelerations;
+
+// rows handed to a worker at a time; rows near the top of the symmetric loop are the longest
+static constexpr size_t rowGrain = 32;
+static constexpr size_t bodyGrain = 4096;
+// tree order positions per worker; a leaf split between two chunks is walked by both
+static constexpr size_t treeGrain = 256;
+// force and broad phase rows per task of the scheduled step
+static constexpr size_t tileRows = 256;
+
+void physicsEngine::update(BodyStore &bodies, double deltaTime) {
     if (bodies.empty()) return;
+    PROFILE_SCOPE("physics step");
     deltaTime *= CONFIG.timeScale;
-    std::vector<glm::vec3> forces(bodies.size(), glm::vec3(0.0f));
-    calculateForces(bodies, forces);
-    applyForces(bodies, forces, deltaTime);
-    collisionCheck(bodies);
+    threadPool::getInstance().resize(CONFIG.numThreads);
+    updateOrigin(bodies);
+
+    selectStep()(bodies, deltaTime);
+
+    if (CONFIG.validateForces) {
+        PROFILE_SCOPE("validation");
+        const forceValidation validation = validateForces(bodies, CONFIG.validationSamples);
+        validationRmsError.store(validation.rmsError, std::memory_order_relaxed);
+        validationMaxError.store(validation.maxError, std::memory_order_relaxed);
+        validationSamples.store(validation.samples, std::memory_order_relaxed);
+    }
 }
 
-void physicsEngine::calculateForces(std::vector<body> &bodies, std::vector<glm::vec3> &forces) {
-    for (size_t i = 0; i < bodies.size(); i++) {
-        for (size_t j = i + 1; j < bodies.size(); j++) {
-            const glm::vec3 force = bodies[i].calculateGravitationalForce(bodies[j]);
-            forces[i] += force;
-            forces[j] -= force;
+physicsEngine::stepFunction physicsEngine::selectStep() {
+    if (CONFIG.blockTimesteps) return selectStep<blockTimestepIntegrator>(CONFIG.collisions);
+    switch (CONFIG.integrator) {
+        case integratorType::semiImplicitEuler:
+            return selectStep<semiImplicitEulerIntegrator>(CONFIG.collisions);
+        case integratorType::velocityVerlet:
+            return selectStep<velocityVerletIntegrator>(CONFIG.collisions);
+        case integratorType::yoshida4:
+            return selectStep<yoshida4Integrator>(CONFIG.collisions);
+        default:
+            return selectStep<leapfrogIntegrator>(CONFIG.collisions);
+    }
+}
+
+template<class Integrator>
+physicsEngine::stepFunction physicsEngine::selectStep(collisionMode collisions) {
+    switch (collisions) {
+        case collisionMode::none:
+            return step<Integrator, noCollisions>;
+        case collisionMode::merge:
+            return step<Integrator, mergeCollisions>;
+        default:
+            return step<Integrator, elasticCollisions>;
+    }
+}
+
+template<class Integrator, class Collisions>
+void physicsEngine::step(BodyStore &bodies, double deltaTime) {
+    const auto dt = static_cast<float>(deltaTime);
+    if constexpr (std::is_same_v<Integrator, blockTimestepIntegrator>) {
+        blockStep(bodies, dt);
+    } else if constexpr (Integrator::type == integratorType::semiImplicitEuler) {
+        forces.reset(bodies.size());
+        calculateForces(bodies, forces);
+        applyForces(bodies, forces, dt);
+        bodies.accelerationsValid = false;
+    } else if constexpr (Integrator::type == integratorType::leapfrog) {
+        if (scheduledStepApplies(Collisions::mode)) {
+            scheduledKickDriftKick(bodies, dt, Collisions::mode == collisionMode::elastic);
+            // the graph has resolved the elastic contacts already
+            if constexpr (Collisions::mode == collisionMode::elastic) return;
+        } else {
+            kickDriftKick(bodies, dt);
         }
+    } else if constexpr (Integrator::type == integratorType::velocityVerlet) {
+        velocityVerlet(bodies, dt);
+    } else {
+        static_assert(Integrator::type == integratorType::yoshida4, "unhandled integrator policy");
+        // Yoshida's 4th order composition of three leapfrog steps
+        const double cubeRootTwo = std::cbrt(2.0);
+        const double w1 = 1.0 / (2.0 - cubeRootTwo);
+        const double w0 = -cubeRootTwo / (2.0 - cubeRootTwo);
+        kickDriftKick(bodies, static_cast<float>(w1 * deltaTime));
+        kickDriftKick(bodies, static_cast<float>(w0 * deltaTime));
+        kickDriftKick(bodies, static_cast<float>(w1 * deltaTime));
+    }
+
+    if constexpr (Collisions::mode == collisionMode::elastic) {
+        // collisions move bodies, so the cached accelerations no longer match the positions
+        if (collisionCheck(bodies) > 0) bodies.accelerationsValid = false;
+    } else if constexpr (Collisions::mode == collisionMode::merge) {
+        mergeCheck(bodies);
     }
 }
 
-void physicsEngine::applyForces(std::vector<body> &bodies, std::vector<glm::vec3> &forces, float deltaTime) {
+// Keeps the stored positions small: once the centre of mass drifts further than
+// CONFIG.originTolerance from the origin, the origin moves onto it in whole units. Forces,
+// collisions and the tree only see differences, so they are unaffected by the shift.
+void physicsEngine::updateOrigin(BodyStore &bodies) {
+    if (!CONFIG.floatingOrigin) {
+        if (bodies.origin != glm::dvec3(0.0)) bodies.shiftOrigin(-bodies.origin);
+        return;
+    }
+    glm::dvec3 weighted(0.0);
+    double totalMass = 0.0;
     for (size_t i = 0; i < bodies.size(); i++) {
-        glm::vec3 acceleration = forces[i] / bodies[i].mass;
-        bodies[i].velocity += acceleration * deltaTime;
-        bodies[i].position += bodies[i].velocity * deltaTime;
+        const double m = bodies.mass[i];
+        weighted += glm::dvec3(bodies.x[i], bodies.y[i], bodies.z[i]) * m;
+        totalMass += m;
     }
+    if (!(totalMass > 0.0)) return;
+    const glm::dvec3 centre = weighted / totalMass;
+    const double tolerance = CONFIG.originTolerance;
+    if (glm::dot(centre, centre) <= tolerance * tolerance) return;
+    bodies.shiftOrigin(glm::dvec3(std::round(centre.x), std::round(centre.y), std::round(centre.z)));
 }
 
-void physicsEngine::collisionCheck(std::vector<body> &bodies) {
+forceValidation physicsEngine::validateForces(const BodyStore &bodies, size_t samples) {
+    forceValidation result;
+    const size_t n = bodies.size();
+    if (n < 2 || samples == 0) return result;
+    samples = std::min(samples, n);
+
+    ForceBuffer solverForces;
+    solverForces.reset(n);
+    calculateForces(bodies, solverForces);
+
+    // the same law summed in double, so the reference does not share the float solver's
+    // accumulation error
+    const accelerationRowFunction referenceRow =
+        forceKernel::select(simdLevel::scalar, scalarPrecision::doublePrecision, activeLaw());
+    const forceLawParameters law = forceLawParameters::fromConfig();
+    const double G = CONFIG.gravitationalConstant;
+    double squaredSum = 0.0;
+    for (size_t s = 0; s < samples; s++) {
+        const size_t i = s * n / samples;
+        float acceleration[3] = {};
+        referenceRow(bodies.x.data(), bodies.y.data(), bodies.z.data(), bodies.mass.data(), n,
+                     bodies.x[i], bodies.y[i], bodies.z[i], law, acceleration);
+        const glm::dvec3 reference = glm::dvec3(acceleration[0], acceleration[1], acceleration[2]) *
+                                     (G * bodies.mass[i]);
+        const double referenceLength = glm::length(reference);
+        if (!(referenceLength > 0.0)) continue;
+        const glm::dvec3 solver(solverForces.x[i], solverForces.y[i], solverForces.z[i]);
+        const auto error = static_cast<float>(glm::length(solver - reference) / referenceLength);
+        squaredSum += static_cast<double>(error) * error;
+        result.maxError = std::max(result.maxError, error);
+        result.samples++;
+    }
+    if (result.samples > 0) {
+        result.rmsError = static_cast<float>(std::sqrt(squaredSum / static_cast<double>(result.samples)));
+    }
+    return result;
+}
+
+template<class Law>
+static double pairPotential(const BodyStore &bodies) {
+    struct alignas(64) partialSum {
+        double value = 0.0;
+    };
+    threadPool &pool = threadPool::getInstance();
+    std::vector<partialSum> partial(pool.size());
+    const forceLawParameters law = forceLawParameters::fromConfig();
+    const size_t n = bodies.size();
+    pool.parallelFor(n, rowGrain, [&](size_t begin, size_t end, unsigned int thread) {
+        double sum = 0.0;
+        for (size_t i = begin; i < end; i++) {
+            const double xi = bodies.x[i], yi = bodies.y[i], zi = bodies.z[i];
+            double row = 0.0;
+            for (size_t j = i + 1; j < n; j++) {
+                const double dx = bodies.x[j] - xi;
+                const double dy = bodies.y[j] - yi;
+                const double dz = bodies.z[j] - zi;
+                row += bodies.mass[j] * inverseDistance<Law>(dx * dx + dy * dy + dz * dz, law);
+            }
+            sum += bodies.mass[i] * row;
+        }
+        partial[thread].value += sum;
+    });
+    double total = 0.0;
+    for (const partialSum &p: partial) total += p.value;
+    return -static_cast<double>(CONFIG.gravitationalConstant) * total;
+}
+
+conservationSample physicsEngine::conservation(const BodyStore &bodies) {
+    PROFILE_SCOPE("diagnostics");
+    conservationSample sample;
+    sample.bodies = bodies.size();
     for (size_t i = 0; i < bodies.size(); i++) {
-        for (size_t j = i + 1; j < bodies.size(); j++) {
-            bodies[i].collisionCheck(bodies[j]);
+        const double m = bodies.mass[i];
+        const glm::dvec3 v(bodies.vx[i], bodies.vy[i], bodies.vz[i]);
+        const double speedSquared = glm::dot(v, v);
+        sample.kinetic += 0.5 * m * speedSquared;
+        sample.momentum += m * v;
+        sample.momentumScale += m * std::sqrt(speedSquared);
+    }
+    switch (activeLaw()) {
+        case forceLaw::plummer:
+            sample.potential = pairPotential<plummerLaw>(bodies);
+            break;
+        case forceLaw::cutoff:
+            sample.potential = pairPotential<cutoffLaw>(bodies);
+            break;
+        default:
+            sample.potential = pairPotential<newtonianLaw>(bodies);
+            break;
+    }
+    return sample;
+}
+
+forceValidation physicsEngine::lastValidation() {
+    forceValidation result;
+    result.rmsError = validationRmsError.load(std::memory_order_relaxed);
+    result.maxError = validationMaxError.load(std::memory_order_relaxed);
+    result.samples = validationSamples.load(std::memory_order_relaxed);
+    return result;
+}
+
+void physicsEngine::calculateForces(const BodyStore &bodies, ForceBuffer &forces) {
+    PROFILE_SCOPE("forces");
+    if (CONFIG.solver == forceSolver::barnesHut) {
+        calculateForcesBarnesHut(bodies, forces);
+        return;
+    }
+    if (CONFIG.solver == forceSolver::fastMultipole) {
+        calculateForcesFastMultipole(bodies, forces);
+        return;
+    }
+    // chosen once from CPUID, the scalar fallback keeps the cheaper symmetric N^2/2 loop
+    static const simdLevel level = forceKernel::detect();
+    if (level != simdLevel::scalar || CONFIG.precision != scalarPrecision::single) {
+        calculateForcesVectorised(bodies, forces, forceKernel::select(level, CONFIG.precision, CONFIG.law));
+        return;
+    }
+    switch (CONFIG.law) {
+        case forceLaw::plummer:
+            calculateForcesSymmetric<plummerLaw>(bodies, forces);
+            break;
+        case forceLaw::cutoff:
+            calculateForcesSymmetric<cutoffLaw>(bodies, forces);
+            break;
+        default:
+            calculateForcesSymmetric<newtonianLaw>(bodies, forces);
+            break;
+    }
+}
+
+forceLaw physicsEngine::activeLaw() {
+    return CONFIG.solver == forceSolver::fastMultipole ? forceLaw::newtonian : CONFIG.law;
+}
+
+// octree::calculateForce specialised on the law
+using treeForceFunction = glm::vec3 (octree::*)(const BodyStore &, size_t, float, float,
+                                                const forceLawParameters &) const;
+
+static treeForceFunction selectTreeForce(forceLaw law) {
+    switch (law) {
+        case forceLaw::plummer:
+            return &octree::calculateForce<plummerLaw>;
+        case forceLaw::cutoff:
+            return &octree::calculateForce<cutoffLaw>;
+        default:
+            return &octree::calculateForce<newtonianLaw>;
+    }
+}
+
+// octree::calculateForces specialised on the law
+using treeForcesFunction = void (octree::*)(const BodyStore &, size_t, size_t, float, float,
+                                            const forceLawParameters &, ForceBuffer &) const;
+
+static treeForcesFunction selectTreeForces(forceLaw law) {
+    switch (law) {
+        case forceLaw::plummer:
+            return &octree::calculateForces<plummerLaw>;
+        case forceLaw::cutoff:
+            return &octree::calculateForces<cutoffLaw>;
+        default:
+            return &octree::calculateForces<newtonianLaw>;
+    }
+}
+
+// Newton's third law halves the work but makes every row write to all later bodies, so each
+// thread accumulates into its own buffer and the buffers are reduced afterwards.
+template<class Law>
+void physicsEngine::calculateForcesSymmetric(const BodyStore &bodies, ForceBuffer &forces) {
+    threadPool &pool = threadPool::getInstance();
+    const float G = CONFIG.gravitationalConstant;
+    const forceLawParameters law = forceLawParameters::fromConfig();
+    const size_t n = bodies.size();
+    threadForces.resize(pool.size());
+    for (auto &buffer: threadForces) {
+        buffer.reset(n);
+    }
+    const float *x = bodies.x.data();
+    const float *y = bodies.y.data();
+    const float *z = bodies.z.data();
+    const float *m = bodies.mass.data();
+
+    pool.parallelFor(n, rowGrain, [&](size_t begin, size_t end, unsigned int thread) {
+        float *fx = threadForces[thread].x.data();
+        float *fy = threadForces[thread].y.data();
+        float *fz = threadForces[thread].z.data();
+        for (size_t i = begin; i < end; i++) {
+            const float xi = x[i], yi = y[i], zi = z[i];
+            const float Gmi = G * m[i];
+            float fxi = 0.0f, fyi = 0.0f, fzi = 0.0f;
+            for (size_t j = i + 1; j < n; j++) {
+                const float dx = x[j] - xi;
+                const float dy = y[j] - yi;
+                const float dz = z[j] - zi;
+                const float s = Gmi * m[j] * inverseDistanceCubed<Law>(dx * dx + dy * dy + dz * dz, law);
+                fxi += dx * s;
+                fyi += dy * s;
+                fzi += dz * s;
+                fx[j] -= dx * s;
+                fy[j] -= dy * s;
+                fz[j] -= dz * s;
+            }
+            fx[i] += fxi;
+            fy[i] += fyi;
+            fz[i] += fzi;
         }
+    });
+
+    pool.parallelFor(n, bodyGrain, [&](size_t begin, size_t end, unsigned int) {
+        for (const auto &buffer: threadForces) {
+            for (size_t i = begin; i < end; i++) {
+                forces.x[i] += buffer.x[i];
+                forces.y[i] += buffer.y[i];
+                forces.z[i] += buffer.z[i];
+            }
+        }
+    });
+}
+
+// every row only writes its own body, so rows split across threads without any accumulators.
+// Also runs the scalar higher-precision rows, which have no symmetric variant.
+void physicsEngine::calculateForcesVectorised(const BodyStore &bodies, ForceBuffer &forces,
+                                              accelerationRowFunction row) {
+    const float G = CONFIG.gravitationalConstant;
+    const forceLawParameters law = forceLawParameters::fromConfig();
+    const size_t n = bodies.size();
+    threadPool::getInstance().parallelFor(n, rowGrain, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) {
+            float acceleration[3] = {};
+            row(bodies.x.data(), bodies.y.data(), bodies.z.data(), bodies.mass.data(), n,
+                bodies.x[i], bodies.y[i], bodies.z[i], law, acceleration);
+            const float Gmi = G * bodies.mass[i];
+            forces.x[i] = acceleration[0] * Gmi;
+            forces.y[i] = acceleration[1] * Gmi;
+            forces.z[i] = acceleration[2] * Gmi;
+        }
+    });
+}
+
+void physicsEngine::calculateForcesBarnesHut(const BodyStore &bodies, ForceBuffer &forces) {
+    const float G = CONFIG.gravitationalConstant;
+    const float theta = CONFIG.openingAngle;
+    const forceLawParameters law = forceLawParameters::fromConfig();
+    const treeForcesFunction treeForces = selectTreeForces(CONFIG.law);
+    tree.build(bodies);
+    threadPool::getInstance().parallelFor(bodies.size(), treeGrain, [&](size_t begin, size_t end, unsigned int) {
+        (tree.*treeForces)(bodies, begin, end, theta, G, law, forces);
+    });
+}
+
+void physicsEngine::calculateForcesFastMultipole(const BodyStore &bodies, ForceBuffer &forces) {
+    multipoleSolver.calculateAccelerations(bodies, CONFIG.multipoleOrder, CONFIG.openingAngle,
+                                           CONFIG.gravitationalConstant, solverAccelerations);
+    threadPool::getInstance().parallelFor(bodies.size(), bodyGrain, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) {
+            forces.x[i] = solverAccelerations.x[i] * bodies.mass[i];
+            forces.y[i] = solverAccelerations.y[i] * bodies.mass[i];
+            forces.z[i] = solverAccelerations.z[i] * bodies.mass[i];
+        }
+    });
+}
+
+void physicsEngine::calculateAccelerations(BodyStore &bodies) {
+    const size_t n = bodies.size();
+    forces.reset(n);
+    calculateForces(bodies, forces);
+    bodies.ax.resize(n);
+    bodies.ay.resize(n);
+    bodies.az.resize(n);
+    threadPool::getInstance().parallelFor(n, bodyGrain, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) {
+            const float inverseMass = 1.0f / bodies.mass[i];
+            bodies.ax[i] = forces.x[i] * inverseMass;
+            bodies.ay[i] = forces.y[i] * inverseMass;
+            bodies.az[i] = forces.z[i] * inverseMass;
+        }
+    });
+    bodies.accelerationsValid = true;
+}
+
+// forces for a subset only, used by the block timestep substeps
+void physicsEngine::calculateAccelerations(BodyStore &bodies, const std::vector<unsigned int> &targets) {
+    PROFILE_SCOPE("forces");
+    const float G = CONFIG.gravitationalConstant;
+    const forceLawParameters law = forceLawParameters::fromConfig();
+    const size_t n = bodies.size();
+    threadPool &pool = threadPool::getInstance();
+    if (CONFIG.solver == forceSolver::barnesHut) {
+        const float theta = CONFIG.openingAngle;
+        const treeForceFunction treeForce = selectTreeForce(CONFIG.law);
+        tree.build(bodies);
+        pool.parallelFor(targets.size(), rowGrain, [&](size_t begin, size_t end, unsigned int) {
+            for (size_t k = begin; k < end; k++) {
+                const unsigned int i = targets[k];
+                const glm::vec3 acceleration = (tree.*treeForce)(bodies, i, theta, G, law) / bodies.mass[i];
+                bodies.ax[i] = acceleration.x;
+                bodies.ay[i] = acceleration.y;
+                bodies.az[i] = acceleration.z;
+            }
+        });
+        return;
     }
+    if (CONFIG.solver == forceSolver::fastMultipole) {
+        // the far field is shared by every target, so the whole system is evaluated at once
+        multipoleSolver.calculateAccelerations(bodies, CONFIG.multipoleOrder, CONFIG.openingAngle, G,
+                                               solverAccelerations);
+        for (unsigned int i: targets) {
+            bodies.ax[i] = solverAccelerations.x[i];
+            bodies.ay[i] = solverAccelerations.y[i];
+            bodies.az[i] = solverAccelerations.z[i];
+        }
+        return;
+    }
+    const accelerationRowFunction row = forceKernel::select(forceKernel::detect(), CONFIG.precision, CONFIG.law);
+    pool.parallelFor(targets.size(), rowGrain, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t k = begin; k < end; k++) {
+            const unsigned int i = targets[k];
+            float acceleration[3] = {};
+            row(bodies.x.data(), bodies.y.data(), bodies.z.data(), bodies.mass.data(), n,
+                bodies.x[i], bodies.y[i], bodies.z[i], law, acceleration);
+            bodies.ax[i] = acceleration[0] * G;
+            bodies.ay[i] = acceleration[1] * G;
+            bodies.az[i] = acceleration[2] * G;
+        }
+    });
 }
 
+// Hierarchical block timesteps (kick-drift-kick). Body i steps by deltaTime / 2^level[i]. The
+// whole system drifts on the finest substep, but a body is only kicked, and its force only
+// recomputed, at the end of its own step. Every level lines up again at the end of the step.
+void physicsEngine::blockStep(BodyStore &bodies, float deltaTime) {
+    const size_t n = bodies.size();
+    const unsigned int maxLevel = std::min(CONFIG.maxTimestepLevel, 16u);
+    const unsigned int substeps = 1u << maxLevel;
+    const float finestStep = deltaTime / static_cast<float>(substeps);
+
+    if (!bodies.accelerationsValid) calculateAccelerations(bodies);
+    // new bodies start on the finest level, they move up once their jerk is known
+    bodies.timestepLevel.resize(n, static_cast<unsigned char>(maxLevel));
+    for (auto &level: bodies.timestepLevel) {
+        level = static_cast<unsigned char>(std::min<unsigned int>(level, maxLevel));
+    }
+    auto ownStep = [&](size_t i) {
+        return deltaTime / static_cast<float>(1u << bodies.timestepLevel[i]);
+    };
+
+    // opening half kick of every body's first step
+    for (size_t i = 0; i < n; i++) {
+        const float halfStep = 0.5f * ownStep(i);
+        bodies.vx[i] += bodies.ax[i] * halfStep;
+        bodies.vy[i] += bodies.ay[i] * halfStep;
+        bodies.vz[i] += bodies.az[i] * halfStep;
+    }
+
+    previousAccelerations.resize(3 * n);
+    for (unsigned int s = 1; s <= substeps; s++) {
+        drift(bodies, finestStep);
+
+        activeBodies.clear();
+        for (size_t i = 0; i < n; i++) {
+            if (s % (substeps >> bodies.timestepLevel[i]) == 0) {
+                activeBodies.push_back(static_cast<unsigned int>(i));
+            }
+        }
+        if (activeBodies.empty()) continue;
+
+        for (unsigned int i: activeBodies) {
+            previousAccelerations[3 * i] = bodies.ax[i];
+            previousAccelerations[3 * i + 1] = bodies.ay[i];
+            previousAccelerations[3 * i + 2] = bodies.az[i];
+        }
+        if (activeBodies.size() == n) {
+            calculateAccelerations(bodies);
+        } else {
+            calculateAccelerations(bodies, activeBodies);
+        }
+
+        for (unsigned int i: activeBodies) {
+            // closing half kick of the step that just ended
+            const float step = ownStep(i);
+            bodies.vx[i] += bodies.ax[i] * 0.5f * step;
+            bodies.vy[i] += bodies.ay[i] * 0.5f * step;
+            bodies.vz[i] += bodies.az[i] * 0.5f * step;
+
+            unsigned int level = chooseTimestepLevel(bodies, i, step, deltaTime, maxLevel);
+            // a coarser step may only start where that level's steps begin
+            while (level < bodies.timestepLevel[i] && s % (substeps >> level) != 0) level++;
+            bodies.timestepLevel[i] = static_cast<unsigned char>(level);
+
+            // opening half kick of the next step, which for s == substeps is taken by the next call
+            if (s < substeps) {
+                const float halfStep = 0.5f * ownStep(i);
+                bodies.vx[i] += bodies.ax[i] * halfStep;
+                bodies.vy[i] += bodies.ay[i] * halfStep;
+                bodies.vz[i] += bodies.az[i] * halfStep;
+            }
+        }
+    }
+}
+
+// Aarseth-style criterion dt = eta * |a| / |da/dt|, with the jerk taken as the change in
+// acceleration over the body's own last step, rounded down to a power-of-two fraction of deltaTime
+unsigned char physicsEngine::chooseTimestepLevel(const BodyStore &bodies, size_t i, float ownStep, float deltaTime,
+                                                 unsigned int maxLevel) {
+    const glm::vec3 acceleration(bodies.ax[i], bodies.ay[i], bodies.az[i]);
+    const glm::vec3 previous(previousAccelerations[3 * i], previousAccelerations[3 * i + 1],
+                             previousAccelerations[3 * i + 2]);
+    const float jerk = glm::length(acceleration - previous) / ownStep;
+    if (!(jerk > 0.0f)) return 0;
+    const float idealStep = CONFIG.timestepAccuracy * glm::length(acceleration) / jerk;
+    if (!(idealStep > 0.0f)) return static_cast<unsigned char>(maxLevel);
+
+    unsigned int level = 0;
+    float step = deltaTime;
+    while (step > idealStep && level < maxLevel) {
+        step *= 0.5f;
+        level++;
+    }
+    return static_cast<unsigned char>(level);
+}
+
+void physicsEngine::kick(BodyStore &bodies, float deltaTime) {
+    PROFILE_SCOPE("integrate");
+    threadPool::getInstance().parallelFor(bodies.size(), bodyGrain, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) {
+            bodies.vx[i] += bodies.ax[i] * deltaTime;
+            bodies.vy[i] += bodies.ay[i] * deltaTime;
+            bodies.vz[i] += bodies.az[i] * deltaTime;
+        }
+    });
+}
+
+void physicsEngine::drift(BodyStore &bodies, float deltaTime) {
+    PROFILE_SCOPE("integrate");
+    threadPool::getInstance().parallelFor(bodies.size(), bodyGrain, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) {
+            bodies.x[i] += bodies.vx[i] * deltaTime;
+            bodies.y[i] += bodies.vy[i] * deltaTime;
+            bodies.z[i] += bodies.vz[i] * deltaTime;
+        }
+    });
+}
+
+// one force evaluation per step: the closing kick's accelerations open the next step
+void physicsEngine::kickDriftKick(BodyStore &bodies, float deltaTime) {
+    if (!bodies.accelerationsValid) calculateAccelerations(bodies);
+    kick(bodies, 0.5f * deltaTime);
+    drift(bodies, deltaTime);
+    calculateAccelerations(bodies);
+    kick(bodies, 0.5f * deltaTime);
+}
+
+bool physicsEngine::scheduledStepApplies(collisionMode collisions) {
+    if (!CONFIG.taskGraphStep || CONFIG.solver == forceSolver::fastMultipole) return false;
+    if (collisions == collisionMode::elastic && CONFIG.maxBodyRadius <= 0.0f) return false;
+    // the scalar symmetric loop writes every later body, so its rows can't be split into tiles
+    static const simdLevel level = forceKernel::detect();
+    return CONFIG.solver == forceSolver::barnesHut || level != simdLevel::scalar ||
+           CONFIG.precision != scalarPrecision::single;
+}
+
+// The same step as kickDriftKick followed by collisionCheck, as a graph of
+//   open[c]   half kick and drift of a chunk of bodies, all joined by `drifted`
+//   tree      octree build (barnes-hut only), after drifted
+//   grid      spatial hash build, after drifted
+//   force[t]  accelerations and closing half kick of a tile (tree order for barnes-hut),
+//             after drifted and the tree
+//   broad[t]  collision candidates of a tile, after the grid
+//   narrow    the contacts, after every force and broad tile
+// instead of a parallelFor per pass. The tree and grid builds, both serial, run side by side,
+// and the broad phase tiles fill the gaps between force tiles. Accelerations are computed
+// exactly as calculateAccelerations does, and the narrow phase walks the candidates in the
+// same order as collisionCheck, so the result matches the fork-join step bit for bit.
+void physicsEngine::scheduledKickDriftKick(BodyStore &bodies, float deltaTime, bool collisions) {
+    if (!bodies.accelerationsValid) calculateAccelerations(bodies);
+    PROFILE_SCOPE("task graph step");
+    threadPool &pool = threadPool::getInstance();
+    const size_t n = bodies.size();
+    const float halfStep = 0.5f * deltaTime;
+    const float G = CONFIG.gravitationalConstant;
+    const forceLawParameters law = forceLawParameters::fromConfig();
+    const bool barnesHut = CONFIG.solver == forceSolver::barnesHut;
+    const float theta = CONFIG.openingAngle;
+    const treeForcesFunction treeForces = selectTreeForces(CONFIG.law);
+    const accelerationRowFunction row = forceKernel::select(forceKernel::detect(), CONFIG.precision, CONFIG.law);
+    const float maxRegularRadius = CONFIG.maxBodyRadius;
+    const size_t tiles = (n + tileRows - 1) / tileRows;
+    size_t contacts = 0;
+
+    stepGraph.clear();
+    const taskGraph::taskId drifted = stepGraph.add([](unsigned int) {});
+    for (size_t begin = 0; begin < n; begin += bodyGrain) {
+        const size_t end = std::min(begin + bodyGrain, n);
+        const taskGraph::taskId open = stepGraph.add([&, begin, end](unsigned int) {
+            for (size_t i = begin; i < end; i++) {
+                bodies.vx[i] += bodies.ax[i] * halfStep;
+                bodies.vy[i] += bodies.ay[i] * halfStep;
+                bodies.vz[i] += bodies.az[i] * halfStep;
+                bodies.x[i] += bodies.vx[i] * deltaTime;
+                bodies.y[i] += bodies.vy[i] * deltaTime;
+                bodies.z[i] += bodies.vz[i] * deltaTime;
+            }
+        });
+        stepGraph.precede(open, drifted);
+    }
+
+    taskGraph::taskId forcesReady = drifted;
+    if (barnesHut) {
+        forces.reset(n);
+        forcesReady = stepGraph.add([&](unsigned int) { tree.build(bodies); });
+        stepGraph.precede(drifted, forcesReady);
+    }
+    taskGraph::taskId narrow = 0;
+    if (collisions) {
+        narrow = stepGraph.add([&](unsigned int) {
+            PROFILE_SCOPE("collisions");
+            for (size_t t = 0; t < tiles; t++) {
+                const std::vector<unsigned int> &pairs = tilePairs[t];
+                const size_t end = std::min((t + 1) * tileRows, n);
+                size_t p = 0;
+                for (size_t i = t * tileRows; i < end; i++) {
+                    // the pairs were listed at build time, before contacts re-binned any body
+                    collisionCandidates.clear();
+                    for (; p < pairs.size() && pairs[p] == i; p += 2) collisionCandidates.push_back(pairs[p + 1]);
+                    collisionGrid.refresh(i, collisionCandidates);
+                    contacts += resolveCandidates(bodies, i, collisionCandidates);
+                }
+            }
+        });
+    }
+
+    for (size_t begin = 0; begin < n; begin += tileRows) {
+        const size_t end = std::min(begin + tileRows, n);
+        const taskGraph::taskId tile = stepGraph.add([&, begin, end](unsigned int) {
+            // barnes-hut tiles cover tree order positions, so each leaf's walk is shared
+            if (barnesHut) (tree.*treeForces)(bodies, begin, end, theta, G, law, forces);
+            for (size_t k = begin; k < end; k++) {
+                const size_t i = barnesHut ? tree.getIndices()[k] : k;
+                float fx, fy, fz;
+                if (barnesHut) {
+                    fx = forces.x[i];
+                    fy = forces.y[i];
+                    fz = forces.z[i];
+                } else {
+                    float acceleration[3] = {};
+                    row(bodies.x.data(), bodies.y.data(), bodies.z.data(), bodies.mass.data(), n,
+                        bodies.x[i], bodies.y[i], bodies.z[i], law, acceleration);
+                    const float Gmi = G * bodies.mass[i];
+                    fx = acceleration[0] * Gmi;
+                    fy = acceleration[1] * Gmi;
+                    fz = acceleration[2] * Gmi;
+                }
+                const float inverseMass = 1.0f / bodies.mass[i];
+                bodies.ax[i] = fx * inverseMass;
+                bodies.ay[i] = fy * inverseMass;
+                bodies.az[i] = fz * inverseMass;
+                bodies.vx[i] += bodies.ax[i] * halfStep;
+                bodies.vy[i] += bodies.ay[i] * halfStep;
+                bodies.vz[i] += bodies.az[i] * halfStep;
+            }
+        });
+        stepGraph.precede(forcesReady, tile);
+        if (collisions) stepGraph.precede(tile, narrow);
+    }
+
+    if (collisions) {
+        tilePairs.resize(tiles);
+        threadCandidates.resize(pool.size());
+        const taskGraph::taskId grid = stepGraph.add([&](unsigned int) {
+            collisionGrid.build(bodies, maxRegularRadius);
+        });
+        stepGraph.precede(drifted, grid);
+        for (size_t t = 0; t < tiles; t++) {
+            const taskGraph::taskId broad = stepGraph.add([&, t](unsigned int thread) {
+                std::vector<unsigned int> &pairs = tilePairs[t];
+                std::vector<unsigned int> &candidates = threadCandidates[thread];
+                pairs.clear();
+                const size_t end = std::min((t + 1) * tileRows, n);
+                for (size_t i = t * tileRows; i < end; i++) {
+                    collisionGrid.candidates(i, candidates);
+                    for (unsigned int j: candidates) {
+                        pairs.push_back(static_cast<unsigned int>(i));
+                        pairs.push_back(j);
+                    }
+                }
+            });
+            stepGraph.precede(grid, broad);
+            stepGraph.precede(broad, narrow);
+        }
+    }
+
+    stepGraph.run(pool);
+    bodies.accelerationsValid = contacts == 0;
+}
+
+// position form: x += v dt + a dt^2 / 2, then v += (a_old + a_new) dt / 2
+void physicsEngine::velocityVerlet(BodyStore &bodies, float deltaTime) {
+    if (!bodies.accelerationsValid) calculateAccelerations(bodies);
+    const float halfDtSquared = 0.5f * deltaTime * deltaTime;
+    const float halfDt = 0.5f * deltaTime;
+    {
+        PROFILE_SCOPE("integrate");
+        threadPool::getInstance().parallelFor(bodies.size(), bodyGrain, [&](size_t begin, size_t end, unsigned int) {
+            for (size_t i = begin; i < end; i++) {
+                bodies.x[i] += bodies.vx[i] * deltaTime + bodies.ax[i] * halfDtSquared;
+                bodies.y[i] += bodies.vy[i] * deltaTime + bodies.ay[i] * halfDtSquared;
+                bodies.z[i] += bodies.vz[i] * deltaTime + bodies.az[i] * halfDtSquared;
+                bodies.vx[i] += bodies.ax[i] * halfDt;
+                bodies.vy[i] += bodies.ay[i] * halfDt;
+                bodies.vz[i] += bodies.az[i] * halfDt;
+            }
+        });
+    }
+    calculateAccelerations(bodies);
+    kick(bodies, halfDt);
+}
+
+void physicsEngine::applyForces(BodyStore &bodies, const ForceBuffer &forces, float deltaTime) {
+    PROFILE_SCOPE("integrate");
+    threadPool::getInstance().parallelFor(bodies.size(), bodyGrain, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) {
+            const float inverseMass = 1.0f / bodies.mass[i];
+            bodies.vx[i] += forces.x[i] * inverseMass * deltaTime;
+            bodies.vy[i] += forces.y[i] * inverseMass * deltaTime;
+            bodies.vz[i] += forces.z[i] * inverseMass * deltaTime;
+            bodies.x[i] += bodies.vx[i] * deltaTime;
+            bodies.y[i] += bodies.vy[i] * deltaTime;
+            bodies.z[i] += bodies.vz[i] * deltaTime;
+        }
+    });
+}
+
+// Broad phase through the spatial hash, then the narrow phase on candidates in the same
+// (i, j) order as the exhaustive loop. Separating a pair can push a body into another cell,
+// so the grid re-bins both after every contact, and resolved contacts match the exhaustive
+// loop pair for pair.
+size_t physicsEngine::collisionCheck(BodyStore &bodies) {
+    PROFILE_SCOPE("collisions");
+    const float maxRegularRadius = CONFIG.maxBodyRadius;
+    if (maxRegularRadius <= 0.0f) {
+        return collisionCheckExhaustive(bodies);
+    }
+    size_t contacts = 0;
+    collisionGrid.build(bodies, maxRegularRadius);
+    for (size_t i = 0; i < bodies.size(); i++) {
+        collisionGrid.candidates(i, collisionCandidates);
+        contacts += resolveCandidates(bodies, i, collisionCandidates);
+    }
+    return contacts;
+}
+
+size_t physicsEngine::resolveCandidates(BodyStore &bodies, size_t i, std::vector<unsigned int> &candidates) {
+    size_t contacts = 0;
+    size_t k = 0;
+    while (k < candidates.size()) {
+        const unsigned int j = candidates[k++];
+        if (!touching(bodies, i, j) || !resolveCollision(bodies, i, j)) continue;
+        contacts++;
+        collisionGrid.moved(bodies, j);
+        // the rest of i's pairs include those around where it is now
+        if (collisionGrid.moved(bodies, i, candidates, k, j)) k = 0;
+    }
+    return contacts;
+}
+
+size_t physicsEngine::collisionCheckExhaustive(BodyStore &bodies) {
+    size_t contacts = 0;
+    const size_t n = bodies.size();
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i + 1; j < n; j++) {
+            if (touching(bodies, i, j) && resolveCollision(bodies, i, j)) contacts++;
+        }
+    }
+    return contacts;
+}
+
+// cheap squared-distance reject ahead of resolveCollision
+bool physicsEngine::touching(const BodyStore &bodies, size_t i, size_t j) {
+    const float dx = bodies.x[i] - bodies.x[j];
+    const float dy = bodies.y[i] - bodies.y[j];
+    const float dz = bodies.z[i] - bodies.z[j];
+    const float reach = bodies.radius[i] + bodies.radius[j];
+    return dx * dx + dy * dy + dz * dz <= reach * reach;
+}
+
+// SoA port of body::collisionCheck, kept numerically identical. Returns false if the bodies
+// turned out not to touch.
+bool physicsEngine::resolveCollision(BodyStore &bodies, size_t i, size_t j) {
+    glm::vec3 positionI = bodies.position(i);
+    glm::vec3 positionJ = bodies.position(j);
+    float distance = glm::distance(positionI, positionJ);
+    if (distance > bodies.radius[i] + bodies.radius[j]) return false;
+
+    // Collision normal (from j to i)
+    glm::vec3 collisionNormal = glm::normalize(positionI - positionJ);
+
+    // Separate overlapping bodies based on mass
+    const float massI = bodies.mass[i];
+    const float massJ = bodies.mass[j];
+    float overlap = (bodies.radius[i] + bodies.radius[j]) - distance;
+    float totalMass = massI + massJ;
+    bodies.setPosition(i, positionI + collisionNormal * (overlap * massJ / totalMass));
+    bodies.setPosition(j, positionJ - collisionNormal * (overlap * massI / totalMass));
+
+    // Relative velocity
+    glm::vec3 relativeVelocity = bodies.velocity(i) - bodies.velocity(j);
+    float velocityAlongNormal = glm::dot(relativeVelocity, collisionNormal);
+
+    // Don't resolve if velocities are separating
+    if (velocityAlongNormal > 0) return true;
+    float restitution = 1.0f;
+
+    float impulseMagnitude = -(1.0f + restitution) * velocityAlongNormal;
+    impulseMagnitude /= (1.0f / massI + 1.0f / massJ);
+
+    glm::vec3 impulse = impulseMagnitude * collisionNormal;
+    bodies.setVelocity(i, bodies.velocity(i) + impulse / massI);
+    bodies.setVelocity(j, bodies.velocity(j) - impulse / massJ);
+    return true;
+}
+
+// Perfectly inelastic contacts. The lower index of a touching pair absorbs the other, so the
+// central body at index 0 is never removed, and a body absorbed earlier in the pass takes no
+// further part in it. The store is compacted afterwards by swap-and-pop from the highest
+// removed index down, which only ever moves surviving bodies.
+size_t physicsEngine::mergeCheck(BodyStore &bodies) {
+    PROFILE_SCOPE("merges");
+    const size_t n = bodies.size();
+    const float maxRegularRadius = CONFIG.maxBodyRadius;
+    absorbed.assign(n, 0);
+    removed.clear();
+    auto tryAbsorb = [&](size_t i, size_t j) {
+        if (absorbed[j] || !touching(bodies, i, j)) return;
+        absorb(bodies, i, j);
+        absorbed[j] = 1;
+        removed.push_back(static_cast<unsigned int>(j));
+    };
+    if (maxRegularRadius <= 0.0f) {
+        for (size_t i = 0; i < n; i++) {
+            if (absorbed[i]) continue;
+            for (size_t j = i + 1; j < n; j++) tryAbsorb(i, j);
+        }
+    } else {
+        // merged bodies grow past the cell size and are paired with everything from the next
+        // build on
+        collisionGrid.build(bodies, maxRegularRadius);
+        for (size_t i = 0; i < n; i++) {
+            if (absorbed[i]) continue;
+            collisionGrid.candidates(i, collisionCandidates);
+            for (unsigned int j: collisionCandidates) tryAbsorb(i, j);
+        }
+    }
+    if (removed.empty()) return 0;
+
+    std::sort(removed.begin(), removed.end(), std::greater<>());
+    for (unsigned int j: removed) bodies.swapRemove(j);
+    return removed.size();
+}
+
+// j into i: mass and momentum add up, i moves to the pair's centre of mass and its radius to
+// that of the combined volume, and the heavier body's colour wins
+void physicsEngine::absorb(BodyStore &bodies, size_t i, size_t j) {
+    const float massI = bodies.mass[i];
+    const float massJ = bodies.mass[j];
+    const float totalMass = massI + massJ;
+    const float weightI = massI / totalMass, weightJ = massJ / totalMass;
+    bodies.setPosition(i, bodies.position(i) * weightI + bodies.position(j) * weightJ);
+    bodies.setVelocity(i, bodies.velocity(i) * weightI + bodies.velocity(j) * weightJ);
+    const float radiusI = bodies.radius[i], radiusJ = bodies.radius[j];
+    bodies.radius[i] = std::cbrt(radiusI * radiusI * radiusI + radiusJ * radiusJ * radiusJ);
+    if (massJ > massI) bodies.colour[i] = bodies.colour[j];
+    bodies.mass[i] = totalMass;
+}
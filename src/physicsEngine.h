@@ -1,20 +1,142 @@
 #ifndef N_BODY_SIMULATION_GL_PHYSICSENGINE_H
 #define N_BODY_SIMULATION_GL_PHYSICSENGINE_H
+#include <atomic>
 #include <vector>
 
 #include "body.h"
+#include "bodyStore.h"
+#include "octree.h"
+#include "fmm.h"
+#include "forceKernel.h"
+#include "physicsPolicies.h"
+#include "spatialHash.h"
+#include "taskGraph.h"
 
 
+// relative force error of the active solver against body::calculateGravitationalForce
+struct forceValidation {
+    float rmsError = 0.0f;
+    float maxError = 0.0f;
+    size_t samples = 0;
+};
+
+// conserved quantities of the whole system, all in double
+struct conservationSample {
+    double kinetic = 0.0;
+    double potential = 0.0; //under activeLaw
+    glm::dvec3 momentum{0.0};
+    double momentumScale = 0.0; //sum of m |v|, the scale momentum drift is relative to
+    size_t bodies = 0;
+
+    [[nodiscard]] double energy() const { return kinetic + potential; }
+};
+
 class physicsEngine {
 public:
-    static void update(std::vector<body> &bodies, double deltaTime);
+    // one step of a particular integrator and collision policy (physicsPolicies.h)
+    using stepFunction = void (*)(BodyStore &bodies, double deltaTime);
+
+    static void update(BodyStore &bodies, double deltaTime);
+
+    // the step specialisation for the CONFIG integrator, block timestep and collision settings
+    static stepFunction selectStep();
+
+    // CONFIG.law, or newtonian for the fmm solver which has no other
+    static forceLaw activeLaw();
+
+    // checks CONFIG.solver on `samples` evenly spaced bodies, O(samples * N)
+    static forceValidation validateForces(const BodyStore &bodies, size_t samples);
+
+    // energy and momentum; the potential is an exact pair sum, O(N^2 / 2) across the pool
+    static conservationSample conservation(const BodyStore &bodies);
+
+    // result of the last per-step validation (CONFIG.validateForces), safe to read from any thread
+    static forceValidation lastValidation();
+
+    // the individual passes of a step, public so n_body_bench can time them in isolation.
+    // forces must be reset to bodies.size() beforehand
+    static void calculateForces(const BodyStore &bodies, ForceBuffer &forces);
+
+    static void applyForces(BodyStore &bodies, const ForceBuffer &forces, float deltaTime);
+
+    // bodies.ax/ay/az of the targets only, against the whole system; bodies.ax must be sized
+    // already. Used by the block timestep substeps and the domain workers
+    static void calculateAccelerations(BodyStore &bodies, const std::vector<unsigned int> &targets);
+
+    // resolves every touching pair, returns the number of contacts
+    static size_t collisionCheck(BodyStore &bodies);
+
+    // merges every touching pair and compacts the store, returns the number of bodies removed
+    static size_t mergeCheck(BodyStore &bodies);
 
 private:
-    static void calculateForces(std::vector<body> &bodies, std::vector<glm::vec3> &forces);
+    static octree tree;
+    static fmm multipoleSolver;
+    static ForceBuffer forces;
+    static ForceBuffer solverAccelerations;
+    static std::atomic<float> validationRmsError;
+    static std::atomic<float> validationMaxError;
+    static std::atomic<size_t> validationSamples;
+    static std::vector<ForceBuffer> threadForces;
+    static spatialHash collisionGrid;
+    static std::vector<unsigned int> collisionCandidates;
+    static std::vector<unsigned char> absorbed;
+    static std::vector<unsigned int> removed;
+    static taskGraph stepGraph;
+    static std::vector<std::vector<unsigned int>> tilePairs;
+    static std::vector<std::vector<unsigned int>> threadCandidates;
+
+    static void updateOrigin(BodyStore &bodies);
+
+    template<class Integrator>
+    static stepFunction selectStep(collisionMode collisions);
+
+    template<class Integrator, class Collisions>
+    static void step(BodyStore &bodies, double deltaTime);
+
+    template<class Law>
+    static void calculateForcesSymmetric(const BodyStore &bodies, ForceBuffer &forces);
+
+    static void calculateForcesVectorised(const BodyStore &bodies, ForceBuffer &forces, accelerationRowFunction row);
+
+    static void calculateForcesBarnesHut(const BodyStore &bodies, ForceBuffer &forces);
+
+    static void calculateForcesFastMultipole(const BodyStore &bodies, ForceBuffer &forces);
+
+    static std::vector<unsigned int> activeBodies;
+    static std::vector<float> previousAccelerations;
+
+    static void calculateAccelerations(BodyStore &bodies);
+
+    static void blockStep(BodyStore &bodies, float deltaTime);
+
+    static unsigned char chooseTimestepLevel(const BodyStore &bodies, size_t i, float ownStep, float deltaTime,
+                                             unsigned int maxLevel);
+
+    static void kick(BodyStore &bodies, float deltaTime);
+
+    static void drift(BodyStore &bodies, float deltaTime);
+
+    static void kickDriftKick(BodyStore &bodies, float deltaTime);
+
+    // whether scheduledKickDriftKick covers the CONFIG solver and collision settings
+    static bool scheduledStepApplies(collisionMode collisions);
+
+    // kickDriftKick as one task graph, with the elastic collision pass folded in if `collisions`
+    static void scheduledKickDriftKick(BodyStore &bodies, float deltaTime, bool collisions);
+
+    static void velocityVerlet(BodyStore &bodies, float deltaTime);
+
+    static size_t collisionCheckExhaustive(BodyStore &bodies);
+
+    // the contacts of body i with its broad phase candidates, refreshed if i leaves its cell
+    static size_t resolveCandidates(BodyStore &bodies, size_t i, std::vector<unsigned int> &candidates);
+
+    static bool touching(const BodyStore &bodies, size_t i, size_t j);
 
-    static void applyForces(std::vector<body> &bodies, std::vector<glm::vec3> &forces, float deltaTime);
+    static bool resolveCollision(BodyStore &bodies, size_t i, size_t j);
 
-    static void collisionCheck(std::vector<body> &bodies);
+    static void absorb(BodyStore &bodies, size_t i, size_t j);
 };
 
 
@@ -0,0 +1,115 @@
+#ifndef N_BODY_SIMULATION_GL_PHYSICSPOLICIES_H
+#define N_BODY_SIMULATION_GL_PHYSICSPOLICIES_H
+#include <cmath>
+#include "config.h"
+
+// Compile-time policies the physics kernels are specialised on. Each combination is its own
+// instantiation, so a feature that is switched off costs nothing in the inner loops, and the
+// runtime choice is made once per force evaluation or step by a factory over the instantiations
+// (forceKernel::select, physicsEngine::selectStep).
+
+// ---- force laws: how a squared separation becomes the 1 / r^3 factor of m r / r^3 ----
+
+struct forceLawParameters {
+    float softeningSquared = 0.0f;
+    float cutoffSquared = 0.0f;
+
+    static forceLawParameters fromConfig() {
+        return {CONFIG.softeningLength * CONFIG.softeningLength, CONFIG.cutoffRadius * CONFIG.cutoffRadius};
+    }
+};
+
+struct newtonianLaw {
+    static constexpr forceLaw type = forceLaw::newtonian;
+    static constexpr bool softened = false;
+    static constexpr bool truncated = false;
+};
+
+// 1 / (r^2 + eps^2)^(3/2), bounded at close encounters
+struct plummerLaw {
+    static constexpr forceLaw type = forceLaw::plummer;
+    static constexpr bool softened = true;
+    static constexpr bool truncated = false;
+};
+
+// newtonian inside the cutoff radius, zero beyond it
+struct cutoffLaw {
+    static constexpr forceLaw type = forceLaw::cutoff;
+    static constexpr bool softened = false;
+    static constexpr bool truncated = true;
+};
+
+// the scalar form of a law, zero for coincident points; the SIMD kernels test the same flags
+template<class Law, typename Scalar>
+inline Scalar inverseDistanceCubed(Scalar distanceSquared, const forceLawParameters &parameters) {
+    bool live;
+    if constexpr (Law::truncated) {
+        live = distanceSquared > Scalar(0) && distanceSquared < static_cast<Scalar>(parameters.cutoffSquared);
+    } else {
+        live = distanceSquared > Scalar(0);
+    }
+    if constexpr (Law::softened) {
+        distanceSquared += static_cast<Scalar>(parameters.softeningSquared);
+        live = distanceSquared > Scalar(0);
+    }
+    const Scalar inverseDistance = Scalar(1) / std::sqrt(live ? distanceSquared : Scalar(1));
+    return live ? inverseDistance * inverseDistance * inverseDistance : Scalar(0);
+}
+
+// the 1 / r of the potential -G mi mj / r each law's force derives from, zero for coincident
+// points. The cutoff potential is shifted by 1 / rc so it stays continuous at the cutoff
+template<class Law>
+inline double inverseDistance(double distanceSquared, const forceLawParameters &parameters) {
+    if constexpr (Law::softened) {
+        distanceSquared += static_cast<double>(parameters.softeningSquared);
+    }
+    if (!(distanceSquared > 0.0)) return 0.0;
+    if constexpr (Law::truncated) {
+        const double cutoffSquared = parameters.cutoffSquared;
+        if (distanceSquared >= cutoffSquared) return 0.0;
+        return 1.0 / std::sqrt(distanceSquared) - 1.0 / std::sqrt(cutoffSquared);
+    }
+    return 1.0 / std::sqrt(distanceSquared);
+}
+
+// ---- collision policies ----
+
+struct noCollisions {
+    static constexpr collisionMode mode = collisionMode::none;
+};
+
+struct elasticCollisions {
+    static constexpr collisionMode mode = collisionMode::elastic;
+};
+
+// accretion: mass and momentum of the absorbed body go to the survivor, which takes the
+// combined volume, and the store shrinks
+struct mergeCollisions {
+    static constexpr collisionMode mode = collisionMode::merge;
+};
+
+// ---- integrators ----
+
+struct semiImplicitEulerIntegrator {
+    static constexpr integratorType type = integratorType::semiImplicitEuler;
+};
+
+struct leapfrogIntegrator {
+    static constexpr integratorType type = integratorType::leapfrog;
+};
+
+struct velocityVerletIntegrator {
+    static constexpr integratorType type = integratorType::velocityVerlet;
+};
+
+struct yoshida4Integrator {
+    static constexpr integratorType type = integratorType::yoshida4;
+};
+
+// hierarchical block timesteps, kick-drift-kick whatever CONFIG.integrator says
+struct blockTimestepIntegrator {
+    static constexpr integratorType type = integratorType::leapfrog;
+};
+
+
+#endif //N_BODY_SIMULATION_GL_PHYSICSPOLICIES_H
@@ -0,0 +1,81 @@
+#ifndef N_BODY_SIMULATION_GL_PRECISION_H
+#define N_BODY_SIMULATION_GL_PRECISION_H
+#include <cmath>
+#include <cstddef>
+#include "physicsPolicies.h"
+
+// Summation policies for the precision-templated direct-sum row
+template<typename Scalar>
+struct plainSum {
+    Scalar sum = 0;
+
+    void add(Scalar value) { sum += value; }
+
+    [[nodiscard]] Scalar value() const { return sum; }
+};
+
+// Kahan summation: the low-order bits each addition drops are carried into the next one, so
+// the error stays O(eps) instead of growing with the number of terms. Relies on strict IEEE
+// evaluation, it is optimised away under -ffast-math.
+template<typename Scalar>
+struct compensatedSum {
+    Scalar sum = 0;
+    Scalar compensation = 0;
+
+    void add(Scalar value) {
+        const Scalar corrected = value - compensation;
+        const Scalar next = sum + corrected;
+        compensation = (next - sum) - corrected;
+        sum = next;
+    }
+
+    // compensation holds what sum overstates by
+    [[nodiscard]] Scalar value() const { return sum - compensation; }
+};
+
+// one source's contribution to a precise row, m_j * r_ij / |r_ij|^3 under Law
+template<class Law, typename Scalar, template<typename> class Sum>
+inline void accumulatePrecise(Scalar dx, Scalar dy, Scalar dz, Scalar mass, const forceLawParameters &law,
+                              Sum<Scalar> &ax, Sum<Scalar> &ay, Sum<Scalar> &az) {
+    const Scalar s = mass * inverseDistanceCubed<Law>(dx * dx + dy * dy + dz * dz, law);
+    ax.add(dx * s);
+    ay.add(dy * s);
+    az.add(dz * s);
+}
+
+// forceKernel::accelerationRowScalar with the differences and the inverse cube evaluated in
+// Scalar and the sums accumulated through Sum<Scalar>. Each of `lanes` accumulators takes every
+// lanes-th source, which breaks the serial dependency of the sums, and the lanes are combined
+// through Sum as well. Matches accelerationRowFunction.
+template<typename Scalar, template<typename> class Sum, class Law>
+void accelerationRowPrecise(const float *x, const float *y, const float *z, const float *m, size_t n,
+                            float xi, float yi, float zi, const forceLawParameters &law, float *acceleration) {
+    constexpr size_t lanes = 8;
+    Sum<Scalar> ax[lanes], ay[lanes], az[lanes];
+    const auto px = static_cast<Scalar>(xi), py = static_cast<Scalar>(yi), pz = static_cast<Scalar>(zi);
+    size_t j = 0;
+    for (; j + lanes <= n; j += lanes) {
+        for (size_t lane = 0; lane < lanes; lane++) {
+            accumulatePrecise<Law>(static_cast<Scalar>(x[j + lane]) - px, static_cast<Scalar>(y[j + lane]) - py,
+                                   static_cast<Scalar>(z[j + lane]) - pz, static_cast<Scalar>(m[j + lane]), law,
+                                   ax[lane], ay[lane], az[lane]);
+        }
+    }
+    for (size_t lane = 0; j < n; j++, lane++) {
+        accumulatePrecise<Law>(static_cast<Scalar>(x[j]) - px, static_cast<Scalar>(y[j]) - py,
+                               static_cast<Scalar>(z[j]) - pz, static_cast<Scalar>(m[j]), law,
+                               ax[lane], ay[lane], az[lane]);
+    }
+
+    Sum<Scalar> sx, sy, sz;
+    for (size_t lane = 0; lane < lanes; lane++) {
+        sx.add(ax[lane].value());
+        sy.add(ay[lane].value());
+        sz.add(az[lane].value());
+    }
+    acceleration[0] += static_cast<float>(sx.value());
+    acceleration[1] += static_cast<float>(sy.value());
+    acceleration[2] += static_cast<float>(sz.value());
+}
+
+#endif //N_BODY_SIMULATION_GL_PRECISION_H
@@ -0,0 +1,105 @@
+#include "profiler.h"
+#include <cstdio>
+#include <cstring>
+
+unsigned int profiler::currentTrack() {
+    thread_local unsigned int track = getInstance().nextTrack.fetch_add(1, std::memory_order_relaxed);
+    return track;
+}
+
+// a handful of phases, so a linear scan beats hashing; literals from different translation
+// units may not share an address, hence the strcmp
+profiler::phase &profiler::find(const char *name) {
+    for (auto &p: phases) {
+        if (p.name == name || std::strcmp(p.name, name) == 0) return p;
+    }
+    phases.push_back(phase{name});
+    return phases.back();
+}
+
+void profiler::record(const char *name, std::uint64_t start, std::uint64_t duration, unsigned int track) {
+    if (track == 0) track = currentTrack();
+    std::lock_guard<std::mutex> lock(mutex);
+    find(name).pending += duration;
+    if (recordingTrace.load(std::memory_order_relaxed) && trace.size() < maxTraceEvents) {
+        trace.push_back({name, track, start, duration});
+    }
+}
+
+void profiler::nameThread(const char *name) {
+    const unsigned int track = currentTrack();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &entry: threadNames) {
+        if (entry.first == track) {
+            entry.second = name;
+            return;
+        }
+    }
+    threadNames.emplace_back(track, name);
+}
+
+void profiler::endFrame() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &p: phases) {
+        p.samples[p.next] = static_cast<float>(static_cast<double>(p.pending) * 1e-6);
+        p.next = (p.next + 1) % historyLength;
+        p.pending = 0;
+    }
+}
+
+void profiler::history(std::vector<phaseHistory> &out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    out.resize(phases.size());
+    for (size_t i = 0; i < phases.size(); i++) {
+        const phase &p = phases[i];
+        phaseHistory &h = out[i];
+        h.name = p.name;
+        h.milliseconds.resize(historyLength);
+        float sum = 0.0f;
+        for (size_t k = 0; k < historyLength; k++) {
+            h.milliseconds[k] = p.samples[(p.next + k) % historyLength];
+            sum += h.milliseconds[k];
+        }
+        h.average = sum / static_cast<float>(historyLength);
+    }
+}
+
+void profiler::startTrace() {
+    std::lock_guard<std::mutex> lock(mutex);
+    trace.clear();
+    traceStart = now();
+    recordingTrace.store(true, std::memory_order_relaxed);
+}
+
+bool profiler::stopTrace(const std::string &path) {
+    std::vector<traceEvent> events;
+    std::vector<std::pair<unsigned int, std::string>> names;
+    std::uint64_t origin;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        recordingTrace.store(false, std::memory_order_relaxed);
+        events.swap(trace);
+        names = threadNames;
+        origin = traceStart;
+    }
+
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    if (!file) return false;
+    // chrome://tracing and Perfetto read microsecond timestamps
+    std::fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    for (const auto &entry: names) {
+        std::fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                           "\"args\": {\"name\": \"%s\"}}", first ? "" : ",\n", entry.first, entry.second.c_str());
+        first = false;
+    }
+    std::fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                       "\"args\": {\"name\": \"GPU\"}}", first ? "" : ",\n", gpuTrack);
+    for (const auto &event: events) {
+        const double start = static_cast<double>(event.start >= origin ? event.start - origin : 0) * 1e-3;
+        std::fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                     event.name, event.track, start, static_cast<double>(event.duration) * 1e-3);
+    }
+    std::fprintf(file, "\n]}\n");
+    return std::fclose(file) == 0;
+}
@@ -0,0 +1,119 @@
+#ifndef N_BODY_SIMULATION_GL_PROFILER_H
+#define N_BODY_SIMULATION_GL_PROFILER_H
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Per-phase timing shared by the render and simulation threads. Phases are named by string
+// literals; their time is summed per rendered frame into a rolling history for the menu graph
+// and, while a trace is recording, kept as Chrome trace_event "X" events. While disabled a
+// PROFILE_SCOPE costs one relaxed atomic load.
+class profiler {
+public:
+    static constexpr size_t historyLength = 240;
+    static constexpr size_t maxTraceEvents = 1 << 20;
+    static constexpr unsigned int gpuTrack = 1000; //trace row for GL_TIME_ELAPSED results
+
+    struct phaseHistory {
+        const char *name;
+        std::vector<float> milliseconds; //oldest first
+        float average;
+    };
+
+    // Singleton access
+    static profiler &getInstance() {
+        static profiler instance;
+        return instance;
+    }
+
+    profiler(const profiler &) = delete;
+
+    profiler &operator=(const profiler &) = delete;
+
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+
+    static void setEnabled(bool enabled) { active.store(enabled, std::memory_order_relaxed); }
+
+    static std::uint64_t now() {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // adds a finished phase on the calling thread's track, or on `track` if given
+    void record(const char *name, std::uint64_t start, std::uint64_t duration, unsigned int track = 0);
+
+    // labels the calling thread's row in the trace
+    void nameThread(const char *name);
+
+    // closes the current frame: every phase's accumulated time becomes one history sample
+    void endFrame();
+
+    void history(std::vector<phaseHistory> &out);
+
+    void startTrace();
+
+    [[nodiscard]] bool tracing() const { return recordingTrace.load(std::memory_order_relaxed); }
+
+    // stops recording and writes the Chrome trace_event JSON, false if the file can't be written
+    bool stopTrace(const std::string &path);
+
+private:
+    profiler() = default;
+
+    struct phase {
+        const char *name;
+        std::uint64_t pending = 0;
+        std::vector<float> samples = std::vector<float>(historyLength, 0.0f);
+        size_t next = 0;
+    };
+
+    struct traceEvent {
+        const char *name;
+        unsigned int track;
+        std::uint64_t start;
+        std::uint64_t duration;
+    };
+
+    static inline std::atomic<bool> active{false};
+
+    static unsigned int currentTrack();
+
+    phase &find(const char *name);
+
+    std::mutex mutex;
+    std::vector<phase> phases;
+    std::vector<traceEvent> trace;
+    std::vector<std::pair<unsigned int, std::string>> threadNames;
+    std::atomic<bool> recordingTrace{false};
+    std::uint64_t traceStart = 0;
+    std::atomic<unsigned int> nextTrack{1};
+};
+
+// Times the rest of the enclosing block as one phase
+class profileScope {
+public:
+    explicit profileScope(const char *name) : name(name), start(profiler::enabled() ? profiler::now() : 0) {
+    }
+
+    ~profileScope() {
+        if (start != 0) profiler::getInstance().record(name, start, profiler::now() - start);
+    }
+
+    profileScope(const profileScope &) = delete;
+
+    profileScope &operator=(const profileScope &) = delete;
+
+private:
+    const char *name;
+    std::uint64_t start;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) profileScope PROFILE_CONCAT(profileScope_, __LINE__)(name)
+
+
+#endif //N_BODY_SIMULATION_GL_PROFILER_H
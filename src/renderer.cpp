@@ -1,5 +1,8 @@
 #include "renderer.h"
 #include "config.h"
+#include "profiler.h"
+#include <cmath>
+#include <cstddef>
 #include <iostream>
 
 renderer::renderer(int width, int height, const char *title) : window(nullptr),
@@ -9,8 +12,10 @@ renderer::renderer(int width, int height, const char *title) : window(nullptr),
                                                                width(width),
                                                                height(height),
                                                                title(title),
-                                                               VAO(0), VBO(0), EBO(0), instanceVBO(0),
-                                                               indexCount(0),
+                                                               VAO(0), VBO(0), EBO(0),
+                                                               format(CONFIG.compactInstances
+                                                                          ? instanceFormat::compact
+                                                                          : instanceFormat::full),
                                                                menuMode(false),
                                                                firstMouse(true),
                                                                tabPressed(false),
@@ -24,7 +29,8 @@ renderer::~renderer() {
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
-    glDeleteBuffers(1, &instanceVBO);
+    instances.release();
+    if (timerQueries[0] != 0) glDeleteQueries(timerQueryCount, timerQueries);
     glfwDestroyWindow(window);
     glfwTerminate();
 }
@@ -78,88 +84,166 @@ bool renderer::init() {
     return true;
 }
 
-void renderer::setupBuffers(const SphereData &sphereData, unsigned int numBodies) {
-    indexCount = sphereData.indices.size();
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
+void renderer::setupBuffers(const std::vector<SphereData> &sphereLods, unsigned int numBodies) {
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    for (size_t level = 0; level < visibleSet::levels && level < sphereLods.size(); level++) {
+        const SphereData &sphere = sphereLods[level];
+        lods[level].indexCount = static_cast<GLsizei>(sphere.indices.size());
+        lods[level].firstIndex = indices.size();
+        lods[level].baseVertex = static_cast<GLint>(vertices.size() / 3);
+        vertices.insert(vertices.end(), sphere.vertices.begin(), sphere.vertices.end());
+        indices.insert(indices.end(), sphere.indices.begin(), sphere.indices.end());
+    }
+
+    // a second call re-uploads into the same objects rather than leaking the first ones
+    if (VAO == 0) {
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+    }
 
     glBindVertexArray(VAO);
 
     // Setup vertex buffer
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sphereData.vertices.size() * sizeof(float),
-                 sphereData.vertices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
 
     // Setup element buffer (indices)
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sphereData.indices.size() * sizeof(unsigned int),
-                 sphereData.indices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
 
     // Vertex position attribute
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), static_cast<void *>(nullptr));
     glEnableVertexAttribArray(0);
 
-    //vertex normal attribute
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *) (3 * sizeof(float)));
+    //vertex normal attribute, on a unit sphere the normal is the position
+    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), static_cast<void *>(nullptr));
     glEnableVertexAttribArray(4);
 
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
     // Setup instance buffer
-    glGenBuffers(1, &instanceVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-    glBufferData(GL_ARRAY_BUFFER, numBodies * 7 * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+    instances.reserve(numBodies * instancePacking::stride(format));
+    setupInstanceAttributes();
+}
 
-    // Instance position attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 7 * sizeof(float), static_cast<void *>(nullptr));
-    glEnableVertexAttribArray(1);
-    glVertexAttribDivisor(1, 1);
+void renderer::reserveInstances(size_t numBodies) {
+    if (instances.reserve(numBodies * instancePacking::stride(format))) setupInstanceAttributes();
+}
 
-    // Instance radius attribute
-    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 7 * sizeof(float), reinterpret_cast<void *>(3 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glVertexAttribDivisor(2, 1);
+void renderer::setInstanceFormat(instanceFormat newFormat) {
+    if (newFormat == format) return;
+    format = newFormat;
+    setupInstanceAttributes();
+}
 
-    // Instance colour attribute
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 7 * sizeof(float), reinterpret_cast<void *>(4 * sizeof(float)));
-    glEnableVertexAttribArray(3);
-    glVertexAttribDivisor(3, 1);
+// points the per-instance attributes at the ring, the section is chosen per draw by baseInstance
+void renderer::setupInstanceAttributes() {
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, instances.buffer());
+    const auto stride = static_cast<GLsizei>(instancePacking::stride(format));
+
+    if (format == instanceFormat::compact) {
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride,
+                              reinterpret_cast<void *>(offsetof(compactInstance, x)));
+        glVertexAttribPointer(2, 1, GL_HALF_FLOAT, GL_FALSE, stride,
+                              reinterpret_cast<void *>(offsetof(compactInstance, radius)));
+        glVertexAttribPointer(3, 3, GL_HALF_FLOAT, GL_FALSE, stride,
+                              reinterpret_cast<void *>(offsetof(compactInstance, r)));
+    } else {
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride,
+                              reinterpret_cast<void *>(offsetof(fullInstance, x)));
+        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, stride,
+                              reinterpret_cast<void *>(offsetof(fullInstance, radius)));
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride,
+                              reinterpret_cast<void *>(offsetof(fullInstance, r)));
+    }
+    for (GLuint location = 1; location <= 3; location++) {
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
+    }
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 }
 
-void renderer::renderFrame(const std::vector<body> &bodies, const Shader &shader) {
+void renderer::renderFrame(const BodyStore &bodies, const Shader &shader) {
+    PROFILE_SCOPE("render frame");
+    const bool timing = profiler::enabled();
+    if (timing) collectGpuTimers();
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    if (!bodies.empty()) {
-        std::vector<float> instanceData;
-        for (auto &b: bodies) {
-            instanceData.push_back(b.position.x);
-            instanceData.push_back(b.position.y);
-            instanceData.push_back(b.position.z);
-            instanceData.push_back(b.radius);
-            instanceData.push_back(b.colour.r);
-            instanceData.push_back(b.colour.g);
-            instanceData.push_back(b.colour.b);
+    triangles = 0;
+    if (bodies.empty()) {
+        visible.visible = 0;
+        return;
+    }
+
+    glm::mat4 view = camera.GetViewMatrix();
+    const float fieldOfView = glm::radians(camera.Zoom);
+    glm::mat4 projection = glm::perspective(fieldOfView, static_cast<float>(width) / static_cast<float>(height),
+                                            0.1f, 10000.0f);
+    {
+        PROFILE_SCOPE("cull");
+        const float pixelScale = static_cast<float>(height) / (2.0f * std::tan(fieldOfView * 0.5f));
+        visibility::classify(bodies, projection * view, camera.Position, camera.Front, pixelScale, lodMinPixels,
+                             visible);
+    }
+    if (visible.visible == 0) return;
+
+    const size_t stride = instancePacking::stride(format);
+    if (instances.reserve(bodies.size() * stride)) setupInstanceAttributes();
+    {
+        PROFILE_SCOPE("pack instances");
+        instancePacking::pack(bodies, visible.indices.data(), visible.visible, format, instances.beginFrame());
+    }
+
+    shader.use();
+    shader.setMat4("projection", projection);
+    shader.setMat4("view", view);
+    shader.setVec3("lightPos", bodies.worldPosition(0));
+    shader.setVec3("viewPos", camera.Position);
+
+    glBindVertexArray(VAO);
+    const unsigned int slot = timerFrame++ % timerQueryCount;
+    const bool timed = timing && !timerPending[slot];
+    if (timed) {
+        if (timerQueries[0] == 0) glGenQueries(timerQueryCount, timerQueries);
+        timerIssued[slot] = profiler::now();
+        glBeginQuery(GL_TIME_ELAPSED, timerQueries[slot]);
+    }
+    {
+        PROFILE_SCOPE("draw submit");
+        const GLuint base = instances.baseInstance(stride);
+        for (unsigned int level = 0; level < visibleSet::levels; level++) {
+            if (visible.count[level] == 0 || lods[level].indexCount == 0) continue;
+            glDrawElementsInstancedBaseVertexBaseInstance(
+                GL_TRIANGLES, lods[level].indexCount, GL_UNSIGNED_INT,
+                reinterpret_cast<void *>(lods[level].firstIndex * sizeof(unsigned int)),
+                static_cast<GLsizei>(visible.count[level]), lods[level].baseVertex,
+                base + static_cast<GLuint>(visible.first[level]));
+            triangles += visible.count[level] * static_cast<size_t>(lods[level].indexCount / 3);
         }
+    }
+    if (timed) {
+        glEndQuery(GL_TIME_ELAPSED);
+        timerPending[slot] = true;
+    }
+    instances.endFrame();
+}
 
-        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-        glBufferData(GL_ARRAY_BUFFER, instanceData.size() * sizeof(float),
-                     instanceData.data(), GL_DYNAMIC_DRAW);
-        glm::mat4 view = camera.GetViewMatrix();
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom),
-                                                static_cast<float>(width) / static_cast<float>(height),
-                                                0.1f, 10000.0f);
-        shader.use();
-        shader.setMat4("projection", projection);
-        shader.setMat4("view", view);
-        shader.setVec3("lightPos", bodies[0].position);
-        shader.setVec3("viewPos", camera.Position);
-
-        glBindVertexArray(VAO);
-        // Use glDrawElementsInstanced instead of glDrawArraysInstanced
-        glDrawElementsInstanced(GL_TRIANGLES, indexCount,
-                                GL_UNSIGNED_INT, nullptr, bodies.size());
+void renderer::collectGpuTimers() {
+    for (unsigned int slot = 0; slot < timerQueryCount; slot++) {
+        if (!timerPending[slot]) continue;
+        GLint available = 0;
+        glGetQueryObjectiv(timerQueries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue;
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(timerQueries[slot], GL_QUERY_RESULT, &elapsed);
+        profiler::getInstance().record("gpu draw", timerIssued[slot], elapsed, profiler::gpuTrack);
+        timerPending[slot] = false;
     }
 }
 
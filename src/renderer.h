@@ -2,21 +2,38 @@
 #define N_BODY_SIMULATION_GL_RENDERER_H
 #include<glad/glad.h>
 #include<GLFW/glfw3.h>
+#include <cstdint>
+#include <vector>
 #include "camera.h"
 #include "body.h"
+#include "bodyStore.h"
 #include "shader.h"
+#include "instanceRing.h"
+#include "instancePacking.h"
+#include "visibility.h"
 
 class renderer {
 public:
+    // sphere segments per level of detail and the projected radius in pixels below which the
+    // next coarser level is used
+    static constexpr int lodSegments[visibleSet::levels] = {32, 16, 8, 4};
+    static constexpr float lodMinPixels[visibleSet::levels - 1] = {24.0f, 8.0f, 2.5f};
+
     renderer(int width, int height, const char *title);
 
     ~renderer();
 
     bool init();
 
-    void setupBuffers(const SphereData &sphereData, unsigned int numBodies);
+    // one unit sphere per entry of lodSegments, finest first
+    void setupBuffers(const std::vector<SphereData> &sphereLods, unsigned int numBodies);
+
+    // grows the instance buffer ahead of a larger system, never shrinks it
+    void reserveInstances(size_t numBodies);
+
+    void renderFrame(const BodyStore &bodies, const Shader &shader);
 
-    void renderFrame(const std::vector<body> &bodies, const Shader &shader);
+    void setInstanceFormat(instanceFormat format);
 
     [[nodiscard]] bool shouldClose() const;
 
@@ -24,6 +41,9 @@ public:
 
     void swapBuffers() const;
 
+    [[nodiscard]] size_t visibleBodies() const { return visible.visible; }
+    [[nodiscard]] size_t drawnTriangles() const { return triangles; }
+
     [[nodiscard]] Camera &getCamera() { return camera; };
     [[nodiscard]] GLFWwindow *getWindow() const { return window; };
 
@@ -32,8 +52,26 @@ private:
     const char *title;
     GLFWwindow *window;
     Camera camera;
-    unsigned int VAO, VBO, EBO, instanceVBO;
-    size_t indexCount;
+    unsigned int VAO, VBO, EBO;
+
+    // the LOD meshes share VBO and EBO
+    struct lodMesh {
+        GLsizei indexCount = 0;
+        size_t firstIndex = 0;
+        GLint baseVertex = 0;
+    };
+    lodMesh lods[visibleSet::levels];
+    visibleSet visible;
+    size_t triangles = 0;
+    instanceRing instances;
+    instanceFormat format;
+
+    // GL_TIME_ELAPSED queries around the draw, read back a few frames later so they never stall
+    static constexpr unsigned int timerQueryCount = 4;
+    GLuint timerQueries[timerQueryCount] = {};
+    bool timerPending[timerQueryCount] = {};
+    std::uint64_t timerIssued[timerQueryCount] = {};
+    unsigned int timerFrame = 0;
 
     bool menuMode;
     bool firstMouse;
@@ -41,6 +79,10 @@ private:
     bool pausePressed;
     float lastX, lastY;
 
+    void setupInstanceAttributes();
+
+    void collectGpuTimers();
+
     static renderer *getRenderer(GLFWwindow *window);
 
     static void framebufferSizeCallback(GLFWwindow *window, int width, int height);
@@ -0,0 +1,233 @@
+#include "rewindBuffer.h"
+#include <algorithm>
+#include <cstring>
+#include "config.h"
+#include "profiler.h"
+#include "trajectory.h"
+
+static constexpr unsigned int maxQuantiseBits = 20;
+//bookkeeping per delta frame besides its encoded bytes
+static constexpr size_t frameOverhead = sizeof(size_t) + 2 * sizeof(double);
+
+static inline std::uint32_t floatBits(float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+void rewindBuffer::enable(const rewindOptions &requested) {
+    options = requested;
+    options.keyframeInterval = std::max(options.keyframeInterval, 1u);
+    options.quantiseBits = std::min(options.quantiseBits, maxQuantiseBits);
+    segments.clear();
+    heldBytes = 0;
+    decodedSegment = nullptr;
+    active = true;
+    publishStats();
+}
+
+void rewindBuffer::disable() {
+    active = false;
+    segments.clear();
+    heldBytes = 0;
+    decodedSegment = nullptr;
+    publishStats();
+}
+
+size_t rewindBuffer::keyframeBytes(const BodyStore &bodies) {
+    return (bodies.x.capacity() + bodies.y.capacity() + bodies.z.capacity() + bodies.vx.capacity() +
+            bodies.vy.capacity() + bodies.vz.capacity() + bodies.mass.capacity() + bodies.radius.capacity() +
+            bodies.ax.capacity() + bodies.ay.capacity() + bodies.az.capacity()) * sizeof(float) +
+           bodies.colour.capacity() * sizeof(glm::vec3) + bodies.timestepLevel.capacity();
+}
+
+void rewindBuffer::record(const BodyStore &bodies, double simulationTime, unsigned long long step,
+                          double deltaTime) {
+    if (!active) return;
+    PROFILE_SCOPE("rewind record");
+    const size_t n = bodies.size();
+    const std::vector<float> *columns[6] = {&bodies.x, &bodies.y, &bodies.z, &bodies.vx, &bodies.vy, &bodies.vz};
+    const unsigned int shift = options.quantiseBits;
+
+    bool startKeyframe = segments.empty() || segmentClosed;
+    if (!startKeyframe) {
+        const segment &newest = segments.back();
+        startKeyframe = newest.keyframe.size() != n || newest.keyframe.origin != bodies.origin ||
+                        step != newest.state.step + newest.frameEnd.size() + 1 ||
+                        newest.frameEnd.size() + 1 >= options.keyframeInterval;
+    }
+
+    if (startKeyframe) {
+        if (!segments.empty()) {
+            // the closed segment's deltas grew by doubling
+            segment &closed = segments.back();
+            heldBytes -= closed.deltas.capacity();
+            closed.deltas.shrink_to_fit();
+            heldBytes += closed.deltas.capacity();
+        }
+        segments.emplace_back();
+        segment &s = segments.back();
+        s.keyframe = bodies;
+        s.state = checkpointState::fromConfig(simulationTime, step);
+        heldBytes += keyframeBytes(s.keyframe);
+        for (int c = 0; c < 6; c++) {
+            last[c].resize(n);
+            for (size_t i = 0; i < n; i++) last[c][i] = floatBits((*columns[c])[i]) >> shift;
+            beforeLast[c] = last[c];
+        }
+        segmentClosed = false;
+    } else {
+        segment &s = segments.back();
+        // the first delta only has the keyframe to go on, later ones extrapolate linearly
+        const unsigned int order = s.frameEnd.empty() ? 1 : 2;
+        const size_t start = s.deltas.size();
+        const size_t previousCapacity = s.deltas.capacity();
+        s.deltas.resize(start + 6 * columnCodec::maxBytes(n));
+        size_t end = start;
+        for (int c = 0; c < 6; c++) {
+            end += columnCodec::encode(columns[c]->data(), last[c].data(), beforeLast[c].data(), n, shift, order,
+                                       s.deltas.data() + end);
+        }
+        s.deltas.resize(end);
+        s.frameEnd.push_back(end);
+        s.frameTime.push_back(simulationTime);
+        s.frameDeltaTime.push_back(deltaTime);
+        s.rawBytes += 6 * sizeof(float) * n;
+        heldBytes += s.deltas.capacity() - previousCapacity + frameOverhead;
+    }
+
+    evict();
+    publishStats();
+}
+
+// Whole segments go, oldest first. The newest one can't be dropped while it is still being
+// written, so once it alone is over budget it is closed and dropped on the next record.
+void rewindBuffer::evict() {
+    while (heldBytes > options.budgetBytes && segments.size() > 1) {
+        segment &oldest = segments.front();
+        heldBytes -= keyframeBytes(oldest.keyframe) + oldest.deltas.capacity() +
+                     oldest.frameEnd.size() * frameOverhead;
+        if (decodedSegment == &oldest) decodedSegment = nullptr;
+        segments.pop_front();
+    }
+    if (heldBytes > options.budgetBytes) segmentClosed = true;
+}
+
+const rewindBuffer::segment *rewindBuffer::find(unsigned long long step) const {
+    auto after = std::upper_bound(segments.begin(), segments.end(), step,
+                                  [](unsigned long long s, const segment &candidate) {
+                                      return s < candidate.state.step;
+                                  });
+    if (after == segments.begin()) return nullptr;
+    const segment &s = *(after - 1);
+    if (step > s.state.step + s.frameEnd.size()) return nullptr;
+    return &s;
+}
+
+bool rewindBuffer::frame(unsigned long long step, BodyStore &out, double &simulationTime) {
+    const segment *s = find(step);
+    if (!s) return false;
+    PROFILE_SCOPE("rewind decode");
+    out = s->keyframe;
+    out.accelerationsValid = false;
+    const auto frames = static_cast<size_t>(step - s->state.step);
+    if (frames == 0) {
+        simulationTime = s->state.simulationTime;
+        return true;
+    }
+
+    const size_t n = s->keyframe.size();
+    const unsigned int shift = options.quantiseBits;
+    std::vector<float> *columns[6] = {&out.x, &out.y, &out.z, &out.vx, &out.vy, &out.vz};
+    if (decodedSegment != s || decodedFrames > frames) {
+        for (int c = 0; c < 6; c++) {
+            decodeLast[c].resize(n);
+            for (size_t i = 0; i < n; i++) decodeLast[c][i] = floatBits((*columns[c])[i]) >> shift;
+            decodeBeforeLast[c] = decodeLast[c];
+        }
+        decodedSegment = s;
+        decodedFrames = 0;
+    }
+    decodeScratch.resize(n);
+    for (; decodedFrames < frames; decodedFrames++) {
+        const unsigned int order = decodedFrames == 0 ? 1 : 2;
+        const unsigned char *cursor = s->deltas.data() + (decodedFrames == 0 ? 0 : s->frameEnd[decodedFrames - 1]);
+        const unsigned char *end = s->deltas.data() + s->frameEnd[decodedFrames];
+        for (int c = 0; c < 6; c++) {
+            cursor += columnCodec::decode(cursor, end, decodeLast[c].data(), decodeBeforeLast[c].data(), n, shift,
+                                          order, decodeScratch.data());
+        }
+    }
+    // the decoder's last values are the frame's
+    for (int c = 0; c < 6; c++) {
+        float *values = columns[c]->data();
+        for (size_t i = 0; i < n; i++) {
+            const std::uint32_t bits = decodeLast[c][i] << shift;
+            std::memcpy(&values[i], &bits, sizeof(bits));
+        }
+    }
+    simulationTime = s->frameTime[frames - 1];
+    return true;
+}
+
+bool rewindBuffer::keyframe(unsigned long long step, BodyStore &out, checkpointState &state,
+                            std::vector<double> &deltaTimes) const {
+    const segment *s = find(step);
+    if (!s) return false;
+    out = s->keyframe;
+    state = s->state;
+    deltaTimes.assign(s->frameDeltaTime.begin(), s->frameDeltaTime.begin() + static_cast<long>(step - s->state.step));
+    return true;
+}
+
+void rewindBuffer::truncate(unsigned long long step) {
+    while (!segments.empty() && segments.back().state.step > step) {
+        const segment &newest = segments.back();
+        heldBytes -= keyframeBytes(newest.keyframe) + newest.deltas.capacity() +
+                     newest.frameEnd.size() * frameOverhead;
+        segments.pop_back();
+    }
+    if (!segments.empty()) {
+        segment &newest = segments.back();
+        const auto keep = static_cast<size_t>(std::min<unsigned long long>(step - newest.state.step,
+                                                                          newest.frameEnd.size()));
+        const size_t dropped = newest.frameEnd.size() - keep;
+        const size_t previousCapacity = newest.deltas.capacity();
+        newest.deltas.resize(keep == 0 ? 0 : newest.frameEnd[keep - 1]);
+        newest.deltas.shrink_to_fit();
+        newest.frameEnd.resize(keep);
+        newest.frameTime.resize(keep);
+        newest.frameDeltaTime.resize(keep);
+        newest.rawBytes = 6 * sizeof(float) * newest.keyframe.size() * keep;
+        heldBytes -= previousCapacity - newest.deltas.capacity() + dropped * frameOverhead;
+    }
+    decodedSegment = nullptr;
+    segmentClosed = true;
+    publishStats();
+}
+
+void rewindBuffer::publishStats() {
+    rewindStats s;
+    if (!segments.empty()) {
+        const segment &oldest = segments.front();
+        const segment &newest = segments.back();
+        s.firstStep = oldest.state.step;
+        s.firstTime = oldest.state.simulationTime;
+        s.lastStep = newest.state.step + newest.frameEnd.size();
+        s.lastTime = newest.frameTime.empty() ? newest.state.simulationTime : newest.frameTime.back();
+        s.keyframes = segments.size();
+        for (const segment &held: segments) {
+            s.deltas += held.frameEnd.size();
+            s.rawDeltaBytes += held.rawBytes;
+            s.deltaBytes += held.deltas.size();
+        }
+    }
+    s.bytes = heldBytes;
+    std::lock_guard<std::mutex> lock(statsMutex);
+    current = s;
+}
+
+rewindStats rewindBuffer::stats() const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return current;
+}
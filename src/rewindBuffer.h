@@ -0,0 +1,108 @@
+#ifndef N_BODY_SIMULATION_GL_REWINDBUFFER_H
+#define N_BODY_SIMULATION_GL_REWINDBUFFER_H
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "bodyStore.h"
+#include "checkpoint.h"
+
+struct rewindOptions {
+    size_t budgetBytes = size_t(256) << 20; //keyframes and deltas together
+    unsigned int keyframeInterval = 240; //steps between full copies, the most a seek re-simulates
+    unsigned int quantiseBits = 0; //low mantissa bits dropped from the deltas, 0 = lossless
+};
+
+struct rewindStats {
+    unsigned long long firstStep = 0;
+    unsigned long long lastStep = 0;
+    double firstTime = 0.0;
+    double lastTime = 0.0;
+    size_t keyframes = 0; //0 = nothing recorded
+    size_t deltas = 0;
+    size_t bytes = 0; //held in memory, keyframes included
+    size_t rawDeltaBytes = 0; //positions and velocities of the delta frames before encoding
+    size_t deltaBytes = 0;
+};
+
+// Bounded in-memory history of the recent past, kept by the simulation thread. Steps are
+// grouped into segments: a keyframe holding a full copy of the BodyStore and the settings of
+// that moment, then one delta frame per step with only the positions and velocities, encoded
+// by columnCodec against the steps before. A segment ends every keyframeInterval steps and
+// whenever the bodies changed other than by a step (a new body count, an origin shift, a
+// command). Past budgetBytes the oldest segments are dropped.
+// frame() decodes a step for display. To continue a run from the past, keyframe() hands out
+// the full state at or before the step and the caller re-simulates forward from there, so
+// the exact state is never stored for every step.
+class rewindBuffer {
+public:
+    // starts an empty history, replacing any kept so far
+    void enable(const rewindOptions &options);
+
+    void disable();
+
+    [[nodiscard]] bool enabled() const { return active; }
+
+    // called after every step, deltaTime is the one the step was taken with (before timeScale)
+    void record(const BodyStore &bodies, double simulationTime, unsigned long long step, double deltaTime);
+
+    // the next record starts a segment, for changes to the bodies that are not a step
+    void startSegment() { segmentClosed = true; }
+
+    // the state at `step` for display: positions and velocities decoded, every other column
+    // from the keyframe. False if the step is not held
+    bool frame(unsigned long long step, BodyStore &out, double &simulationTime);
+
+    // the keyframe at or before `step` with the clock and CONFIG settings it was taken with, and
+    // the deltaTime of each step from there up to `step`
+    bool keyframe(unsigned long long step, BodyStore &out, checkpointState &state,
+                  std::vector<double> &deltaTimes) const;
+
+    // forgets every step after `step`
+    void truncate(unsigned long long step);
+
+    // safe from any thread
+    [[nodiscard]] rewindStats stats() const;
+
+private:
+    struct segment {
+        BodyStore keyframe;
+        checkpointState state;
+        std::vector<unsigned char> deltas;
+        std::vector<size_t> frameEnd; //frame k is step state.step + k + 1
+        std::vector<double> frameTime;
+        std::vector<double> frameDeltaTime;
+        size_t rawBytes = 0;
+    };
+
+    rewindOptions options;
+    bool active = false;
+    bool segmentClosed = false;
+    std::deque<segment> segments;
+    size_t heldBytes = 0;
+
+    //encoder state of the newest segment
+    std::vector<std::uint32_t> last[6], beforeLast[6];
+
+    //decoder state, kept so scrubbing forward through a segment continues where it stopped
+    const segment *decodedSegment = nullptr;
+    size_t decodedFrames = 0;
+    std::vector<std::uint32_t> decodeLast[6], decodeBeforeLast[6];
+    std::vector<float> decodeScratch;
+
+    mutable std::mutex statsMutex;
+    rewindStats current;
+
+    // the segment holding `step`, or nullptr
+    [[nodiscard]] const segment *find(unsigned long long step) const;
+
+    void evict();
+
+    void publishStats();
+
+    static size_t keyframeBytes(const BodyStore &bodies);
+};
+
+
+#endif //N_BODY_SIMULATION_GL_REWINDBUFFER_H
@@ -0,0 +1,225 @@
+#include "simulation.h"
+#include <chrono>
+#include <memory>
+#include "physicsEngine.h"
+#include "config.h"
+#include "profiler.h"
+
+simulation::~simulation() {
+    stop();
+}
+
+void simulation::start() {
+    if (running.exchange(true)) return;
+    worker = std::thread(&simulation::run, this);
+}
+
+void simulation::stop() {
+    if (!running.exchange(false)) return;
+    worker.join();
+    trajectory.close();
+    // commands left over would never run; dropping them breaks any pending checkpoint promise
+    std::lock_guard<std::mutex> lock(commandMutex);
+    commands.clear();
+    hasCommands.store(false, std::memory_order_relaxed);
+}
+
+void simulation::post(command c) {
+    std::lock_guard<std::mutex> lock(commandMutex);
+    commands.push_back(std::move(c));
+    hasCommands.store(true, std::memory_order_release);
+}
+
+std::future<bool> simulation::saveCheckpoint(const std::string &path) {
+    using capture = std::pair<BodyStore, checkpointState>;
+    auto copied = std::make_shared<std::promise<capture>>();
+    std::future<capture> captured = copied->get_future();
+    if (running.load(std::memory_order_relaxed)) {
+        post([this, copied](BodyStore &current) {
+            copied->set_value({current, checkpointState::fromConfig(simulationTime, step)});
+        });
+    } else {
+        copied->set_value({bodies, checkpointState::fromConfig(simulationTime, step)});
+    }
+    return std::async(std::launch::async, [path, captured = std::move(captured)]() mutable {
+        try {
+            const capture state = captured.get();
+            return checkpoint::save(path, state.first, state.second);
+        } catch (const std::future_error &) {
+            return false; //stopped before the copy was taken
+        }
+    });
+}
+
+void simulation::restore(BodyStore restored, const checkpointState &state) {
+    auto pending = std::make_shared<BodyStore>(std::move(restored));
+    post([this, pending, state](BodyStore &current) {
+        state.applyToConfig();
+        current = std::move(*pending);
+        simulationTime = state.simulationTime;
+        step = state.step;
+    });
+}
+
+void simulation::startRecording(const std::string &path, const trajectoryOptions &options) {
+    post([this, path, options](BodyStore &) {
+        trajectory.open(path, options);
+    });
+}
+
+void simulation::stopRecording() {
+    post([this](BodyStore &) {
+        trajectory.close();
+    });
+}
+
+void simulation::startRewind(const rewindOptions &options) {
+    post([this, options](BodyStore &) {
+        rewind.enable(options);
+    });
+}
+
+void simulation::stopRewind() {
+    post([this](BodyStore &) {
+        rewind.disable();
+        previewing = false;
+    });
+}
+
+void simulation::preview(unsigned long long requested) {
+    post([this, requested](BodyStore &) {
+        if (rewind.frame(requested, previewBodies, previewTime)) {
+            previewStep = requested;
+            previewing = true;
+        }
+    });
+}
+
+void simulation::endPreview() {
+    post([this](BodyStore &) {
+        previewing = false;
+    });
+}
+
+std::future<checkpointState> simulation::seek(unsigned long long requested) {
+    auto result = std::make_shared<std::promise<checkpointState>>();
+    std::future<checkpointState> resumed = result->get_future();
+    post([this, requested, result](BodyStore &current) {
+        checkpointState state;
+        std::vector<double> deltaTimes;
+        previewing = false;
+        if (rewind.keyframe(requested, current, state, deltaTimes)) {
+            PROFILE_SCOPE("rewind seek");
+            state.applyToConfig();
+            simulationTime = state.simulationTime;
+            step = state.step;
+            // the steps as they were taken, which the adaptive step varies
+            for (double deltaTime: deltaTimes) {
+                physicsEngine::update(current, deltaTime);
+                simulationTime += deltaTime * CONFIG.timeScale;
+                step++;
+            }
+            rewind.truncate(requested);
+            adaptive = CONFIG.adaptiveTimestep;
+            controller.reset(deltaTimes.empty() ? CONFIG.fixedTimeStep : deltaTimes.back());
+        }
+        result->set_value(checkpointState::fromConfig(simulationTime, step));
+    });
+    return resumed;
+}
+
+void simulation::runCommands() {
+    PROFILE_SCOPE("commands");
+    std::vector<command> pending;
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        pending.swap(commands);
+        hasCommands.store(false, std::memory_order_relaxed);
+    }
+    for (auto &c: pending) {
+        c(bodies);
+    }
+    // commands may have changed the bodies in ways a delta frame can't hold, or their energy
+    rewind.startSegment();
+    controller.rebaseline();
+}
+
+void simulation::publish() {
+    PROFILE_SCOPE("publish snapshot");
+    simulationSnapshot &snapshot = snapshots.back();
+    if (previewing) {
+        snapshot.bodies = previewBodies;
+        snapshot.simulationTime = previewTime;
+        snapshot.step = previewStep;
+    } else {
+        snapshot.bodies = bodies;
+        snapshot.simulationTime = simulationTime;
+        snapshot.step = step;
+    }
+    snapshots.publish();
+}
+
+void simulation::run() {
+    profiler::getInstance().nameThread("simulation");
+    using clock = std::chrono::steady_clock;
+    auto previous = clock::now();
+    auto rateWindowStart = previous;
+    unsigned long long rateWindowSteps = 0;
+    double accumulator = 0.0;
+
+    while (running.load(std::memory_order_relaxed)) {
+        if (hasCommands.load(std::memory_order_acquire)) {
+            runCommands();
+            publish();
+        }
+
+        const auto now = clock::now();
+        const double elapsed = std::chrono::duration<double>(now - previous).count();
+        previous = now;
+        if (std::chrono::duration<double>(now - rateWindowStart).count() >= 1.0) {
+            stepRate.store(static_cast<double>(rateWindowSteps) /
+                           std::chrono::duration<double>(now - rateWindowStart).count(), std::memory_order_relaxed);
+            rateWindowStart = now;
+            rateWindowSteps = 0;
+        }
+
+        if (CONFIG.paused) {
+            accumulator = 0.0;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        previewing = false;
+        if (CONFIG.adaptiveTimestep != adaptive) {
+            adaptive = CONFIG.adaptiveTimestep;
+            controller.reset(CONFIG.fixedTimeStep);
+        }
+        // the accumulator is in unscaled seconds like the step, so timeScale keeps setting the pace
+        // while the adaptive step only changes how finely it is resolved
+        double stepDuration = adaptive ? controller.deltaTime() : CONFIG.fixedTimeStep;
+        accumulator += elapsed;
+        unsigned int steps = 0;
+        while (accumulator >= stepDuration && steps < CONFIG.maxCatchUpSteps) {
+            physicsEngine::update(bodies, stepDuration);
+            simulationTime += stepDuration * CONFIG.timeScale;
+            step++;
+            steps++;
+            trajectory.submit(bodies, simulationTime, step);
+            rewind.record(bodies, simulationTime, step, stepDuration);
+            accumulator -= stepDuration;
+            if (adaptive) {
+                controller.stepTaken(bodies);
+                stepDuration = controller.deltaTime();
+            }
+        }
+        rateWindowSteps += steps;
+
+        if (steps > 0) {
+            // too slow to keep up with real time: drop the backlog rather than spiral
+            if (steps == CONFIG.maxCatchUpSteps) accumulator = 0.0;
+            publish();
+        } else {
+            std::this_thread::sleep_for(std::chrono::duration<double>(stepDuration - accumulator));
+        }
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef N_BODY_SIMULATION_GL_SIMULATION_H
+#define N_BODY_SIMULATION_GL_SIMULATION_H
+#include <atomic>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bodyStore.h"
+#include "checkpoint.h"
+#include "rewindBuffer.h"
+#include "timestepController.h"
+#include "trajectory.h"
+#include "tripleBuffer.h"
+
+// State handed from the simulation thread to the renderer
+struct simulationSnapshot {
+    BodyStore bodies;
+    double simulationTime = 0.0;
+    unsigned long long step = 0;
+};
+
+// Runs physicsEngine on its own thread at a fixed timestep (CONFIG.fixedTimeStep) and
+// publishes every completed state through a triple buffer, so rendering and physics each
+// run at their own rate. Anything that touches the bodies or CONFIG while the thread is
+// running goes through post() and runs on the simulation thread between steps.
+class simulation {
+public:
+    using command = std::function<void(BodyStore &bodies)>;
+
+    simulation() = default;
+
+    ~simulation();
+
+    simulation(const simulation &) = delete;
+
+    simulation &operator=(const simulation &) = delete;
+
+    void start();
+
+    void stop();
+
+    void post(command c);
+
+    // copies the state between steps on the simulation thread and writes it on a background
+    // thread, so neither the physics nor the render loop waits for the disk
+    std::future<bool> saveCheckpoint(const std::string &path);
+
+    // replaces the bodies, clock and CONFIG settings before the next step
+    void restore(BodyStore restored, const checkpointState &state);
+
+    // records every options.interval-th step from the simulation thread until stopRecording
+    void startRecording(const std::string &path, const trajectoryOptions &options);
+
+    void stopRecording();
+
+    [[nodiscard]] trajectoryStats recordingStats() const { return trajectory.stats(); }
+
+    // keeps the recent past in memory from the next step on, replacing any history kept so far
+    void startRewind(const rewindOptions &options);
+
+    void stopRewind();
+
+    [[nodiscard]] rewindStats rewindState() const { return rewind.stats(); }
+
+    // publishes the recorded state of `step` instead of the live one until the run steps
+    // again or endPreview; pause first, or the next step ends the preview straight away
+    void preview(unsigned long long step);
+
+    void endPreview();
+
+    // continues the run from a recorded step: the keyframe at or before it, re-simulated up to
+    // it under the settings it was recorded with. Everything recorded after the step is
+    // dropped. The future yields the clock and settings the run goes on with.
+    std::future<checkpointState> seek(unsigned long long step);
+
+    // the adaptive step and the drift it is chosen from, while CONFIG.adaptiveTimestep is on
+    [[nodiscard]] timestepStats timestepState() const { return controller.stats(); }
+
+    // render thread: picks up the newest published state, true if it changed
+    bool acquireLatest() { return snapshots.acquire(); }
+
+    [[nodiscard]] const simulationSnapshot &latest() const { return snapshots.front(); }
+
+    [[nodiscard]] double getStepRate() const { return stepRate.load(std::memory_order_relaxed); }
+
+private:
+    void run();
+
+    void runCommands();
+
+    void publish();
+
+    BodyStore bodies;
+    double simulationTime = 0.0;
+    unsigned long long step = 0;
+
+    trajectoryWriter trajectory;
+    rewindBuffer rewind;
+    timestepController controller;
+    bool adaptive = false;
+    bool previewing = false;
+    BodyStore previewBodies;
+    double previewTime = 0.0;
+    unsigned long long previewStep = 0;
+    tripleBuffer<simulationSnapshot> snapshots;
+    std::thread worker;
+    std::atomic<bool> running{false};
+    std::atomic<double> stepRate{0.0};
+
+    std::mutex commandMutex;
+    std::vector<command> commands;
+    std::atomic<bool> hasCommands{false};
+};
+
+
+#endif //N_BODY_SIMULATION_GL_SIMULATION_H
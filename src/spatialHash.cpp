@@ -0,0 +1,221 @@
+#include "spatialHash.h"
+#include <algorithm>
+#include <cmath>
+
+// keeps runaway or non-finite coordinates from overflowing the integer cell index
+static int cellCoordinate(float position, float inverseCellSize) {
+    const float cell = std::floor(position * inverseCellSize);
+    if (!(cell > -1e9f)) return -1000000000;
+    if (!(cell < 1e9f)) return 1000000000;
+    return static_cast<int>(cell);
+}
+
+// LSD radix sort over the bits an index below `limit` can have, several times faster than
+// std::sort on lists of a few hundred; short lists go to std::sort
+static void sortIndices(std::vector<unsigned int>::iterator first, std::vector<unsigned int>::iterator last,
+                        size_t limit) {
+    const auto n = static_cast<size_t>(last - first);
+    if (n < 64) {
+        std::sort(first, last);
+        return;
+    }
+    thread_local std::vector<unsigned int> scratch;
+    scratch.resize(n);
+    unsigned int *from = &*first, *to = scratch.data();
+    unsigned int passes = 0;
+    for (unsigned int shift = 0; shift < 32 && (limit >> shift) != 0; shift += 8) {
+        size_t count[257] = {};
+        for (size_t k = 0; k < n; k++) count[((from[k] >> shift) & 255u) + 1]++;
+        for (unsigned int d = 0; d < 256; d++) count[d + 1] += count[d];
+        for (size_t k = 0; k < n; k++) to[count[(from[k] >> shift) & 255u]++] = from[k];
+        std::swap(from, to);
+        passes++;
+    }
+    if (passes % 2 != 0) std::copy_n(from, n, &*first);
+}
+
+size_t spatialHash::hash(int x, int y, int z) const {
+    const auto h = static_cast<unsigned int>(x) * 73856093u ^
+                   static_cast<unsigned int>(y) * 19349663u ^
+                   static_cast<unsigned int>(z) * 83492791u;
+    return h & tableMask;
+}
+
+void spatialHash::build(const BodyStore &bodies, float maxRegularRadius) {
+    bodyCount = bodies.size();
+    regularRadius = maxRegularRadius;
+    rebuilt = false;
+    inverseCellSize = 1.0f / (2.0f * maxRegularRadius);
+
+    size_t tableSize = 64;
+    while (tableSize < 2 * bodyCount) tableSize <<= 1;
+    tableMask = tableSize - 1;
+
+    cellX.resize(bodyCount);
+    cellY.resize(bodyCount);
+    cellZ.resize(bodyCount);
+    bucket.resize(bodyCount);
+    oversized.clear();
+    cellStart.assign(tableSize + 1, 0);
+    movedHead.assign(tableSize, notInGrid);
+    movedNext.resize(bodyCount);
+    movedPrevious.resize(bodyCount);
+    movedBucket.assign(bodyCount, notInGrid);
+    movedCount = 0;
+
+    for (size_t i = 0; i < bodyCount; i++) {
+        if (bodies.radius[i] > maxRegularRadius) {
+            bucket[i] = notInGrid;
+            oversized.push_back(static_cast<unsigned int>(i));
+            continue;
+        }
+        cellX[i] = cellCoordinate(bodies.x[i], inverseCellSize);
+        cellY[i] = cellCoordinate(bodies.y[i], inverseCellSize);
+        cellZ[i] = cellCoordinate(bodies.z[i], inverseCellSize);
+        bucket[i] = static_cast<unsigned int>(hash(cellX[i], cellY[i], cellZ[i]));
+        cellStart[bucket[i] + 1]++;
+    }
+    for (size_t b = 0; b < tableSize; b++) {
+        cellStart[b + 1] += cellStart[b];
+    }
+
+    // bodies are visited in index order, so every bucket lists its bodies ascending
+    entries.resize(cellStart[tableSize]);
+    cursor.assign(cellStart.begin(), cellStart.end() - 1);
+    for (size_t i = 0; i < bodyCount; i++) {
+        if (bucket[i] == notInGrid) continue;
+        entries[cursor[bucket[i]]++] = static_cast<unsigned int>(i);
+    }
+}
+
+// The body's entry from the build stays where it was and is skipped from then on.
+bool spatialHash::moved(const BodyStore &bodies, size_t i) {
+    if (bucket[i] == notInGrid) return false;
+    const int x = cellCoordinate(bodies.x[i], inverseCellSize);
+    const int y = cellCoordinate(bodies.y[i], inverseCellSize);
+    const int z = cellCoordinate(bodies.z[i], inverseCellSize);
+    if (x == cellX[i] && y == cellY[i] && z == cellZ[i]) return false;
+    cellX[i] = x;
+    cellY[i] = y;
+    cellZ[i] = z;
+
+    const auto body = static_cast<unsigned int>(i);
+    if (movedBucket[i] == notInGrid) {
+        movedCount++;
+    } else {
+        // unlinked from the cell it was re-binned to before
+        if (movedPrevious[i] == notInGrid) movedHead[movedBucket[i]] = movedNext[i];
+        else movedNext[movedPrevious[i]] = movedNext[i];
+        if (movedNext[i] != notInGrid) movedPrevious[movedNext[i]] = movedPrevious[i];
+    }
+    const auto b = static_cast<unsigned int>(hash(x, y, z));
+    movedBucket[i] = b;
+    movedPrevious[i] = notInGrid;
+    movedNext[i] = movedHead[b];
+    if (movedHead[b] != notInGrid) movedPrevious[movedHead[b]] = body;
+    movedHead[b] = body;
+    return true;
+}
+
+bool spatialHash::moved(const BodyStore &bodies, size_t i, std::vector<unsigned int> &out, size_t next,
+                        size_t after) {
+    const int previousX = cellX[i], previousY = cellY[i], previousZ = cellZ[i];
+    const bool left = moved(bodies, i);
+    if (left) {
+        out.erase(out.begin(), out.begin() + static_cast<long>(next));
+        const size_t pending = out.size();
+        for (int dz = -1; dz <= 1; dz++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    const int x = cellX[i] + dx, y = cellY[i] + dy, z = cellZ[i] + dz;
+                    // the neighbours of the cell it left are listed already
+                    if (std::abs(x - previousX) <= 1 && std::abs(y - previousY) <= 1 &&
+                        std::abs(z - previousZ) <= 1) {
+                        continue;
+                    }
+                    appendBucket(hash(x, y, z), after, out);
+                }
+            }
+        }
+        if (out.size() > pending) {
+            sortIndices(out.begin() + static_cast<long>(pending), out.end(), bodyCount);
+            std::inplace_merge(out.begin(), out.begin() + static_cast<long>(pending), out.end());
+            out.erase(std::unique(out.begin(), out.end()), out.end());
+        }
+    }
+    // The side table is walked in full on every query, past a sixteenth of the bodies binning
+    // afresh is cheaper. Only here, once i's list covers where it is now: the other bodies
+    // still to visit have not moved since it was taken.
+    if (movedCount > bodyCount / 16) {
+        build(bodies, regularRadius);
+        rebuilt = true;
+    }
+    return left;
+}
+
+void spatialHash::candidates(size_t i, std::vector<unsigned int> &out) const {
+    out.clear();
+    if (bucket[i] == notInGrid) {
+        for (size_t j = i + 1; j < bodyCount; j++) {
+            out.push_back(static_cast<unsigned int>(j));
+        }
+        return;
+    }
+
+    for (unsigned int j: oversized) {
+        if (j > i) out.push_back(j);
+    }
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                appendBucket(hash(cellX[i] + dx, cellY[i] + dy, cellZ[i] + dz), i, out);
+            }
+        }
+    }
+    // distinct cells can share a bucket, which would list the same body twice
+    sortIndices(out.begin(), out.end(), bodyCount);
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void spatialHash::refresh(size_t i, std::vector<unsigned int> &out) const {
+    if (bucket[i] == notInGrid || (movedCount == 0 && !rebuilt)) return;
+    // a body that left its cell has different neighbours altogether, and after a rebuild the
+    // side table no longer holds everything that moved
+    if (rebuilt || movedBucket[i] != notInGrid) {
+        candidates(i, out);
+        return;
+    }
+    const size_t listed = out.size();
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                appendMoved(hash(cellX[i] + dx, cellY[i] + dy, cellZ[i] + dz), i, out);
+            }
+        }
+    }
+    if (out.size() == listed) return;
+    sortIndices(out.begin() + static_cast<long>(listed), out.end(), bodyCount);
+    std::inplace_merge(out.begin(), out.begin() + static_cast<long>(listed), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void spatialHash::appendBucket(size_t b, size_t after, std::vector<unsigned int> &out) const {
+    // buckets are ascending, skip straight past everything up to `after`
+    const auto end = entries.begin() + cellStart[b + 1];
+    auto from = std::upper_bound(entries.begin() + cellStart[b], end, static_cast<unsigned int>(after));
+    if (movedCount == 0) {
+        out.insert(out.end(), from, end);
+        return;
+    }
+    // bodies re-binned since are listed where they are now instead
+    for (; from != end; ++from) {
+        if (movedBucket[*from] == notInGrid) out.push_back(*from);
+    }
+    appendMoved(b, after, out);
+}
+
+void spatialHash::appendMoved(size_t b, size_t after, std::vector<unsigned int> &out) const {
+    for (unsigned int j = movedHead[b]; j != notInGrid; j = movedNext[j]) {
+        if (j > after) out.push_back(j);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef N_BODY_SIMULATION_GL_SPATIALHASH_H
+#define N_BODY_SIMULATION_GL_SPATIALHASH_H
+#include <vector>
+#include "bodyStore.h"
+
+// Uniform grid broad phase for collisions, stored as a hash table of cells. With cells of
+// twice the largest regular radius two touching regular bodies always sit in neighbouring
+// cells. Bodies larger than that ("oversized", e.g. the sun) stay out of the grid and are
+// paired with everything instead. A body a contact pushes out of its cell mid-pass is re-binned
+// by moved() into a side table of the pass, so the pairs stay those the exhaustive loop would
+// find touching; once a sixteenth of the bodies sit in it the whole grid is binned again.
+class spatialHash {
+public:
+    void build(const BodyStore &bodies, float maxRegularRadius);
+
+    // every j > i that may touch body i, ascending and without duplicates
+    void candidates(size_t i, std::vector<unsigned int> &out) const;
+
+    // call after body i moved; true if it left its cell and now has other neighbours
+    bool moved(const BodyStore &bodies, size_t i);
+
+    // moved() for the body whose candidates are being walked, after the other body of the
+    // contact. out[next..] are the ones still to visit, all past `after`; if i left its cell
+    // they move to the front and gain the bodies past `after` around the cell it moved into
+    bool moved(const BodyStore &bodies, size_t i, std::vector<unsigned int> &out, size_t next, size_t after);
+
+    // brings candidates(i) taken right after build() up to date with the bodies re-binned since
+    void refresh(size_t i, std::vector<unsigned int> &out) const;
+
+private:
+    static constexpr unsigned int notInGrid = ~0u;
+
+    float regularRadius = 0.0f;
+    float inverseCellSize = 0.0f;
+    size_t tableMask = 0;
+    size_t bodyCount = 0;
+    std::vector<int> cellX, cellY, cellZ;
+    std::vector<unsigned int> bucket;
+    std::vector<unsigned int> cellStart;
+    std::vector<unsigned int> entries;
+    std::vector<unsigned int> cursor;
+    std::vector<unsigned int> oversized;
+    //bodies re-binned since the build, a list per bucket linked through the bodies
+    std::vector<unsigned int> movedHead;
+    std::vector<unsigned int> movedNext;
+    std::vector<unsigned int> movedPrevious;
+    std::vector<unsigned int> movedBucket;
+    size_t movedCount = 0;
+    bool rebuilt = false; //binned again mid-pass once the side table grew long
+
+    [[nodiscard]] size_t hash(int x, int y, int z) const;
+
+    // appends the j > after in bucket b
+    void appendBucket(size_t b, size_t after, std::vector<unsigned int> &out) const;
+
+    // appends the re-binned j > after in bucket b
+    void appendMoved(size_t b, size_t after, std::vector<unsigned int> &out) const;
+};
+
+
+#endif //N_BODY_SIMULATION_GL_SPATIALHASH_H
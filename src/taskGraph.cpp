@@ -0,0 +1,85 @@
+#include "taskGraph.h"
+#include <thread>
+
+taskGraph::taskId taskGraph::add(task work) {
+    tasks.push_back({std::move(work), {}, 0});
+    return static_cast<taskId>(tasks.size() - 1);
+}
+
+void taskGraph::precede(taskId before, taskId after) {
+    tasks[before].successors.push_back(after);
+    tasks[after].dependencies++;
+}
+
+void taskGraph::clear() {
+    tasks.clear();
+}
+
+void taskGraph::push(unsigned int thread, taskId id) {
+    workQueue &queue = queues[thread];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.ready.push_back(id);
+}
+
+// newest from the own queue, otherwise the oldest from the next queue that has one
+bool taskGraph::pop(unsigned int thread, taskId &id) {
+    {
+        workQueue &own = queues[thread];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.ready.empty()) {
+            id = own.ready.back();
+            own.ready.pop_back();
+            return true;
+        }
+    }
+    for (unsigned int offset = 1; offset < queueCount; offset++) {
+        workQueue &victim = queues[(thread + offset) % queueCount];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.ready.empty()) {
+            id = victim.ready.front();
+            victim.ready.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void taskGraph::work(unsigned int thread) {
+    while (unfinished.load(std::memory_order_acquire) > 0) {
+        taskId id;
+        if (!pop(thread, id)) {
+            // everything left is running elsewhere or waits for it
+            std::this_thread::yield();
+            continue;
+        }
+        node &n = tasks[id];
+        n.work(thread);
+        for (taskId successor: n.successors) {
+            if (remaining[successor].fetch_sub(1, std::memory_order_acq_rel) == 1) push(thread, successor);
+        }
+        unfinished.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+void taskGraph::run(threadPool &pool) {
+    if (tasks.empty()) return;
+    if (remainingCapacity < tasks.size()) {
+        remaining = std::make_unique<std::atomic<unsigned int>[]>(tasks.size());
+        remainingCapacity = tasks.size();
+    }
+    if (queueCount != pool.size()) {
+        queueCount = pool.size();
+        queues = std::make_unique<workQueue[]>(queueCount);
+    }
+    unsigned int next = 0;
+    for (taskId id = 0; id < tasks.size(); id++) {
+        remaining[id].store(tasks[id].dependencies, std::memory_order_relaxed);
+        // the roots are dealt round robin so every thread starts with work
+        if (tasks[id].dependencies == 0) push(next++ % queueCount, id);
+    }
+    unfinished.store(tasks.size(), std::memory_order_release);
+    // one chunk per thread; a thread that comes back for another finds the graph done
+    pool.parallelFor(queueCount, 1, [&](size_t, size_t, unsigned int thread) {
+        work(thread);
+    });
+}
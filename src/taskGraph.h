@@ -0,0 +1,62 @@
+#ifndef N_BODY_SIMULATION_GL_TASKGRAPH_H
+#define N_BODY_SIMULATION_GL_TASKGRAPH_H
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "threadPool.h"
+
+// Tasks with dependencies, run on the threadPool threads by work stealing. Every thread keeps
+// its own queue: a finished task pushes the successors it made ready onto its own queue and
+// the thread continues with the newest of them (the data it just wrote is still in its
+// cache), while a thread with nothing left steals the oldest task of another. A task starts
+// as soon as the tasks it depends on are done, so independent passes overlap instead of
+// waiting for each other at the end of a parallelFor.
+class taskGraph {
+public:
+    using task = std::function<void(unsigned int thread)>;
+    using taskId = unsigned int;
+
+    taskId add(task work);
+
+    // `after` waits until `before` is done
+    void precede(taskId before, taskId after);
+
+    // Runs every task once and returns when all are done. The graph can be run again, or
+    // cleared and rebuilt. Tasks must not call parallelFor themselves.
+    void run(threadPool &pool);
+
+    void clear();
+
+    [[nodiscard]] size_t size() const { return tasks.size(); }
+
+private:
+    struct node {
+        task work;
+        std::vector<taskId> successors;
+        unsigned int dependencies = 0;
+    };
+
+    struct alignas(64) workQueue {
+        std::mutex mutex;
+        std::deque<taskId> ready;
+    };
+
+    std::vector<node> tasks;
+    std::unique_ptr<std::atomic<unsigned int>[]> remaining;
+    size_t remainingCapacity = 0;
+    std::unique_ptr<workQueue[]> queues;
+    unsigned int queueCount = 0;
+    std::atomic<size_t> unfinished{0};
+
+    void push(unsigned int thread, taskId id);
+
+    bool pop(unsigned int thread, taskId &id);
+
+    void work(unsigned int thread);
+};
+
+
+#endif //N_BODY_SIMULATION_GL_TASKGRAPH_H
@@ -0,0 +1,83 @@
+#include "threadPool.h"
+#include <algorithm>
+
+threadPool::~threadPool() {
+    stop();
+}
+
+void threadPool::resize(unsigned int threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (threadCount == size()) return;
+
+    std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+    stop();
+    stopping = false;
+    for (unsigned int i = 1; i < threadCount; i++) {
+        workers.emplace_back(&threadPool::workerLoop, this, i, generation);
+    }
+}
+
+void threadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker: workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void threadPool::parallelFor(size_t count, size_t grain, const rangeTask &task) {
+    if (count == 0) return;
+    grain = std::max<size_t>(1, grain);
+    std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+    if (workers.empty() || count <= grain) {
+        task(0, count, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->task = &task;
+        this->count = count;
+        this->grain = grain;
+        next.store(0, std::memory_order_relaxed);
+        busy = static_cast<unsigned int>(workers.size());
+        generation++;
+    }
+    wake.notify_all();
+    runChunks(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return busy == 0; });
+    this->task = nullptr;
+}
+
+// `seen` starts at the generation current when the worker was spawned so it never picks up a finished job
+void threadPool::workerLoop(unsigned int index, unsigned long long seen) {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        runChunks(index);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0) done.notify_one();
+        }
+    }
+}
+
+void threadPool::runChunks(unsigned int index) {
+    for (;;) {
+        const size_t begin = next.fetch_add(grain, std::memory_order_relaxed);
+        if (begin >= count) return;
+        (*task)(begin, std::min(begin + grain, count), index);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef N_BODY_SIMULATION_GL_THREADPOOL_H
+#define N_BODY_SIMULATION_GL_THREADPOOL_H
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker pool shared by the physics passes. The calling thread takes part in
+// every parallelFor as thread 0, so a pool of size 1 runs everything inline.
+class threadPool {
+public:
+    using rangeTask = std::function<void(size_t begin, size_t end, unsigned int thread)>;
+
+    // Singleton access
+    static threadPool &getInstance() {
+        static threadPool instance;
+        return instance;
+    }
+
+    threadPool(const threadPool &) = delete;
+
+    threadPool &operator=(const threadPool &) = delete;
+
+    ~threadPool();
+
+    // total thread count including the caller, 0 = one per hardware thread
+    void resize(unsigned int threadCount);
+
+    [[nodiscard]] unsigned int size() const { return static_cast<unsigned int>(workers.size()) + 1; }
+
+    // Splits [0, count) into chunks of `grain` handed out dynamically and blocks until all
+    // have run. Not reentrant: tasks must not call parallelFor themselves.
+    void parallelFor(size_t count, size_t grain, const rangeTask &task);
+
+private:
+    threadPool() = default;
+
+    void workerLoop(unsigned int index, unsigned long long seen);
+
+    void runChunks(unsigned int index);
+
+    void stop();
+
+    std::vector<std::thread> workers;
+    std::mutex dispatchMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const rangeTask *task = nullptr;
+    size_t count = 0;
+    size_t grain = 1;
+    std::atomic<size_t> next{0};
+    unsigned int busy = 0;
+    unsigned long long generation = 0;
+    bool stopping = false;
+};
+
+
+#endif //N_BODY_SIMULATION_GL_THREADPOOL_H
@@ -0,0 +1,70 @@
+#include "timestepController.h"
+#include <algorithm>
+#include <cmath>
+#include "config.h"
+#include "glm/geometric.hpp"
+
+static constexpr double safety = 0.9;
+static constexpr double maxShrink = 0.5;
+static constexpr double maxGrowth = 1.5;
+
+void timestepController::reset(double deltaTime) {
+    step = std::clamp(deltaTime, static_cast<double>(CONFIG.minTimeStep), static_cast<double>(CONFIG.maxTimeStep));
+    sinceCheck = 0;
+    baselineValid = false;
+    std::lock_guard<std::mutex> lock(statsMutex);
+    current = timestepStats();
+    current.deltaTime = step;
+}
+
+double timestepController::errorOrder() {
+    if (CONFIG.blockTimesteps) return 2.0;
+    switch (CONFIG.integrator) {
+        case integratorType::semiImplicitEuler:
+            return 1.0;
+        case integratorType::yoshida4:
+            return 4.0;
+        default:
+            return 2.0;
+    }
+}
+
+void timestepController::stepTaken(const BodyStore &bodies) {
+    if (++sinceCheck < std::max(CONFIG.diagnosticInterval, 1u)) return;
+    sinceCheck = 0;
+    const conservationSample sample = physicsEngine::conservation(bodies);
+
+    // merges remove bodies and take energy with them
+    if (!baselineValid || sample.bodies != previous.bodies) {
+        baseline = sample;
+        previous = sample;
+        baselineValid = true;
+        return;
+    }
+
+    const double reference = std::abs(previous.energy());
+    const double error = reference > 0.0 ? std::abs(sample.energy() - previous.energy()) / reference : 0.0;
+    double factor = maxGrowth;
+    if (error > 0.0) {
+        factor = safety * std::pow(static_cast<double>(CONFIG.energyTolerance) / error, 1.0 / errorOrder());
+    }
+    step = std::clamp(step * std::clamp(factor, maxShrink, maxGrowth), static_cast<double>(CONFIG.minTimeStep),
+                      static_cast<double>(CONFIG.maxTimeStep));
+    previous = sample;
+
+    timestepStats s;
+    s.deltaTime = step;
+    const double baselineEnergy = std::abs(baseline.energy());
+    s.energyDrift = baselineEnergy > 0.0 ? (sample.energy() - baseline.energy()) / baselineEnergy : 0.0;
+    s.checkError = error;
+    const double momentumScale = std::max(baseline.momentumScale, sample.momentumScale);
+    s.momentumDrift = momentumScale > 0.0 ? glm::length(sample.momentum - baseline.momentum) / momentumScale : 0.0;
+    std::lock_guard<std::mutex> lock(statsMutex);
+    s.checks = current.checks + 1;
+    current = s;
+}
+
+timestepStats timestepController::stats() const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return current;
+}
@@ -0,0 +1,53 @@
+#ifndef N_BODY_SIMULATION_GL_TIMESTEPCONTROLLER_H
+#define N_BODY_SIMULATION_GL_TIMESTEPCONTROLLER_H
+#include <mutex>
+#include "bodyStore.h"
+#include "physicsEngine.h"
+
+struct timestepStats {
+    double deltaTime = 0.0; //the step in use, before timeScale
+    double energyDrift = 0.0; //(E - E0) / |E0| since the baseline
+    double checkError = 0.0; //|E - E'| / |E'| over the last check interval
+    double momentumDrift = 0.0; //|P - P0| / sum of m |v|
+    unsigned long long checks = 0;
+};
+
+// Picks the global step from the conservation diagnostics. Every CONFIG.diagnosticInterval
+// steps it measures the total energy and momentum; the relative energy change e since the
+// previous check scales as dt^p for an integrator of order p, so the next step is
+// dt * 0.9 * (energyTolerance / e)^(1/p), by at most half or one and a half times per check,
+// within [minTimeStep, maxTimeStep]. An interval over the tolerance is not repeated, the
+// smaller step applies from the next one on. Momentum drift is only reported: with every
+// solver but Barnes-Hut and FMM it stays at rounding level whatever the step.
+class timestepController {
+public:
+    // starts over at deltaTime, the next check becomes the baseline
+    void reset(double deltaTime);
+
+    // the next check becomes the baseline, for changes to the bodies that are not a step
+    void rebaseline() { baselineValid = false; }
+
+    [[nodiscard]] double deltaTime() const { return step; }
+
+    // called after every step taken with deltaTime()
+    void stepTaken(const BodyStore &bodies);
+
+    // safe from any thread
+    [[nodiscard]] timestepStats stats() const;
+
+private:
+    double step = 0.0;
+    unsigned int sinceCheck = 0;
+    bool baselineValid = false;
+    conservationSample baseline;
+    conservationSample previous;
+
+    mutable std::mutex statsMutex;
+    timestepStats current;
+
+    // order of the CONFIG integrator's energy error in dt
+    static double errorOrder();
+};
+
+
+#endif //N_BODY_SIMULATION_GL_TIMESTEPCONTROLLER_H
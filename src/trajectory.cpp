@@ -0,0 +1,340 @@
+#include "trajectory.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "profiler.h"
+
+static constexpr char magic[8] = {'N', 'B', 'O', 'D', 'Y', 'T', 'R', 'J'};
+static constexpr size_t fileHeaderBytes = 24;
+static constexpr size_t frameHeaderBytes = 32;
+static constexpr std::uint32_t keyframeFlag = 1;
+static constexpr unsigned int maxQuantiseBits = 20;
+
+static void putLittle(unsigned char *out, std::uint64_t value, size_t bytes) {
+    for (size_t b = 0; b < bytes; b++) {
+        out[b] = static_cast<unsigned char>(value >> (8 * b));
+    }
+}
+
+static std::uint64_t getLittle(const unsigned char *in, size_t bytes) {
+    std::uint64_t value = 0;
+    for (size_t b = 0; b < bytes; b++) {
+        value |= static_cast<std::uint64_t>(in[b]) << (8 * b);
+    }
+    return value;
+}
+
+// worst case: a control byte per four values plus four bytes per value, and slack for the
+// unconditional four-byte stores
+size_t columnCodec::maxBytes(size_t n) {
+    return (n + 3) / 4 + 4 * n + 4;
+}
+
+// Prediction from the body's last two recorded values in the integer bit domain, where
+// same-signed floats are ordered: none on keyframes, constant on the frame after, linear after
+// that. Positions and velocities move smoothly between recorded steps, so the residual is small.
+static inline std::uint32_t predict(const std::uint32_t *last, const std::uint32_t *beforeLast, size_t i,
+                                    unsigned int order) {
+    if (order == 0) return 0;
+    if (order == 1) return last[i];
+    return 2 * last[i] - beforeLast[i];
+}
+
+size_t columnCodec::encode(const float *values, std::uint32_t *last, std::uint32_t *beforeLast, size_t n,
+                          unsigned int shift, unsigned int order, unsigned char *out) {
+    unsigned char *control = out;
+    unsigned char *data = out + (n + 3) / 4;
+    std::memset(control, 0, (n + 3) / 4);
+    for (size_t i = 0; i < n; i++) {
+        std::uint32_t bits;
+        std::memcpy(&bits, &values[i], sizeof(bits));
+        bits >>= shift;
+        const std::uint32_t delta = bits - predict(last, beforeLast, i, order);
+        const std::uint32_t residual = (delta << 1) ^ (0u - (delta >> 31)); //zigzag
+        beforeLast[i] = last[i];
+        last[i] = bits;
+        const unsigned int code = (residual > 0xffu) + (residual > 0xffffu) + (residual > 0xffffffu);
+        control[i >> 2] |= static_cast<unsigned char>(code << ((i & 3) * 2));
+        data[0] = static_cast<unsigned char>(residual);
+        data[1] = static_cast<unsigned char>(residual >> 8);
+        data[2] = static_cast<unsigned char>(residual >> 16);
+        data[3] = static_cast<unsigned char>(residual >> 24);
+        data += code + 1;
+    }
+    return static_cast<size_t>(data - out);
+}
+
+size_t columnCodec::decode(const unsigned char *in, const unsigned char *end, std::uint32_t *last,
+                          std::uint32_t *beforeLast, size_t n, unsigned int shift, unsigned int order,
+                          float *values) {
+    const unsigned char *control = in;
+    const unsigned char *data = in + (n + 3) / 4;
+    if (data > end) return 0;
+    for (size_t i = 0; i < n; i++) {
+        const size_t length = ((control[i >> 2] >> ((i & 3) * 2)) & 3u) + 1;
+        if (data + length > end) return 0;
+        const auto residual = static_cast<std::uint32_t>(getLittle(data, length));
+        data += length;
+        const std::uint32_t delta = (residual >> 1) ^ (0u - (residual & 1u));
+        const std::uint32_t bits = predict(last, beforeLast, i, order) + delta;
+        beforeLast[i] = last[i];
+        last[i] = bits;
+        const std::uint32_t restored = bits << shift;
+        std::memcpy(&values[i], &restored, sizeof(restored));
+    }
+    return static_cast<size_t>(data - in);
+}
+
+trajectoryWriter::~trajectoryWriter() {
+    close();
+}
+
+bool trajectoryWriter::open(const std::string &path, const trajectoryOptions &requested) {
+    close();
+    options = requested;
+    options.quantiseBits = std::min(options.quantiseBits, maxQuantiseBits);
+    options.queueFrames = std::max<size_t>(options.queueFrames, 1);
+    options.keyframeInterval = std::max(options.keyframeInterval, 1u);
+
+    framesWritten = 0;
+    framesDropped = 0;
+    stalls = 0;
+    stallNanoseconds = 0;
+    rawBytes = 0;
+    writtenBytes = 0;
+    writeNanoseconds = 0;
+    queued = 0;
+    failed = false;
+
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        failed = true;
+        return false;
+    }
+    std::setvbuf(file, nullptr, _IOFBF, 4 << 20);
+    unsigned char header[fileHeaderBytes] = {};
+    std::memcpy(header, magic, sizeof(magic));
+    putLittle(header + 8, version, 4);
+    putLittle(header + 12, options.quantiseBits, 4);
+    putLittle(header + 16, options.keyframeInterval, 4);
+    if (std::fwrite(header, 1, sizeof(header), file) != sizeof(header)) failed = true;
+    writtenBytes = sizeof(header);
+
+    pool = std::vector<frame>(options.queueFrames);
+    freeFrames.clear();
+    for (auto &f: pool) freeFrames.push_back(&f);
+    queue.clear();
+    closing = false;
+    for (auto &column: last) column.clear();
+    framesSinceKeyframe = 0;
+    writer = std::thread(&trajectoryWriter::writerLoop, this);
+    return true;
+}
+
+void trajectoryWriter::close() {
+    if (!file) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    frameQueued.notify_all();
+    writer.join();
+    if (std::fclose(file) != 0) failed = true;
+    file = nullptr;
+    pool.clear();
+    freeFrames.clear();
+}
+
+bool trajectoryWriter::submit(const BodyStore &bodies, double simulationTime, unsigned long long step) {
+    if (!file || options.interval == 0 || step % options.interval != 0) return true;
+    PROFILE_SCOPE("trajectory submit");
+    frame *f;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (freeFrames.empty()) {
+            if (options.dropWhenFull) {
+                framesDropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            const auto start = std::chrono::steady_clock::now();
+            frameFree.wait(lock, [this] { return !freeFrames.empty(); });
+            stalls.fetch_add(1, std::memory_order_relaxed);
+            stallNanoseconds.fetch_add(static_cast<unsigned long long>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count()), std::memory_order_relaxed);
+        }
+        f = freeFrames.back();
+        freeFrames.pop_back();
+    }
+
+    f->step = step;
+    f->simulationTime = simulationTime;
+    f->columns[0].assign(bodies.x.begin(), bodies.x.end());
+    f->columns[1].assign(bodies.y.begin(), bodies.y.end());
+    f->columns[2].assign(bodies.z.begin(), bodies.z.end());
+    // frames hold world positions
+    if (bodies.origin != glm::dvec3(0.0)) {
+        const glm::vec3 origin(bodies.origin);
+        for (size_t i = 0; i < bodies.size(); i++) {
+            f->columns[0][i] += origin.x;
+            f->columns[1][i] += origin.y;
+            f->columns[2][i] += origin.z;
+        }
+    }
+    f->columns[3].assign(bodies.vx.begin(), bodies.vx.end());
+    f->columns[4].assign(bodies.vy.begin(), bodies.vy.end());
+    f->columns[5].assign(bodies.vz.begin(), bodies.vz.end());
+    rawBytes.fetch_add(6 * sizeof(float) * bodies.size(), std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(f);
+        queued.store(queue.size(), std::memory_order_relaxed);
+    }
+    frameQueued.notify_one();
+    return true;
+}
+
+void trajectoryWriter::writerLoop() {
+    profiler::getInstance().nameThread("trajectory writer");
+    while (true) {
+        frame *f;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            frameQueued.wait(lock, [this] { return closing || !queue.empty(); });
+            if (queue.empty()) return;
+            f = queue.front();
+            queue.pop_front();
+        }
+        write(*f);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            freeFrames.push_back(f);
+            queued.store(queue.size(), std::memory_order_relaxed);
+        }
+        frameFree.notify_one();
+    }
+}
+
+void trajectoryWriter::write(const frame &f) {
+    PROFILE_SCOPE("trajectory write");
+    const auto start = std::chrono::steady_clock::now();
+    const size_t n = f.columns[0].size();
+    const bool keyframe = last[0].size() != n || framesSinceKeyframe >= options.keyframeInterval;
+    if (keyframe) {
+        for (int c = 0; c < 6; c++) {
+            last[c].assign(n, 0);
+            beforeLast[c].assign(n, 0);
+        }
+        framesSinceKeyframe = 0;
+    }
+    const auto order = static_cast<unsigned int>(std::min<unsigned long long>(framesSinceKeyframe, 2));
+    framesSinceKeyframe++;
+
+    encoded.resize(frameHeaderBytes + 6 * columnCodec::maxBytes(n));
+    size_t size = frameHeaderBytes;
+    for (int c = 0; c < 6; c++) {
+        size += columnCodec::encode(f.columns[c].data(), last[c].data(), beforeLast[c].data(), n,
+                                    options.quantiseBits, order, encoded.data() + size);
+    }
+    putLittle(encoded.data(), n, 4);
+    putLittle(encoded.data() + 4, keyframe ? keyframeFlag : 0, 4);
+    putLittle(encoded.data() + 8, f.step, 8);
+    std::uint64_t timeBits;
+    std::memcpy(&timeBits, &f.simulationTime, sizeof(timeBits));
+    putLittle(encoded.data() + 16, timeBits, 8);
+    putLittle(encoded.data() + 24, size - frameHeaderBytes, 8);
+
+    if (std::fwrite(encoded.data(), 1, size, file) != size) failed = true;
+    framesWritten.fetch_add(1, std::memory_order_relaxed);
+    writtenBytes.fetch_add(size, std::memory_order_relaxed);
+    writeNanoseconds.fetch_add(static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count()), std::memory_order_relaxed);
+}
+
+trajectoryStats trajectoryWriter::stats() const {
+    trajectoryStats s;
+    s.framesWritten = framesWritten.load(std::memory_order_relaxed);
+    s.framesDropped = framesDropped.load(std::memory_order_relaxed);
+    s.stalls = stalls.load(std::memory_order_relaxed);
+    s.stallSeconds = static_cast<double>(stallNanoseconds.load(std::memory_order_relaxed)) * 1e-9;
+    s.rawBytes = rawBytes.load(std::memory_order_relaxed);
+    s.writtenBytes = writtenBytes.load(std::memory_order_relaxed);
+    s.writeSeconds = static_cast<double>(writeNanoseconds.load(std::memory_order_relaxed)) * 1e-9;
+    s.queued = queued.load(std::memory_order_relaxed);
+    s.failed = failed.load(std::memory_order_relaxed);
+    return s;
+}
+
+trajectoryReader::~trajectoryReader() {
+    close();
+}
+
+bool trajectoryReader::open(const std::string &path) {
+    close();
+    file = std::fopen(path.c_str(), "rb");
+    if (!file) return false;
+    unsigned char header[fileHeaderBytes];
+    if (std::fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        std::memcmp(header, magic, sizeof(magic)) != 0 || getLittle(header + 8, 4) != trajectoryWriter::version) {
+        close();
+        return false;
+    }
+    shift = static_cast<unsigned int>(getLittle(header + 12, 4));
+    if (shift > maxQuantiseBits || std::fseek(file, 0, SEEK_END) != 0) {
+        close();
+        return false;
+    }
+    fileBytes = static_cast<size_t>(std::ftell(file));
+    std::fseek(file, static_cast<long>(sizeof(header)), SEEK_SET);
+    for (auto &column: last) column.clear();
+    framesSinceKeyframe = 0;
+    return true;
+}
+
+void trajectoryReader::close() {
+    if (file) std::fclose(file);
+    file = nullptr;
+}
+
+bool trajectoryReader::next(trajectoryFrame &out) {
+    if (!file) return false;
+    unsigned char header[frameHeaderBytes];
+    if (std::fread(header, 1, sizeof(header), file) != sizeof(header)) return false;
+    const size_t n = getLittle(header, 4);
+    const bool keyframe = (getLittle(header + 4, 4) & keyframeFlag) != 0;
+    const size_t payload = getLittle(header + 24, 8);
+    if (payload > 6 * columnCodec::maxBytes(n)) return false;
+    //the payload has to be in the file and holds at least a byte per value, which bounds n
+    //before the prediction state is sized for it
+    const auto position = static_cast<size_t>(std::ftell(file));
+    if (payload > fileBytes - std::min(position, fileBytes) || n > payload / 6) return false;
+    if (keyframe) {
+        for (int c = 0; c < 6; c++) {
+            last[c].assign(n, 0);
+            beforeLast[c].assign(n, 0);
+        }
+        framesSinceKeyframe = 0;
+    } else if (last[0].size() != n) {
+        return false;
+    }
+    const auto order = static_cast<unsigned int>(std::min<unsigned long long>(framesSinceKeyframe, 2));
+    framesSinceKeyframe++;
+    encoded.resize(payload);
+    if (std::fread(encoded.data(), 1, payload, file) != payload) return false;
+
+    out.step = getLittle(header + 8, 8);
+    const std::uint64_t timeBits = getLittle(header + 16, 8);
+    std::memcpy(&out.simulationTime, &timeBits, sizeof(timeBits));
+    std::vector<float> *columns[6] = {&out.x, &out.y, &out.z, &out.vx, &out.vy, &out.vz};
+    const unsigned char *cursor = encoded.data();
+    const unsigned char *end = encoded.data() + encoded.size();
+    for (int c = 0; c < 6; c++) {
+        columns[c]->resize(n);
+        const size_t used = columnCodec::decode(cursor, end, last[c].data(), beforeLast[c].data(), n, shift, order,
+                                                columns[c]->data());
+        if (used == 0 && n != 0) return false;
+        cursor += used;
+    }
+    return true;
+}
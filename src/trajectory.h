@@ -0,0 +1,164 @@
+#ifndef N_BODY_SIMULATION_GL_TRAJECTORY_H
+#define N_BODY_SIMULATION_GL_TRAJECTORY_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bodyStore.h"
+
+struct trajectoryOptions {
+    unsigned int interval = 10; //record every interval-th step
+    size_t queueFrames = 4; //frames buffered between the producer and the writer thread
+    unsigned int quantiseBits = 0; //low mantissa bits dropped, 0 = lossless
+    unsigned int keyframeInterval = 64; //frames between frames that decode on their own
+    bool dropWhenFull = false; //false = the producer waits for the writer (back-pressure)
+};
+
+struct trajectoryStats {
+    unsigned long long framesWritten = 0;
+    unsigned long long framesDropped = 0;
+    unsigned long long stalls = 0; //submissions that had to wait for a free frame
+    double stallSeconds = 0.0;
+    unsigned long long rawBytes = 0; //positions and velocities before encoding
+    unsigned long long writtenBytes = 0;
+    double writeSeconds = 0.0; //writer thread time spent encoding and writing
+    size_t queued = 0;
+    bool failed = false;
+};
+
+// The column coder behind trajectory files, shared with the in-memory history. A value is
+// stored as the zigzagged difference between its float bits, shifted right by `shift`, and a
+// prediction from the same body's previous two values: none for order 0, the last value for
+// order 1, their linear extrapolation for order 2. The differences are packed four at a time
+// behind a control byte of 2-bit byte lengths. last / beforeLast carry the previous values
+// from one column to the next and are updated by both calls.
+class columnCodec {
+public:
+    // bytes encode may write for n values
+    static size_t maxBytes(size_t n);
+
+    // returns the bytes written
+    static size_t encode(const float *values, std::uint32_t *last, std::uint32_t *beforeLast, size_t n,
+                         unsigned int shift, unsigned int order, unsigned char *out);
+
+    // returns the bytes consumed, 0 if the column runs past end
+    static size_t decode(const unsigned char *in, const unsigned char *end, std::uint32_t *last,
+                         std::uint32_t *beforeLast, size_t n, unsigned int shift, unsigned int order, float *values);
+};
+
+// One decoded frame
+struct trajectoryFrame {
+    unsigned long long step = 0;
+    double simulationTime = 0.0;
+    std::vector<float> x, y, z;
+    std::vector<float> vx, vy, vz;
+};
+
+// Records positions and velocities of every interval-th step on a background thread. submit()
+// only copies the six columns into a frame from a fixed pool; the writer thread encodes each
+// column as the zigzagged difference between the float bits and a prediction from the same
+// body's previous two recorded values, and packs those four at a time behind a control byte
+// of 2-bit byte lengths. Keyframes predict nothing, so decoding can start at any of them.
+// File layout:
+//   header   magic "NBODYTRJ", version, quantiseBits, keyframeInterval, reserved
+//   frame    body count, flags, step, time, payload bytes, then six encoded columns
+class trajectoryWriter {
+public:
+    static constexpr std::uint32_t version = 1;
+
+    trajectoryWriter() = default;
+
+    ~trajectoryWriter();
+
+    trajectoryWriter(const trajectoryWriter &) = delete;
+
+    trajectoryWriter &operator=(const trajectoryWriter &) = delete;
+
+    bool open(const std::string &path, const trajectoryOptions &options);
+
+    // writes what is queued and stops the writer thread
+    void close();
+
+    [[nodiscard]] bool isOpen() const { return file != nullptr; }
+
+    // called after every step; false if the frame was due but dropped
+    bool submit(const BodyStore &bodies, double simulationTime, unsigned long long step);
+
+    // safe from any thread
+    [[nodiscard]] trajectoryStats stats() const;
+
+private:
+    struct frame {
+        unsigned long long step;
+        double simulationTime;
+        std::vector<float> columns[6];
+    };
+
+    void writerLoop();
+
+    void write(const frame &f);
+
+    trajectoryOptions options;
+    std::FILE *file = nullptr;
+    std::thread writer;
+
+    std::mutex mutex;
+    std::condition_variable frameQueued;
+    std::condition_variable frameFree;
+    std::vector<frame> pool;
+    std::vector<frame *> freeFrames;
+    std::deque<frame *> queue;
+    bool closing = false;
+
+    //writer thread only
+    std::vector<std::uint32_t> last[6], beforeLast[6];
+    std::vector<unsigned char> encoded;
+    unsigned long long framesSinceKeyframe = 0;
+
+    std::atomic<unsigned long long> framesWritten{0};
+    std::atomic<unsigned long long> framesDropped{0};
+    std::atomic<unsigned long long> stalls{0};
+    std::atomic<unsigned long long> stallNanoseconds{0};
+    std::atomic<unsigned long long> rawBytes{0};
+    std::atomic<unsigned long long> writtenBytes{0};
+    std::atomic<unsigned long long> writeNanoseconds{0};
+    std::atomic<size_t> queued{0};
+    std::atomic<bool> failed{false};
+};
+
+// Sequential decoder for files written by trajectoryWriter
+class trajectoryReader {
+public:
+    trajectoryReader() = default;
+
+    ~trajectoryReader();
+
+    trajectoryReader(const trajectoryReader &) = delete;
+
+    trajectoryReader &operator=(const trajectoryReader &) = delete;
+
+    bool open(const std::string &path);
+
+    void close();
+
+    // false at the end of the file or on a corrupt frame
+    bool next(trajectoryFrame &out);
+
+    [[nodiscard]] unsigned int quantiseBits() const { return shift; }
+
+private:
+    std::FILE *file = nullptr;
+    size_t fileBytes = 0;
+    unsigned int shift = 0;
+    std::vector<std::uint32_t> last[6], beforeLast[6];
+    std::vector<unsigned char> encoded;
+    unsigned long long framesSinceKeyframe = 0;
+};
+
+
+#endif //N_BODY_SIMULATION_GL_TRAJECTORY_H
@@ -0,0 +1,40 @@
+#ifndef N_BODY_SIMULATION_GL_TRIPLEBUFFER_H
+#define N_BODY_SIMULATION_GL_TRIPLEBUFFER_H
+#include <atomic>
+
+// Lock-free single-producer / single-consumer triple buffer. The writer fills back() and
+// publishes it, the reader picks up the newest published slot with acquire(). Neither side
+// ever waits for the other; the reader simply keeps its current slot until a newer one exists.
+template<typename T>
+class tripleBuffer {
+public:
+    // writer side
+    T &back() { return slots[backIndex]; }
+
+    void publish() {
+        const unsigned int previous = middle.exchange(backIndex | freshBit, std::memory_order_acq_rel);
+        backIndex = previous & indexMask;
+    }
+
+    // reader side, returns true if a newer slot was picked up
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & freshBit)) return false;
+        const unsigned int previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & indexMask;
+        return true;
+    }
+
+    const T &front() const { return slots[frontIndex]; }
+
+private:
+    static constexpr unsigned int indexMask = 3;
+    static constexpr unsigned int freshBit = 4;
+
+    T slots[3];
+    std::atomic<unsigned int> middle{2};
+    unsigned int backIndex = 0;
+    unsigned int frontIndex = 1;
+};
+
+
+#endif //N_BODY_SIMULATION_GL_TRIPLEBUFFER_H
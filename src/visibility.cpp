@@ -0,0 +1,75 @@
+#include "visibility.h"
+#include <cmath>
+
+void visibility::frustumPlanes(const glm::mat4 &m, glm::vec4 (&planes)[6]) {
+    const glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    const glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    const glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    const glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    planes[0] = row3 + row0; //left
+    planes[1] = row3 - row0; //right
+    planes[2] = row3 + row1; //bottom
+    planes[3] = row3 - row1; //top
+    planes[4] = row3 + row2; //near
+    planes[5] = row3 - row2; //far
+    for (auto &plane: planes) {
+        plane /= std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+    }
+}
+
+void visibility::classify(const BodyStore &bodies, const glm::mat4 &viewProjection, const glm::vec3 &eye,
+                          const glm::vec3 &forward, float pixelScale,
+                          const float (&minPixels)[visibleSet::levels - 1], visibleSet &out) {
+    constexpr unsigned int levels = visibleSet::levels;
+    const size_t n = bodies.size();
+    glm::vec4 planes[6];
+    frustumPlanes(viewProjection, planes);
+    // the planes and the eye move into the store's origin-relative frame instead of every body
+    // into world space
+    const glm::vec3 origin(bodies.origin);
+    for (auto &plane: planes) {
+        plane.w += plane.x * origin.x + plane.y * origin.y + plane.z * origin.z;
+    }
+    const glm::vec3 relativeEye = eye - origin;
+
+    // pass 1: a level per body, levels = culled. Branch-free and without the histogram so it
+    // vectorises
+    out.levelOf.resize(n);
+    unsigned char *levelOf = out.levelOf.data();
+    const float *x = bodies.x.data(), *y = bodies.y.data(), *z = bodies.z.data(), *r = bodies.radius.data();
+    for (size_t i = 0; i < n; i++) {
+        bool inside = true;
+        for (const auto &plane: planes) {
+            inside &= plane.x * x[i] + plane.y * y[i] + plane.z * z[i] + plane.w >= -r[i];
+        }
+        const float depth = (x[i] - relativeEye.x) * forward.x + (y[i] - relativeEye.y) * forward.y +
+                            (z[i] - relativeEye.z) * forward.z;
+        // depth below the radius means the camera is at or inside the sphere: finest mesh
+        const float pixels = depth > r[i] ? r[i] * pixelScale / depth : minPixels[0];
+        unsigned int level = 0;
+        for (unsigned int l = 0; l + 1 < levels; l++) {
+            level += pixels < minPixels[l];
+        }
+        levelOf[i] = static_cast<unsigned char>(inside ? level : levels);
+    }
+    size_t counts[levels + 1] = {};
+    for (size_t i = 0; i < n; i++) {
+        counts[levelOf[i]]++;
+    }
+
+    // pass 2: scatter the visible indices into contiguous buckets
+    size_t offset = 0;
+    for (unsigned int l = 0; l < levels; l++) {
+        out.first[l] = offset;
+        out.count[l] = counts[l];
+        offset += counts[l];
+    }
+    out.visible = offset;
+    out.indices.resize(offset);
+    size_t next[levels];
+    for (unsigned int l = 0; l < levels; l++) next[l] = out.first[l];
+    for (size_t i = 0; i < n; i++) {
+        const unsigned int level = levelOf[i];
+        if (level < levels) out.indices[next[level]++] = static_cast<unsigned int>(i);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef N_BODY_SIMULATION_GL_VISIBILITY_H
+#define N_BODY_SIMULATION_GL_VISIBILITY_H
+#include <cstddef>
+#include <vector>
+#include "glm/mat4x4.hpp"
+#include "glm/vec3.hpp"
+#include "glm/vec4.hpp"
+#include "bodyStore.h"
+
+// Bodies that survive frustum culling, grouped by sphere level of detail
+struct visibleSet {
+    static constexpr unsigned int levels = 4; //0 = finest mesh
+
+    std::vector<unsigned int> indices; //level 0 bodies first, then level 1, ...
+    size_t first[levels] = {};
+    size_t count[levels] = {};
+    size_t visible = 0;
+
+    std::vector<unsigned char> levelOf; //scratch, per body, levels = culled
+};
+
+// CPU culling and LOD selection for the instanced spheres, free of GL like instancePacking so
+// its cost can be measured headless
+class visibility {
+public:
+    // Gribb-Hartmann planes of clip = viewProjection * world, normalised, pointing inwards
+    static void frustumPlanes(const glm::mat4 &viewProjection, glm::vec4 (&planes)[6]);
+
+    // Culls every body against the frustum and buckets the rest by projected radius in pixels,
+    // radius * pixelScale / depth where depth is along the view direction. pixelScale is the
+    // viewport height / (2 tan(fovy / 2)); a body uses level l when its projected radius is
+    // below minPixels[l - 1].
+    static void classify(const BodyStore &bodies, const glm::mat4 &viewProjection, const glm::vec3 &eye,
+                         const glm::vec3 &forward, float pixelScale,
+                         const float (&minPixels)[visibleSet::levels - 1], visibleSet &out);
+};
+
+
+#endif //N_BODY_SIMULATION_GL_VISIBILITY_H